@@ -0,0 +1,418 @@
+/*
+ * bench/lookup.c: Compare lookups with and without a json_index.
+ *
+ * Usage: bench_lookup [ITEMS [ITERATIONS]]
+ *
+ * The document is an object holding an array of ITEMS objects, and the
+ * benchmark looks up "items[i].id" for every i, then gets them all with a loop
+ * and with the query "items[*].id".  A second document is one object with
+ * ITEMS keys, and the benchmark looks up each of them.  Finally, the "name" of
+ * each item is read, with and without copying, and a few paths in
+ * test/twitapi.h are looked up, with and without compiling them, and all at
+ * once as a set.  Lastly, ITEMS coordinates and integers are converted by
+ * json_number_get() and friends, and by strtod() and strtoll() for comparison,
+ * and the integers are read again as decoded by json_easy_parse_ints().  The
+ * lookups in the first two documents are also done on a json_tape.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nosj.h"
+#include "twitapi.h"
+
+static const char *paths[] = {
+	"id_str",
+	"user.screen_name",
+	"user.followers_count",
+	"user.entities.url.urls[0].indices[1]",
+	"entities.hashtags",
+	"retweet_count",
+	"in_reply_to_status_id",
+	"user.profile_image_url_https",
+};
+#define NPATHS (sizeof(paths) / sizeof(paths[0]))
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *make_doc(long items)
+{
+	char *buf = malloc(items * 64 + 64);
+	size_t len = 0;
+
+	len += sprintf(buf, "{\"items\": [");
+	for (long i = 0; i < items; i++)
+		len += sprintf(buf + len, "%s{\"id\": %ld, \"name\": \"n%ld\"}",
+		               i ? ", " : "", i, i);
+	sprintf(buf + len, "]}");
+	return buf;
+}
+
+static char *make_wide_doc(long items)
+{
+	char *buf = malloc(items * 32 + 64);
+	size_t len = 0;
+
+	len += sprintf(buf, "{");
+	for (long i = 0; i < items; i++)
+		len += sprintf(buf + len, "%s\"field_%ld\": %ld", i ? ", " : "",
+		               i, i);
+	sprintf(buf + len, "}");
+	return buf;
+}
+
+static char *make_number_doc(long items)
+{
+	char *buf = malloc(items * 48 + 64);
+	size_t len = 0;
+
+	srand(1);
+	len += sprintf(buf, "[");
+	for (long i = 0; i < items; i++)
+		len += sprintf(buf + len, "%s%.6f, %.6f, %d", i ? ", " : "",
+		               rand() / (RAND_MAX / 180.0) - 90,
+		               rand() / (RAND_MAX / 360.0) - 180, rand());
+	sprintf(buf + len, "]");
+	return buf;
+}
+
+static void report(const char *name, double secs, long lookups)
+{
+	printf("%-28s %10.1f ns/lookup\n", name, secs / lookups * 1e9);
+}
+
+static int bench_lookups(const char *name, struct json_easy *easy, long items,
+                         long iters)
+{
+	char expr[64];
+	uint32_t index;
+	double start = now();
+	int rv;
+
+	for (long n = 0; n < iters; n++) {
+		for (long i = 0; i < items; i++) {
+			snprintf(expr, sizeof(expr), "items[%ld].id", i);
+			if ((rv = json_easy_lookup(easy, 0, expr, &index)))
+				return rv;
+		}
+	}
+	report(name, now() - start, items * iters);
+	return 0;
+}
+
+static int bench_strings(struct json_easy *easy, long items, long iters)
+{
+	uint32_t index, len;
+	const char *view;
+	char *copy;
+	size_t total = 0;
+	double start;
+	int rv;
+
+	start = now();
+	for (long n = 0; n < iters; n++) {
+		json_easy_for_each(index, easy, 2) {
+			if ((rv = json_easy_string_get(easy, index + 4, &copy)))
+				return rv;
+			total += strlen(copy);
+			free(copy);
+		}
+	}
+	report("json_easy_string_get", now() - start, items * iters);
+
+	start = now();
+	for (long n = 0; n < iters; n++) {
+		json_easy_for_each(index, easy, 2) {
+			if ((rv = json_easy_string_view(easy, index + 4, NULL,
+			                                &view, &len)))
+				return rv;
+			total += len;
+		}
+	}
+	report("json_easy_string_view", now() - start, items * iters);
+	return total ? 0 : JSONERR_LOOKUP;
+}
+
+static int bench_query(struct json_easy *easy, long items, long iters)
+{
+	uint32_t *out = malloc(items * sizeof(*out)), count, index, elem;
+	struct json_path *path;
+	double start;
+	int rv;
+
+	start = now();
+	for (long n = 0; n < iters; n++) {
+		count = 0;
+		json_easy_for_each(elem, easy, 2) {
+			if ((rv = json_easy_object_get(easy, elem, "id", &index)))
+				return rv;
+			out[count++] = index;
+		}
+	}
+	report("loop over items[i].id", now() - start, items * iters);
+
+	if ((rv = json_path_compile("items[*].id", &path, NULL)))
+		return rv;
+	start = now();
+	for (long n = 0; n < iters; n++)
+		json_easy_path_select(easy, path, 0, out, items, &count);
+	report("json_path_select", now() - start, items * iters);
+	json_path_free(path);
+	free(out);
+	return count == items ? 0 : JSONERR_LOOKUP;
+}
+
+static int bench_keys(const char *name, struct json_easy *easy, long items,
+                      long iters)
+{
+	char key[64];
+	uint32_t index;
+	double start = now();
+	int rv;
+
+	for (long n = 0; n < iters; n++) {
+		for (long i = 0; i < items; i++) {
+			snprintf(key, sizeof(key), "field_%ld", i);
+			if ((rv = json_easy_object_get(easy, 0, key, &index)))
+				return rv;
+		}
+	}
+	report(name, now() - start, items * iters);
+	return 0;
+}
+
+static int bench_tape(const char *doc, bool wide, long items, long iters)
+{
+	struct json_tape tape;
+	uint32_t index, elem;
+	char key[64];
+	double start;
+	int rv;
+
+	json_tape_init(&tape, doc, strlen(doc));
+	if ((rv = json_tape_parse(&tape)))
+		goto out;
+	start = now();
+	for (long n = 0; n < iters; n++) {
+		for (long i = 0; i < items; i++) {
+			if (wide) {
+				snprintf(key, sizeof(key), "field_%ld", i);
+				rv = json_tape_object_get(&tape, 0, key,
+				                          &index);
+			} else {
+				snprintf(key, sizeof(key), "items[%ld].id", i);
+				rv = json_tape_lookup(&tape, 0, key, &index);
+			}
+			if (rv)
+				goto out;
+		}
+	}
+	report(wide ? "json_tape_object_get" : "json_tape_lookup",
+	       now() - start, items * iters);
+	if (wide)
+		goto out;
+
+	start = now();
+	for (long n = 0; n < iters; n++) {
+		json_tape_for_each(elem, &tape, 2) {
+			if ((rv = json_tape_object_get(&tape, elem, "id",
+			                               &index)))
+				goto out;
+		}
+	}
+	report("tape loop over items[i].id", now() - start, items * iters);
+out:
+	json_tape_destroy(&tape);
+	return rv;
+}
+
+static int bench_paths(long iters)
+{
+	struct json_path *compiled[NPATHS];
+	struct json_path_set *set;
+	struct json_easy easy;
+	uint32_t index, results[NPATHS];
+	int errors[NPATHS];
+	double start;
+	int rv;
+
+	json_easy_init(&easy, twitapi_json);
+	if ((rv = json_easy_parse(&easy)))
+		return rv;
+	for (size_t i = 0; i < NPATHS; i++)
+		if ((rv = json_path_compile(paths[i], &compiled[i], NULL)))
+			return rv;
+
+	start = now();
+	for (long n = 0; n < iters; n++)
+		for (size_t i = 0; i < NPATHS; i++)
+			if ((rv = json_easy_lookup(&easy, 0, paths[i], &index)))
+				return rv;
+	report("json_lookup (twitapi)", now() - start, iters * NPATHS);
+
+	start = now();
+	for (long n = 0; n < iters; n++)
+		for (size_t i = 0; i < NPATHS; i++)
+			if ((rv = json_easy_path_eval(&easy, compiled[i], 0,
+			                              &index)))
+				return rv;
+	report("json_path_eval (twitapi)", now() - start, iters * NPATHS);
+
+	if ((rv = json_path_set_build(compiled, NPATHS, &set)))
+		return rv;
+	start = now();
+	for (long n = 0; n < iters; n++)
+		if ((rv = json_easy_path_set_eval(&easy, set, 0, results,
+		                                  errors)))
+			return rv;
+	report("json_path_set_eval (twitapi)", now() - start, iters * NPATHS);
+	json_path_set_free(set);
+
+	for (size_t i = 0; i < NPATHS; i++)
+		json_path_free(compiled[i]);
+	json_easy_destroy(&easy);
+	return 0;
+}
+
+static int bench_numbers(long items, long iters)
+{
+	char *doc = make_number_doc(items);
+	struct json_easy easy;
+	uint32_t index;
+	double start, d, sum = 0;
+	int64_t n;
+	int rv;
+
+	json_easy_init(&easy, doc);
+	if ((rv = json_easy_parse(&easy)))
+		goto out;
+
+	start = now();
+	for (long k = 0; k < iters; k++) {
+		json_easy_for_each(index, &easy, 0) {
+			d = strtod(doc + easy.tokens[index].start, NULL);
+			sum += d;
+		}
+	}
+	report("strtod", now() - start, items * iters * 3);
+
+	start = now();
+	for (long k = 0; k < iters; k++) {
+		json_easy_for_each(index, &easy, 0) {
+			if ((rv = json_easy_number_get(&easy, index, &d)))
+				goto out;
+			sum += d;
+		}
+	}
+	report("json_number_get", now() - start, items * iters * 3);
+
+	start = now();
+	for (long k = 0; k < iters; k++) {
+		for (index = 3; index < easy.tokens_len; index += 3) {
+			n = strtoll(doc + easy.tokens[index].start, NULL, 10);
+			sum += n;
+		}
+	}
+	report("strtoll", now() - start, items * iters);
+
+	start = now();
+	for (long k = 0; k < iters; k++) {
+		for (index = 3; index < easy.tokens_len; index += 3) {
+			if ((rv = json_easy_number_getint(&easy, index, &n)))
+				goto out;
+			sum += n;
+		}
+	}
+	report("json_number_getint", now() - start, items * iters);
+
+	// Again, reading the values decoded while parsing.
+	if ((rv = json_easy_parse_ints(&easy)))
+		goto out;
+	start = now();
+	for (long k = 0; k < iters; k++) {
+		for (index = 3; index < easy.tokens_len; index += 3) {
+			if ((rv = json_easy_number_getint(&easy, index, &n)))
+				goto out;
+			sum += n;
+		}
+	}
+	report("json_int_get", now() - start, items * iters);
+	rv = sum != 0 ? 0 : JSONERR_LOOKUP;
+out:
+	json_easy_destroy(&easy);
+	free(doc);
+	return rv;
+}
+
+int main(int argc, char **argv)
+{
+	long items = 10000, iters = 3;
+	struct json_easy easy;
+	char *doc;
+	int rv;
+
+	if (argc > 1)
+		items = strtol(argv[1], NULL, 10);
+	if (argc > 2)
+		iters = strtol(argv[2], NULL, 10);
+
+	doc = make_doc(items);
+	json_easy_init(&easy, doc);
+	rv = json_easy_parse(&easy);
+	if (!rv)
+		rv = bench_lookups("json_lookup", &easy, items, iters);
+	if (!rv)
+		rv = bench_query(&easy, items, iters);
+	if (!rv)
+		rv = bench_tape(doc, false, items, iters);
+	if (!rv)
+		rv = json_easy_index(&easy, SIZE_MAX);
+	if (!rv)
+		rv = bench_lookups("json_index_lookup", &easy, items, iters);
+	if (!rv)
+		rv = bench_strings(&easy, items, iters);
+	if (rv) {
+		fprintf(stderr, "error: %s\n", json_strerror(rv));
+		return 1;
+	}
+	json_easy_destroy(&easy);
+	free(doc);
+
+	doc = make_wide_doc(items);
+	json_easy_init(&easy, doc);
+	rv = json_easy_parse(&easy);
+	if (!rv)
+		rv = bench_keys("json_object_get", &easy, items, iters);
+	if (!rv)
+		rv = bench_tape(doc, true, items, iters);
+	if (!rv)
+		rv = json_easy_parse_hashed(&easy);
+	if (!rv)
+		rv = bench_keys("json_object_get_hashed", &easy, items, iters);
+	if (!rv)
+		rv = json_easy_index(&easy, SIZE_MAX);
+	if (!rv)
+		rv = bench_keys("json_index_object_get", &easy, items, iters);
+	if (rv) {
+		fprintf(stderr, "error: %s\n", json_strerror(rv));
+		return 1;
+	}
+	json_easy_destroy(&easy);
+	free(doc);
+
+	rv = bench_paths(items * iters);
+	if (!rv)
+		rv = bench_numbers(items, iters);
+	if (rv) {
+		fprintf(stderr, "error: %s\n", json_strerror(rv));
+		return 1;
+	}
+	return 0;
+}
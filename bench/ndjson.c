@@ -0,0 +1,120 @@
+/*
+ * bench/ndjson.c: Compare the serial NDJSON reader against
+ * json_ndjson_parallel() with increasing numbers of threads.
+ *
+ * Usage: bench_ndjson [FILE [ITERATIONS]]
+ *
+ * Without a file, the input is many copies of the Twitter API example from
+ * the test suite, one per line.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nosj.h"
+#include "twitapi.h"
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *read_file(const char *filename, size_t *len)
+{
+	FILE *f = fopen(filename, "rb");
+	char *buf;
+
+	if (!f)
+		return NULL;
+	fseek(f, 0, SEEK_END);
+	*len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	buf = malloc(*len + 1);
+	if (buf && fread(buf, 1, *len, f) != *len) {
+		free(buf);
+		buf = NULL;
+	}
+	fclose(f);
+	return buf;
+}
+
+/*
+ * Join copies of the example onto single lines.
+ */
+static char *make_input(size_t copies, size_t *len)
+{
+	size_t doclen = strlen(twitapi_json);
+	char *buf = malloc(copies * (doclen + 1));
+
+	*len = 0;
+	for (size_t i = 0; i < copies; i++) {
+		for (size_t j = 0; j < doclen; j++)
+			if (twitapi_json[j] != '\n')
+				buf[(*len)++] = twitapi_json[j];
+		buf[(*len)++] = '\n';
+	}
+	return buf;
+}
+
+static void report(const char *name, double secs, size_t bytes, long iters)
+{
+	printf("%-24s %10.3f ms %10.1f MB/s\n", name, secs / iters * 1e3,
+	       (double)bytes * iters / secs / 1e6);
+}
+
+static int count(struct json_ndjson *nd, void *arg)
+{
+	(void)nd;
+	(void)arg;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	size_t len;
+	char *input;
+	long iters = 5;
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	double start;
+	char name[64];
+
+	if (argc > 1) {
+		if (!(input = read_file(argv[1], &len))) {
+			perror(argv[1]);
+			return 1;
+		}
+	} else {
+		input = make_input(20000, &len);
+	}
+	if (argc > 2)
+		iters = strtol(argv[2], NULL, 10);
+
+	start = now();
+	for (long i = 0; i < iters; i++) {
+		struct json_ndjson nd;
+		json_ndjson_init(&nd, input, len);
+		while (json_ndjson_next(&nd))
+			;
+		json_ndjson_destroy(&nd);
+	}
+	report("json_ndjson_next", now() - start, len, iters);
+
+	for (long t = 1; t <= ncpu; t *= 2) {
+		for (int ordered = 0; ordered <= 1; ordered++) {
+			start = now();
+			for (long i = 0; i < iters; i++)
+				json_ndjson_parallel(input, len, t, ordered,
+				                     count, NULL);
+			snprintf(name, sizeof(name), "parallel %s x%ld",
+			         ordered ? "ordered" : "unordered", t);
+			report(name, now() - start, len, iters);
+		}
+	}
+	free(input);
+	return 0;
+}
@@ -0,0 +1,271 @@
+/*
+ * bench/parse.c: Compare the two-pass json_parse() idiom against the
+ * single-pass json_easy_parse(), and json_parse() against json_parse_indexed()
+ * given a buffer of the right size.  Also times json_easy_parse_parallel() with
+ * one thread per CPU, the stream parser, fed in 64 KiB chunks, the lazy
+ * parser, which tokenizes only the top level, and a projected parse, which
+ * tokenizes only what some paths select.  Lastly, json_format() to /dev/null
+ * is timed against json_write() into memory, indented and compact.
+ *
+ * Usage: bench_parse [FILE [ITERATIONS [PATH...]]]
+ *
+ * Without a file, the Twitter API example from the test suite is used.  The
+ * paths for the projected parse default to "user.id" and
+ * "entities.urls[*].url", which suit it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nosj.h"
+#include "twitapi.h"
+
+static char *default_paths[] = { "user.id", "entities.urls[*].url" };
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *read_file(const char *filename)
+{
+	FILE *f = fopen(filename, "rb");
+	char *buf;
+	long len;
+
+	if (!f)
+		return NULL;
+	fseek(f, 0, SEEK_END);
+	len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	buf = malloc(len + 1);
+	if (buf && fread(buf, 1, len, f) != (size_t)len) {
+		free(buf);
+		buf = NULL;
+	} else if (buf) {
+		buf[len] = '\0';
+	}
+	fclose(f);
+	return buf;
+}
+
+static void report(const char *name, double secs, size_t bytes, long iters)
+{
+	printf("%-24s %10.3f us/doc %10.1f MB/s\n", name, secs / iters * 1e6,
+	       (double)bytes * iters / secs / 1e6);
+}
+
+static int bench_two_pass(const char *input, long iters)
+{
+	double start = now();
+	for (long i = 0; i < iters; i++) {
+		struct json_parser p = json_parse(input, NULL, 0);
+		struct json_token *tokens;
+		if (p.error != JSON_OK)
+			return p.error;
+		tokens = calloc(p.tokenidx, sizeof(*tokens));
+		p = json_parse(input, tokens, p.tokenidx);
+		free(tokens);
+	}
+	report("two-pass json_parse", now() - start, strlen(input), iters);
+	return 0;
+}
+
+static int bench_easy(const char *input, long iters)
+{
+	double start = now();
+	for (long i = 0; i < iters; i++) {
+		struct json_easy easy;
+		int rv;
+		json_easy_init(&easy, input);
+		rv = json_easy_parse(&easy);
+		json_easy_destroy(&easy);
+		if (rv != JSON_OK)
+			return rv;
+	}
+	report("json_easy_parse", now() - start, strlen(input), iters);
+	return 0;
+}
+
+static int bench_easy_parallel(const char *input, long iters)
+{
+	double start = now();
+	for (long i = 0; i < iters; i++) {
+		struct json_easy easy;
+		int rv;
+		json_easy_init(&easy, input);
+		rv = json_easy_parse_parallel(&easy, 0);
+		json_easy_destroy(&easy);
+		if (rv != JSON_OK)
+			return rv;
+	}
+	report("json_easy_parse_parallel", now() - start, strlen(input), iters);
+	return 0;
+}
+
+static int bench_tokenize(const char *name,
+                          struct json_parser (*parse)(const char *,
+                                                      struct json_token *,
+                                                      uint32_t),
+                          const char *input, long iters)
+{
+	struct json_parser p = json_parse(input, NULL, 0);
+	struct json_token *tokens;
+	double start;
+
+	if (p.error != JSON_OK)
+		return p.error;
+	tokens = calloc(p.tokenidx, sizeof(*tokens));
+	start = now();
+	for (long i = 0; i < iters; i++)
+		parse(input, tokens, p.tokenidx);
+	report(name, now() - start, strlen(input), iters);
+	free(tokens);
+	return 0;
+}
+
+static int bench_lazy(const char *input, long iters)
+{
+	double start = now();
+	for (long i = 0; i < iters; i++) {
+		struct json_lazy lz;
+		int rv;
+		json_lazy_init(&lz, input, strlen(input));
+		rv = json_lazy_parse(&lz);
+		json_lazy_destroy(&lz);
+		if (rv != JSON_OK)
+			return rv;
+	}
+	report("json_lazy_parse", now() - start, strlen(input), iters);
+	return 0;
+}
+
+static int bench_projected(const char *input, long iters, char **exprs,
+                           int nexprs)
+{
+	struct json_path *paths[16];
+	struct json_easy easy;
+	uint32_t full;
+	double start;
+	int rv = 0, n;
+
+	for (n = 0; n < nexprs && n < 16; n++)
+		if ((rv = json_path_compile(exprs[n], &paths[n], NULL)))
+			goto out;
+	full = json_parse(input, NULL, 0).tokenidx;
+	json_easy_init(&easy, input);
+	start = now();
+	for (long i = 0; i < iters && !rv; i++)
+		rv = json_easy_parse_projected(&easy, paths, n);
+	if (!rv) {
+		report("projected parse", now() - start,
+		       strlen(input), iters);
+		printf("%-24s %10u of %u tokens\n", "", easy.tokens_len, full);
+	}
+	json_easy_destroy(&easy);
+out:
+	while (n--)
+		json_path_free(paths[n]);
+	return rv;
+}
+
+static int bench_stream(const char *input, long iters)
+{
+	size_t len = strlen(input);
+	double start = now();
+	for (long i = 0; i < iters; i++) {
+		struct json_stream s;
+		struct json_parser p;
+		if (json_stream_init(&s))
+			return JSONERR_NOMEM;
+		for (size_t off = 0; off < len; off += 65536)
+			json_stream_feed(&s, input + off,
+			                 len - off < 65536 ? len - off : 65536);
+		p = json_stream_finish(&s);
+		json_stream_destroy(&s);
+		if (p.error != JSON_OK)
+			return p.error;
+	}
+	report("json_stream_feed", now() - start, len, iters);
+	return 0;
+}
+
+static int bench_format(const char *input, long iters)
+{
+	struct json_easy easy;
+	struct json_writer w;
+	double start;
+	FILE *null;
+	int rv;
+
+	json_easy_init(&easy, input);
+	if ((rv = json_easy_parse(&easy)) || !(null = fopen("/dev/null", "w")))
+		goto out;
+	start = now();
+	for (long i = 0; i < iters; i++)
+		json_easy_format(&easy, 0, null);
+	report("json_format", now() - start, strlen(input), iters);
+	fclose(null);
+
+	json_writer_init(&w);
+	for (int indent = 2; indent >= 0 && !rv; indent -= 2) {
+		w.indent = indent;
+		start = now();
+		for (long i = 0; i < iters && !rv; i++) {
+			w.len = 0;
+			rv = json_easy_write(&easy, &w, 0);
+		}
+		report(indent ? "json_write" : "json_write (compact)",
+		       now() - start, strlen(input), iters);
+	}
+	json_writer_destroy(&w);
+out:
+	json_easy_destroy(&easy);
+	return rv;
+}
+
+int main(int argc, char **argv)
+{
+	char *input = twitapi_json;
+	long iters = 20000;
+	int rv;
+
+	if (argc > 1 && !(input = read_file(argv[1]))) {
+		perror(argv[1]);
+		return 1;
+	}
+	if (argc > 2)
+		iters = strtol(argv[2], NULL, 10);
+
+	rv = bench_two_pass(input, iters);
+	if (!rv)
+		rv = bench_easy(input, iters);
+	if (!rv)
+		rv = bench_easy_parallel(input, iters);
+	if (!rv)
+		rv = bench_tokenize("json_parse", json_parse, input, iters);
+	if (!rv)
+		rv = bench_tokenize("json_parse_indexed", json_parse_indexed,
+		                    input, iters);
+	if (!rv)
+		rv = bench_stream(input, iters);
+	if (!rv)
+		rv = bench_lazy(input, iters);
+	if (!rv && argc > 3)
+		rv = bench_projected(input, iters, argv + 3, argc - 3);
+	else if (!rv)
+		rv = bench_projected(input, iters, default_paths, 2);
+	if (!rv)
+		rv = bench_format(input, iters);
+	if (rv) {
+		fprintf(stderr, "parse error: %s\n", json_strerror(rv));
+		return 1;
+	}
+	if (input != twitapi_json)
+		free(input);
+	return 0;
+}
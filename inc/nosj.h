@@ -41,14 +41,33 @@ enum json_type {
  */
 struct json_token {
 
+#ifdef NOSJ_COMPACT_TOKENS
+	/*
+	 * The compact layout shares one word between the type, the plain flag
+	 * and the start, making a token 12 bytes rather than 16, at the cost of
+	 * limiting inputs to NOSJ_MAX_INPUT bytes.
+	 */
+	uint32_t type : 3;
+	uint32_t plain : 1;
+	uint32_t start : 28;
+#else
 	/**
 	 * @brief Type of the token.
 	 */
-	enum json_type type;
+	enum json_type type : 8;
+	/**
+	 * @brief For strings, set if the string contains no escapes.
+	 *
+	 * Its contents are then exactly the @a length bytes after the opening
+	 * quote, so they can be compared or copied without decoding.  Always
+	 * clear for other tokens.
+	 */
+	uint32_t plain : 1;
 	/**
 	 * @brief Index of the first character of the token in the string.
 	 */
 	uint32_t start;
+#endif
 	/**
 	 * @brief For tokens that can have a length, this is the length!
 	 *
@@ -68,6 +87,19 @@ struct json_token {
 	uint32_t next;
 };
 
+/**
+ * @brief Length in bytes of the longest input which can be tokenized.
+ *
+ * With NOSJ_COMPACT_TOKENS defined (see the compact_tokens meson option),
+ * token offsets have 28 bits, so this is 256 MiB less one byte.  Parsing a
+ * longer input fails with JSONERR_NOMEM.
+ */
+#ifdef NOSJ_COMPACT_TOKENS
+#define NOSJ_MAX_INPUT 0x0fffffffu
+#else
+#define NOSJ_MAX_INPUT UINT32_MAX
+#endif
+
 /**
  * @brief Errors that could be encountered in JSON parsing.
  */
@@ -120,6 +152,22 @@ enum json_error {
 	 * @brief The number provided is not an integer
 	 */
 	JSONERR_NOT_INT,
+	/**
+	 * @brief Memory allocation failed
+	 */
+	JSONERR_NOMEM,
+	/**
+	 * @brief Objects and arrays are nested too deeply
+	 */
+	JSONERR_TOO_DEEP,
+	/**
+	 * @brief A file could not be opened, read, written or mapped
+	 */
+	JSONERR_IO,
+	/**
+	 * @brief Saved tokens don't match the input, or this build of nosj
+	 */
+	JSONERR_STALE,
 
 	_LAST_JSONERR,
 };
@@ -153,6 +201,27 @@ struct json_parser {
 	enum json_error error;
 };
 
+/**
+ * @brief The integer value of a number token, decoded during parsing.
+ *
+ * See `json_parse_ints_n()`.
+ */
+struct json_int {
+	/**
+	 * @brief Magnitude of the value, if it is an integer.
+	 */
+	uint64_t mag;
+	/**
+	 * @brief Set if the number is written as an integer (no fraction or
+	 * exponent) whose magnitude fits in 64 bits.
+	 */
+	bool integer;
+	/**
+	 * @brief Set if the number has a minus sign.
+	 */
+	bool neg;
+};
+
 /**
  * @brief Parse JSON into tokens.
  *
@@ -164,6 +233,10 @@ struct json_parser {
  * with arr=NULL, and it will return the number of tokens it would have parsed
  * as part of the `json_parser` return value (``textidx``).
  *
+ * The parser does not recurse: objects and arrays nested more deeply than a
+ * build-time limit (1024 by default) fail with JSONERR_TOO_DEEP, rather than
+ * risking the C stack.
+ *
  * @param json The text buffer to parse.
  * @param arr A buffer to put the tokens in.  May be null.
  * @param n The number of slots in the arr buffer.
@@ -172,6 +245,181 @@ struct json_parser {
 struct json_parser json_parse(const char *json, struct json_token *arr,
                               uint32_t n);
 
+/**
+ * @brief Parse JSON of a known length into tokens.
+ *
+ * This is just like `json_parse()`, but the input need not be NUL-terminated:
+ * no byte at or past `json[len]` is read, so you can parse directly out of a
+ * receive buffer or a read-only memory mapping.  Input which ends before the
+ * JSON value does results in JSONERR_PREMATURE_EOF, as if the input had been
+ * NUL-terminated at `len`.
+ *
+ * @param json The text buffer to parse.
+ * @param len The length of the text buffer.
+ * @param arr A buffer to put the tokens in.  May be null.
+ * @param n The number of slots in the arr buffer.
+ * @returns A parser result.
+ */
+struct json_parser json_parse_n(const char *json, uint32_t len,
+                                struct json_token *arr, uint32_t n);
+
+/**
+ * @brief Parse JSON into tokens, and hash each object key as it is parsed.
+ *
+ * This is just like `json_parse_n()`, but for every token which is an object
+ * key, a 32-bit hash of the key's decoded contents is stored at the same index
+ * in @a hashes (entries for other tokens are left alone).  Pass the tokens and
+ * hashes to `json_object_get_hashed()`, which compares hashes rather than
+ * decoding every key.  The parser decodes each key anyway, so the hashes cost
+ * little extra.
+ *
+ * @param json The text buffer to parse.
+ * @param len The length of the text buffer.
+ * @param arr A buffer to put the tokens in.  May be null.
+ * @param hashes A buffer of n hashes, parallel to arr.  May be null.
+ * @param n The number of slots in the arr and hashes buffers.
+ * @returns A parser result.
+ */
+struct json_parser json_parse_hashed_n(const char *json, uint32_t len,
+                                       struct json_token *arr,
+                                       uint32_t *hashes, uint32_t n);
+
+/**
+ * @brief Parse JSON into tokens, decoding the value of each integer.
+ *
+ * This is just like `json_parse_n()`, but for every token which is a number,
+ * whether it is an integer, and if so its value, is stored at the same index in
+ * @a ints (entries for other tokens are left alone).  The parser reads each
+ * digit anyway, so this costs little extra, and `json_int_get()` then returns
+ * the value without reading the number again.
+ *
+ * @param json The text buffer to parse.
+ * @param len The length of the text buffer.
+ * @param arr A buffer to put the tokens in.  May be null.
+ * @param ints A buffer of n values, parallel to arr.  May be null.
+ * @param n The number of slots in the arr and ints buffers.
+ * @returns A parser result.
+ */
+struct json_parser json_parse_ints_n(const char *json, uint32_t len,
+                                     struct json_token *arr,
+                                     struct json_int *ints, uint32_t n);
+
+/**
+ * @brief Parse JSON into tokens, using a structural index.
+ *
+ * This is a drop-in replacement for `json_parse()`, with exactly the same
+ * arguments and results.  It first scans the input in 64-byte blocks (with
+ * SIMD instructions where the CPU supports them) to locate quotes, brackets,
+ * commas, colons and the start of each scalar outside of strings, and then
+ * builds tokens from that index, skipping over whitespace and the bodies of
+ * strings without looking at them byte by byte.  This is much faster for
+ * documents dominated by long strings and whitespace.
+ *
+ * Like `json_parse()`, no memory is allocated.  Invalid input is handed over to
+ * `json_parse()` so that errors are reported identically.
+ *
+ * @param json The text buffer to parse.
+ * @param arr A buffer to put the tokens in.  May be null.
+ * @param n The number of slots in the arr buffer.
+ * @returns A parser result.
+ */
+struct json_parser json_parse_indexed(const char *json, struct json_token *arr,
+                                      uint32_t n);
+
+/**
+ * @brief Parse JSON of a known length into tokens, using a structural index.
+ *
+ * This is to `json_parse_indexed()` as `json_parse_n()` is to `json_parse()`.
+ */
+struct json_parser json_parse_indexed_n(const char *json, uint32_t len,
+                                        struct json_token *arr, uint32_t n);
+
+struct json_stream_state;
+
+/**
+ * @brief A parser for input which arrives a piece at a time.
+ *
+ * Use `json_stream_init()` to set one up, pass each piece of input to
+ * `json_stream_feed()` as it arrives, and call `json_stream_finish()` once
+ * there is no more.  The pieces may be split anywhere, even in the middle of a
+ * string, number or escape sequence.  Tokens are the same as `json_parse()`
+ * produces for all of the input concatenated together, and their offsets are
+ * relative to the start of that (logical) input.
+ *
+ * Tokens are available as soon as they are parsed: the first `p.tokenidx`
+ * entries of `tokens` may be used while parsing is still in progress, except
+ * that the length of an object or array is only set when it is closed, and the
+ * next field of a value is only set when the next one starts.
+ */
+struct json_stream {
+	/**
+	 * @brief Tokens parsed so far.  Allocated and grown by the stream.
+	 */
+	struct json_token *tokens;
+	/**
+	 * @brief Number of slots allocated in tokens.
+	 */
+	uint32_t tokens_cap;
+	/**
+	 * @brief Parser result so far.
+	 *
+	 * `p.tokenidx` is the number of tokens parsed, and `p.textidx` the
+	 * number of input bytes consumed.  Once the value is complete, input
+	 * following it is not consumed, just like `json_parse()`.
+	 */
+	struct json_parser p;
+	/**
+	 * @brief Private parser state.
+	 */
+	struct json_stream_state *state;
+};
+
+/**
+ * @brief Initialize a stream parser.
+ * @param s The stream to initialize.
+ * @returns 0 on success, or JSONERR_NOMEM.
+ */
+int json_stream_init(struct json_stream *s);
+
+/**
+ * @brief Parse the next piece of input.
+ *
+ * The chunk need not stay valid after this returns.  Once an error has been
+ * encountered, or the value is complete, further input is ignored.
+ *
+ * @param s The stream.
+ * @param chunk The input.
+ * @param len The length of the input.
+ * @returns The error encountered so far, if any (same as `s->p.error`).
+ */
+int json_stream_feed(struct json_stream *s, const char *chunk, uint32_t len);
+
+/**
+ * @brief Return true if a complete value has been parsed.
+ *
+ * A number at the top level is only known to be complete once the next
+ * character (or the end of input) is seen.
+ */
+bool json_stream_done(const struct json_stream *s);
+
+/**
+ * @brief Signal the end of input, and return the final parser result.
+ *
+ * This is the same as `json_parse_n()` would return for all of the input fed
+ * to the stream.  The tokens remain available until `json_stream_destroy()`.
+ * @param s The stream.
+ * @returns A parser result.
+ */
+struct json_parser json_stream_finish(struct json_stream *s);
+
+/**
+ * @brief Free the memory held by a stream, including its tokens.
+ *
+ * To keep the tokens, set `s->tokens` to NULL beforehand (and free them
+ * yourself later).
+ */
+void json_stream_destroy(struct json_stream *s);
+
 /**
  * @brief Print a list of JSON tokens.
  *
@@ -238,6 +486,28 @@ int json_string_match(const char *json, const struct json_token *tokens,
 int json_string_load(const char *json, const struct json_token *tokens,
                      uint32_t index, char *buffer);
 
+/**
+ * @brief Get a string's contents, without copying them if possible.
+ *
+ * Strings without escapes (see `json_token.plain`) already sit in the JSON
+ * buffer, so @a out is simply pointed at them there.  Otherwise, the string is
+ * decoded into @a scratch, as by `json_string_load()`, and @a out points at
+ * that.  Either way, @a len is set to the length of the contents, which are
+ * only NUL-terminated in the second case.
+ *
+ * @param json The original JSON buffer.
+ * @param tokens The parsed tokens.
+ * @param index The index of the string token.
+ * @param scratch A buffer of at least `tokens[index].length + 1` bytes, used
+ * only if the string has escapes.
+ * @param[out] out Pointer to the contents.
+ * @param[out] len Length of the contents.
+ * @returns 0 (NO_ERROR) on success, or JSONERR_TYPE if token is invalid
+ */
+int json_string_view(const char *json, const struct json_token *tokens,
+                     uint32_t index, char *scratch, const char **out,
+                     uint32_t *len);
+
 /**
  * @brief Print a string to a file, escaped or not
  * @param json The original JSON buffer.
@@ -266,6 +536,18 @@ int json_string_print(const char *json, const struct json_token *tokens,
 int json_object_get(const char *json, const struct json_token *tokens,
                     uint32_t index, const char *key, uint32_t *ret);
 
+/**
+ * @brief Like `json_object_get()`, using key hashes from parsing.
+ *
+ * Keys whose hash differs from that of @a key are skipped without decoding
+ * them, so usually only the matching key is decoded.
+ *
+ * @param hashes The key hashes filled in by `json_parse_hashed_n()`.
+ */
+int json_object_get_hashed(const char *json, const struct json_token *tokens,
+                           const uint32_t *hashes, uint32_t index,
+                           const char *key, uint32_t *ret);
+
 /**
  * @brief Return the value at a certain index within a JSON array.
  * @param json The original JSON buffer.
@@ -281,6 +563,10 @@ int json_array_get(const char *json, const struct json_token *tokens,
 
 /**
  * @brief Return the value of a JSON number token.
+ *
+ * The result is correctly rounded (the same as strtod() in the C locale),
+ * whatever the current locale.  Numbers too large for a double are infinite.
+ *
  * @param json The original JSON buffer.
  * @param tokens The parsed token buffer.
  * @param index The index of the number in the token buffer.
@@ -309,7 +595,8 @@ int json_number_get(const char *json, const struct json_token *tokens,
  * @param tokens The parsed token buffer.
  * @param index The index of the number in the token buffer.
  * @param number Number to fill result
- * @returns 0 (NO_ERROR) on success, or JSONERR_TYPE if token is invalid
+ * @returns 0 (NO_ERROR) on success, JSONERR_TYPE if token is invalid, or
+ * JSONERR_NOT_INT if it is not written as an integer, or is out of range
  */
 int json_number_getint(const char *json, const struct json_token *tokens,
                        uint32_t index, int64_t *number);
@@ -324,11 +611,43 @@ int json_number_getint(const char *json, const struct json_token *tokens,
  * @param tokens The parsed token buffer.
  * @param index The index of the number in the token buffer.
  * @param number Number to fill result
- * @returns 0 (NO_ERROR) on success, or JSONERR_TYPE if token is invalid
+ * @returns 0 (NO_ERROR) on success, JSONERR_TYPE if token is invalid, or
+ * JSONERR_NOT_INT if it is negative, not written as an integer, or out of
+ * range
  */
 int json_number_getuint(const char *json, const struct json_token *tokens,
                         uint32_t index, uint64_t *number);
 
+/**
+ * @brief Like `json_number_getint()`, using values decoded by
+ * `json_parse_ints_n()`.
+ *
+ * @param tokens The parsed token buffer.
+ * @param ints The values filled in by `json_parse_ints_n()`.
+ * @param index The index of the number in the token buffer.
+ * @param number Number to fill result
+ * @returns 0 (NO_ERROR) on success, JSONERR_TYPE if token is invalid, or
+ * JSONERR_NOT_INT if it is not written as an integer, or is out of range
+ */
+int json_int_get(const struct json_token *tokens, const struct json_int *ints,
+                 uint32_t index, int64_t *number);
+
+/**
+ * @brief Like `json_number_getuint()`, using values decoded by
+ * `json_parse_ints_n()`.
+ *
+ * @param tokens The parsed token buffer.
+ * @param ints The values filled in by `json_parse_ints_n()`.
+ * @param index The index of the number in the token buffer.
+ * @param number Number to fill result
+ * @returns 0 (NO_ERROR) on success, JSONERR_TYPE if token is invalid, or
+ * JSONERR_NOT_INT if it is negative, not written as an integer, or out of
+ * range
+ */
+int json_int_getuint(const struct json_token *tokens,
+                     const struct json_int *ints, uint32_t index,
+                     uint64_t *number);
+
 /**
  * @brief Lookup values from complex JSON obj/arr using an expression language
  *
@@ -365,9 +684,298 @@ int json_number_getuint(const char *json, const struct json_token *tokens,
 int json_lookup(const char *json, const struct json_token *arr, uint32_t tok,
                 const char *key, uint32_t *index);
 
+/**
+ * @brief A lookup expression, compiled for repeated use.
+ *
+ * A compiled path is never modified, so it may be evaluated from several
+ * threads at once.
+ */
+struct json_path;
+
+/**
+ * @brief Compile a path expression, in the syntax of `json_lookup()`.
+ *
+ * The whole expression is checked for syntax errors here, so that evaluating
+ * it only fails if the document doesn't match.  Unlike `json_lookup()`, an
+ * empty index ("[]") is a syntax error, rather than index zero.
+ *
+ * The expression may also be a query, using steps which `json_lookup()` does
+ * not accept, each of which may match any number of tokens: "*" or "[*]" for
+ * every value in an object or array, "[a:b]" for array elements a up to (not
+ * including) b, either of which may be left out, and ".." before a step to
+ * apply it to the current token and all of its descendants ("..id" finds
+ * every "id" key).  Queries are evaluated with `json_path_query()` or
+ * `json_path_select()`.
+ *
+ * @param expr The expression.
+ * @param[out] path The compiled path, to be freed by `json_path_free()`.
+ * @param[out] erridx On syntax error, the position of the error in the
+ * expression (for `json_lookup_error()`).  May be null.
+ * @returns 0 on success, JSONERR_BAD_EXPR, or JSONERR_NOMEM
+ */
+int json_path_compile(const char *expr, struct json_path **path,
+                      uint32_t *erridx);
+
+/**
+ * @brief Free a compiled path.
+ */
+void json_path_free(struct json_path *path);
+
+/**
+ * @brief Evaluate a compiled path, like `json_lookup()`.
+ *
+ * For a path which is not a query, this gives the same results as
+ * `json_lookup()` with the expression it was compiled from, including the
+ * position in the expression stored into @a index on error, but does not
+ * allocate memory or parse the expression.
+ *
+ * @param path The compiled path
+ * @param json The original JSON text buffer
+ * @param tokens The parsed tokens array
+ * @param tok Token which the path will be evaluated relative to
+ * @param[out] index The index found by the lookup
+ * @returns 0 (JSON_OK) on success, or else a lookup error.  A query is
+ * JSONERR_BAD_EXPR, at the position of its first step which may match more
+ * than one token.
+ */
+int json_path_eval(const struct json_path *path, const char *json,
+                   const struct json_token *tokens, uint32_t tok,
+                   uint32_t *index);
+
+/**
+ * @brief Function called for each match by `json_path_query()`.
+ *
+ * Return 0 to continue, or anything else to stop the query.
+ */
+typedef int (*json_path_callback)(uint32_t tok, void *arg);
+
+/**
+ * @brief Evaluate a compiled query, calling back for each token it matches.
+ *
+ * Matches are found in document order, step by step: for "items[*].id", each
+ * item in turn, then its "id".  Tokens which a step doesn't apply to (missing
+ * keys, out of range indices, or the wrong type) simply don't match, so this
+ * never fails.  A path without any wildcards matches the token found by
+ * `json_path_eval()`, if any.  No memory is allocated.
+ *
+ * @param path The compiled path
+ * @param json The original JSON text buffer
+ * @param tokens The parsed tokens array
+ * @param tok Token which the path will be evaluated relative to
+ * @param cb Function to call with each match
+ * @param arg Argument to pass to the callback
+ * @returns 0, or the first nonzero value returned by the callback
+ */
+int json_path_query(const struct json_path *path, const char *json,
+                    const struct json_token *tokens, uint32_t tok,
+                    json_path_callback cb, void *arg);
+
+/**
+ * @brief Evaluate a compiled query, storing the matches into a buffer.
+ *
+ * @param path The compiled path
+ * @param json The original JSON text buffer
+ * @param tokens The parsed tokens array
+ * @param tok Token which the path will be evaluated relative to
+ * @param[out] out Buffer for the first @a max matches
+ * @param max Size of the buffer
+ * @param[out] count Number of matches, which may be more than @a max
+ * @returns 0 (JSON_OK)
+ */
+int json_path_select(const struct json_path *path, const char *json,
+                     const struct json_token *tokens, uint32_t tok,
+                     uint32_t *out, uint32_t max, uint32_t *count);
+
+/**
+ * @brief A set of compiled paths, to be evaluated together.
+ *
+ * The paths are merged into a trie, so that a prefix they share is followed
+ * once, and each object along the way has its keys scanned once for all of the
+ * paths through it, rather than once per path.
+ */
+struct json_path_set;
+
+/**
+ * @brief Build a set of compiled paths.
+ *
+ * The set does not refer to the paths, which may be freed once it is built.
+ * Like a path, a set is never modified, so it may be evaluated from several
+ * threads at once.
+ *
+ * @param paths The paths, which need not be different.
+ * @param npaths Number of paths.
+ * @param[out] set The set, to be freed by `json_path_set_free()`.
+ * @returns 0 on success, JSONERR_BAD_EXPR if any path is a query, or
+ * JSONERR_NOMEM
+ */
+int json_path_set_build(struct json_path *const *paths, uint32_t npaths,
+                        struct json_path_set **set);
+
+/**
+ * @brief Free a set of compiled paths.
+ */
+void json_path_set_free(struct json_path_set *set);
+
+/**
+ * @brief Evaluate every path in a set, in one traversal of the document.
+ *
+ * For each path (numbered as they were given to `json_path_set_build()`), the
+ * result and error are exactly those of `json_path_eval()`.  No memory is
+ * allocated.
+ *
+ * @param set The set of paths
+ * @param json The original JSON text buffer
+ * @param tokens The parsed tokens array
+ * @param tok Token which the paths will be evaluated relative to
+ * @param[out] results For each path, the token found, or the position of the
+ * error in its expression
+ * @param[out] errors For each path, 0 (JSON_OK) or a lookup error
+ * @returns 0 (JSON_OK) if every path was found, or else the error of the first
+ * path which was not
+ */
+int json_path_set_eval(const struct json_path_set *set, const char *json,
+                       const struct json_token *tokens, uint32_t tok,
+                       uint32_t *results, int *errors);
+
+/**
+ * @brief Parse only the values selected by some paths, and their ancestors.
+ *
+ * Tokens are produced just for the values the paths select (each in full),
+ * and the objects and arrays on the way to them.  Everything else is checked
+ * for syntax errors exactly as by `json_parse()`, but not tokenized, so the
+ * token buffer may be far smaller than the document needs.
+ *
+ * The tokens are laid out as usual, and the paths evaluate to the same values
+ * in them as in the whole document.  An object keeps only the members which
+ * hold something selected.  An array keeps its elements up to the last one
+ * which does, so that indices are unchanged; the others among them are a
+ * single token each, with no members if they are objects or arrays.
+ *
+ * A path which selects nothing fails in the projection as it does in the
+ * whole document, but the error and its position may differ, since what it
+ * failed on may have been dropped: "[0].a" against "[1]" is JSONERR_TYPE in
+ * the whole document but JSONERR_INDEX in the projection.
+ *
+ * Paths may use wildcards and slices, but not recursive descent ("..").
+ * Unlike `json_parse()`, this allocates a little memory (for the lists of
+ * paths matching at each level).
+ *
+ * @param json The text buffer to parse.
+ * @param len The length of the text buffer.
+ * @param paths The compiled paths, which need not be different.
+ * @param npaths Number of paths.
+ * @param arr A buffer to put the tokens in.  May be null.
+ * @param n The number of slots in the arr buffer.
+ * @returns A parser result.  The error is JSONERR_BAD_EXPR if a path uses
+ * recursive descent, or JSONERR_NOMEM.
+ */
+struct json_parser json_parse_projected_n(const char *json, uint32_t len,
+                                          struct json_path *const *paths,
+                                          uint32_t npaths,
+                                          struct json_token *arr, uint32_t n);
+
+/**
+ * @brief Print a value (and everything in it) to a file, indented by two
+ * spaces per level and followed by a newline.
+ *
+ * This is `json_write()` with the default options, to a file.
+ */
 void json_format(const char *json, const struct json_token *arr, uint32_t len,
                  uint32_t start, FILE *f);
 
+/**
+ * @brief Function given the output of a `json_writer`, a block at a time.
+ *
+ * Return 0 to continue, or anything else to stop writing, which is reported as
+ * JSONERR_IO.
+ */
+typedef int (*json_write_callback)(const char *buf, size_t len, void *arg);
+
+/**
+ * @brief Writes values as JSON text, into memory or through a callback.
+ *
+ * Output is gathered in a buffer, and whatever can be is copied from the input
+ * whole: numbers, and strings without escapes or characters which must be
+ * escaped.  Written to memory, the buffer grows to hold everything, and is
+ * kept NUL-terminated.  Given a callback, the buffer holds 64KiB (or the
+ * largest string), and is passed to the callback when full, and by
+ * `json_writer_flush()`.
+ *
+ * Example:
+ *
+ *     struct json_writer w;
+ *     json_writer_init(&w);
+ *     w.indent = 0;
+ *     if (json_easy_write(&easy, &w, 0) == JSON_OK)
+ *             puts(w.buf);
+ *     json_writer_destroy(&w);
+ */
+struct json_writer {
+	/** @brief The output, when writing to memory */
+	char *buf;
+	/** @brief Bytes of output in buf */
+	size_t len;
+	/** @brief Spaces per level of nesting (default 2), or 0 for none */
+	int indent;
+	/** @brief Whether to end each value with a newline (default true) */
+	bool newline;
+	/** @brief Error which stopped the writer, if any */
+	int error;
+
+	/* Private: buffer size, callback, and scratch space */
+	size_t cap;
+	json_write_callback cb;
+	void *arg;
+	uint32_t *nest;
+	uint32_t nest_cap;
+	char *scratch;
+	uint32_t scratch_cap;
+};
+
+/**
+ * @brief Initialize a writer which writes to memory (see `json_writer.buf`).
+ */
+void json_writer_init(struct json_writer *w);
+
+/**
+ * @brief Initialize a writer which gives its output to a callback.
+ */
+void json_writer_init_cb(struct json_writer *w, json_write_callback cb,
+                         void *arg);
+
+/**
+ * @brief Write a value (and everything in it).
+ *
+ * With an indent, each member or element goes on its own line, and keys are
+ * followed by ": ".  Without, nothing is added between tokens at all.  Strings
+ * are escaped just as by `json_string_print()`.  Several values may be written
+ * one after another, for instance as NDJSON.
+ *
+ * @param w The writer.
+ * @param json The original JSON buffer.
+ * @param arr The parsed tokens.
+ * @param len The number of tokens.
+ * @param start The index of the value to write.
+ * @returns 0 on success, or else the error which stopped the writer:
+ * JSONERR_NOMEM, or JSONERR_IO if the callback failed.  Once stopped, a
+ * writer writes nothing more.
+ */
+int json_write(struct json_writer *w, const char *json,
+               const struct json_token *arr, uint32_t len, uint32_t start);
+
+/**
+ * @brief Give any output still buffered to the callback.
+ * @returns The error which stopped the writer, if any.
+ */
+int json_writer_flush(struct json_writer *w);
+
+/**
+ * @brief Free the memory held by a writer, including its output.
+ *
+ * Output which was not flushed is discarded.
+ */
+void json_writer_destroy(struct json_writer *w);
+
 /**
  * @brief Loop through each value in a JSON array, or each key in an object
  *
@@ -393,11 +1001,101 @@ void json_format(const char *json, const struct json_token *arr, uint32_t len,
 #define json_for_each(var, tok_arr, start)                                     \
 	json_array_for_each(var, tok_arr, start)
 
+/**
+ * @brief An index over parsed JSON, for faster lookups.
+ *
+ * Lookups in an array walk from one element to the next, so they take time
+ * proportional to the index looked up.  An index records where each element of
+ * the larger arrays is, so that these lookups take constant time.  Likewise,
+ * it records a hash of each key of the larger objects, so that key lookups
+ * take expected constant time instead of comparing every key.
+ *
+ * An index refers to the input and token buffer it was built from, which must
+ * outlive it, and must not change.  It is never modified after it is built, so
+ * it may be used from several threads at once.
+ */
+struct json_index;
+
+/**
+ * @brief Build an index over parsed JSON.
+ *
+ * Arrays and objects are indexed in the order they appear, as long as the
+ * memory used stays within @a max_bytes (pass SIZE_MAX for no limit).  Lookups
+ * in containers which are left out, or are too small to be worth indexing,
+ * still work, just without the speedup.
+ *
+ * @param json The original JSON buffer.
+ * @param tokens The parsed tokens.
+ * @param ntokens The number of tokens.
+ * @param max_bytes Limit on the memory used by the index.
+ * @returns The index, or NULL if memory allocation fails.
+ */
+struct json_index *json_index_build(const char *json,
+                                    const struct json_token *tokens,
+                                    uint32_t ntokens, size_t max_bytes);
+
+/**
+ * @brief Free an index.
+ */
+void json_index_free(struct json_index *ix);
+
+/**
+ * @brief Like `json_array_get()`, but using an index.
+ */
+int json_index_array_get(const struct json_index *ix, uint32_t index,
+                         uint32_t array_index, uint32_t *result);
+
+/**
+ * @brief Like `json_object_get()`, but using an index.
+ */
+int json_index_object_get(const struct json_index *ix, uint32_t index,
+                          const char *key, uint32_t *ret);
+
+/**
+ * @brief Like `json_lookup()`, but using an index.
+ */
+int json_index_lookup(const struct json_index *ix, uint32_t tok,
+                      const char *key, uint32_t *result);
+
+/**
+ * @brief Like `json_path_eval()`, but using an index.
+ */
+int json_index_path_eval(const struct json_index *ix,
+                         const struct json_path *path, uint32_t tok,
+                         uint32_t *result);
+
+/**
+ * @brief Like `json_path_set_eval()`, but using an index.
+ */
+int json_index_path_set_eval(const struct json_index *ix,
+                             const struct json_path_set *set, uint32_t tok,
+                             uint32_t *results, int *errors);
+
 struct json_easy {
 	const char *input;
 	uint32_t input_len;
 	struct json_token *tokens;
+	/** @brief Number of tokens parsed (zero until json_easy_parse()) */
 	uint32_t tokens_len;
+	/** @brief Number of token slots allocated (may exceed tokens_len) */
+	uint32_t tokens_cap;
+	/** @brief Index used by lookups, if built by json_easy_index() */
+	struct json_index *index;
+	/** @brief Key hashes, parallel to tokens, if json_easy_parse_hashed() */
+	uint32_t *hashes;
+	/** @brief Integer values, parallel to tokens (json_easy_parse_ints()) */
+	struct json_int *ints;
+	/**
+	 * @brief Set if the tokens cover only some paths of the input
+	 * (json_easy_parse_projected())
+	 */
+	bool projected;
+	/**
+	 * @brief Mapping of the file loaded by json_easy_load(), which holds
+	 * the buffers above, or NULL
+	 */
+	void *map;
+	size_t map_len;
 };
 
 #define json_easy_for_each(var, jsonp, start)                                  \
@@ -412,6 +1110,22 @@ static inline struct json_easy *json_easy_new(const char *input)
 	return easy;
 }
 
+/**
+ * @brief Initialize a json_easy for an input of known length.
+ *
+ * The input need not be NUL-terminated, and is not copied: it must outlive the
+ * json_easy.  See json_parse_n().
+ */
+void json_easy_init_n(struct json_easy *, const char *input, uint32_t len);
+static inline struct json_easy *json_easy_new_n(const char *input,
+                                                uint32_t len)
+{
+	struct json_easy *easy = (struct json_easy *)malloc(sizeof(*easy));
+	if (easy)
+		json_easy_init_n(easy, input, len);
+	return easy;
+}
+
 void json_easy_destroy(struct json_easy *easy);
 static inline void json_easy_free(struct json_easy *easy)
 {
@@ -419,8 +1133,146 @@ static inline void json_easy_free(struct json_easy *easy)
 	free(easy);
 }
 
+/**
+ * @brief Parse the input of a json_easy, allocating the token buffer.
+ *
+ * The token buffer is sized by a guess based on the input length, so that most
+ * documents are tokenized in a single pass. Only when the guess is too small is
+ * the buffer grown (to the exact size reported by the first pass) and the
+ * input parsed again.
+ *
+ * @returns 0 on success, or a parser error (JSONERR_NOMEM if allocation fails)
+ */
 int json_easy_parse(struct json_easy *easy);
 
+/**
+ * @brief Parse the input of a json_easy, hashing each object key.
+ *
+ * This is `json_easy_parse()` using `json_parse_hashed_n()`, after which
+ * `json_easy_object_get()` uses the hashes (unless there is an index).
+ *
+ * @returns 0 on success, or a parser error (JSONERR_NOMEM if allocation fails)
+ */
+int json_easy_parse_hashed(struct json_easy *easy);
+
+/**
+ * @brief Parse the input of a json_easy, decoding the value of each integer.
+ *
+ * This is `json_easy_parse()` using `json_parse_ints_n()`, after which
+ * `json_easy_number_getint()` and `json_easy_number_getuint()` return the
+ * decoded values.  It may be combined with `json_easy_parse_hashed()`.
+ *
+ * @returns 0 on success, or a parser error (JSONERR_NOMEM if allocation fails)
+ */
+int json_easy_parse_ints(struct json_easy *easy);
+
+/**
+ * @brief Parse the input of a json_easy on several threads.
+ *
+ * When the input is a large array, it is split up speculatively between
+ * elements, and the pieces are tokenized on separate threads, then joined.
+ * If the input is not an array, or is small, or the split can't be confirmed
+ * (for instance because it fell inside a string), this falls back to
+ * `json_easy_parse()`.  Either way, the result is exactly the same as
+ * `json_easy_parse()`.
+ *
+ * @param easy The json_easy to parse.
+ * @param nthreads Number of threads to use, or 0 for one per online CPU.
+ * @returns 0 on success, or a parser error (JSONERR_NOMEM if allocation fails)
+ */
+int json_easy_parse_parallel(struct json_easy *easy, unsigned int nthreads);
+
+/**
+ * @brief Parse only the values selected by some paths into a json_easy.
+ *
+ * See `json_parse_projected_n()`.  The input is parsed again even if it
+ * already was, replacing the tokens (and dropping any index).  Key hashes and
+ * integer values are filled in if `json_easy_parse_hashed()` or
+ * `json_easy_parse_ints()` was used before.
+ *
+ * @returns 0 on success, or a parser error (JSONERR_NOMEM if allocation fails)
+ */
+int json_easy_parse_projected(struct json_easy *easy,
+                              struct json_path *const *paths, uint32_t npaths);
+
+/**
+ * @brief Build an index over the parsed tokens, which lookups then use.
+ *
+ * See `json_index_build()`.
+ * @returns 0 on success, or JSONERR_NOMEM
+ */
+int json_easy_index(struct json_easy *easy, size_t max_bytes);
+
+/**
+ * @brief Save the tokens of a json_easy to a file, so that a later run may
+ * load them with `json_easy_load()` rather than parse the same input again.
+ *
+ * The input is parsed first if it hasn't been.  Key hashes, integer values and
+ * the index are saved too, if the json_easy has them.  The file records the
+ * length and a hash of the input, along with the version of the file format
+ * and the token layout, so that `json_easy_load()` can tell when it is stale.
+ *
+ * Tokens from `json_easy_parse_projected()` are not saved, since they would
+ * be taken for the whole document when loaded.
+ *
+ * @returns 0 on success, a parser error, JSONERR_STALE if the tokens are
+ * projected, or JSONERR_IO (or JSONERR_NOMEM)
+ */
+int json_easy_save(struct json_easy *easy, const char *path);
+
+/**
+ * @brief Use the tokens saved by `json_easy_save()` for the input of a
+ * json_easy, rather than parsing it.
+ *
+ * The file is mapped into memory and used where it lies, so loading reads
+ * only the input (to check its hash), and the saved tokens are paged in as
+ * lookups reach them.  Any tokens the json_easy had before are dropped.  The
+ * file must not change while it is mapped.  Its contents are trusted like any
+ * other file the program writes for itself: a file which doesn't match the
+ * input is refused, but a deliberately corrupted one is not detected.
+ *
+ * @returns 0 on success, JSONERR_IO if the file can't be read or mapped,
+ * JSONERR_STALE if it was saved from a different input or by a different
+ * build of nosj, or JSONERR_NOMEM.  On failure the json_easy is unchanged, and
+ * may be parsed as usual.
+ */
+int json_easy_load(struct json_easy *easy, const char *path);
+
+/**
+ * @brief Evaluate a compiled path, using the index or key hashes if present.
+ *
+ * See `json_path_eval()`.
+ */
+int json_easy_path_eval(struct json_easy *easy, const struct json_path *path,
+                        uint32_t tok, uint32_t *result);
+
+/**
+ * @brief Evaluate a set of paths, using the index or key hashes if present.
+ *
+ * See `json_path_set_eval()`.
+ */
+int json_easy_path_set_eval(struct json_easy *easy,
+                            const struct json_path_set *set, uint32_t tok,
+                            uint32_t *results, int *errors);
+
+/**
+ * @brief Evaluate a query, using the index or key hashes if present.
+ *
+ * See `json_path_query()`.
+ */
+int json_easy_path_query(struct json_easy *easy, const struct json_path *path,
+                         uint32_t tok, json_path_callback cb, void *arg);
+
+/**
+ * @brief Evaluate a query into a buffer, using the index or key hashes if
+ * present.
+ *
+ * See `json_path_select()`.
+ */
+int json_easy_path_select(struct json_easy *easy, const struct json_path *path,
+                          uint32_t tok, uint32_t *out, uint32_t max,
+                          uint32_t *count);
+
 /**
  * @brief Return the string at a given index. Returned pointer must be freed.
  */
@@ -430,6 +1282,8 @@ int json_easy_string_get(struct json_easy *easy, uint32_t index, char **out);
 static inline int json_easy_lookup(struct json_easy *easy, uint32_t tok,
                                    const char *key, uint32_t *result)
 {
+	if (easy->index)
+		return json_index_lookup(easy->index, tok, key, result);
 	return json_lookup(easy->input, easy->tokens, tok, key, result);
 }
 static inline int json_easy_number_get(struct json_easy *easy, uint32_t index,
@@ -440,11 +1294,16 @@ static inline int json_easy_number_get(struct json_easy *easy, uint32_t index,
 static inline int json_easy_number_getint(struct json_easy *easy,
                                           uint32_t index, int64_t *result)
 {
+	if (easy->ints)
+		return json_int_get(easy->tokens, easy->ints, index, result);
 	return json_number_getint(easy->input, easy->tokens, index, result);
 }
 static inline int json_easy_number_getuint(struct json_easy *easy,
                                            uint32_t index, uint64_t *result)
 {
+	if (easy->ints)
+		return json_int_getuint(easy->tokens, easy->ints, index,
+		                        result);
 	return json_number_getuint(easy->input, easy->tokens, index, result);
 }
 static inline int json_easy_string_match(struct json_easy *easy, uint32_t index,
@@ -459,6 +1318,13 @@ static inline int json_easy_string_load(struct json_easy *easy, uint32_t index,
 {
 	return json_string_load(easy->input, easy->tokens, index, buffer);
 }
+static inline int json_easy_string_view(struct json_easy *easy, uint32_t index,
+                                        char *scratch, const char **out,
+                                        uint32_t *len)
+{
+	return json_string_view(easy->input, easy->tokens, index, scratch, out,
+	                        len);
+}
 static inline int json_easy_string_print(struct json_easy *easy, uint32_t index,
                                          FILE *f, bool escaped)
 {
@@ -467,11 +1333,19 @@ static inline int json_easy_string_print(struct json_easy *easy, uint32_t index,
 static inline int json_easy_object_get(struct json_easy *easy, uint32_t index,
                                        const char *key, uint32_t *out)
 {
+	if (easy->index)
+		return json_index_object_get(easy->index, index, key, out);
+	if (easy->hashes)
+		return json_object_get_hashed(easy->input, easy->tokens,
+		                              easy->hashes, index, key, out);
 	return json_object_get(easy->input, easy->tokens, index, key, out);
 }
 static inline int json_easy_array_get(struct json_easy *easy, uint32_t index,
                                       uint32_t array_index, uint32_t *result)
 {
+	if (easy->index)
+		return json_index_array_get(easy->index, index, array_index,
+		                            result);
 	return json_array_get(easy->input, easy->tokens, index, array_index,
 	                      result);
 }
@@ -480,4 +1354,353 @@ static inline void json_easy_format(struct json_easy *easy, uint32_t start,
 {
 	json_format(easy->input, easy->tokens, easy->tokens_len, start, f);
 }
+static inline int json_easy_write(struct json_easy *easy,
+                                  struct json_writer *w, uint32_t start)
+{
+	return json_write(w, easy->input, easy->tokens, easy->tokens_len,
+	                  start);
+}
+
+/**
+ * @brief A reader for newline-delimited JSON (NDJSON, or JSON Lines).
+ *
+ * Each non-blank line of the input must hold exactly one JSON value.  Records
+ * are read one at a time with `json_ndjson_next()`, and each one is presented
+ * as a parsed `struct json_easy` (`record`), so that all of the `json_easy_*`
+ * accessors work on it.  The record, and its tokens, are only valid until the
+ * next call: the token buffer is reused from one record to the next, and only
+ * grows when a record needs more tokens than any before it.
+ *
+ *     struct json_ndjson nd;
+ *     json_ndjson_init_file(&nd, stdin);
+ *     while (json_ndjson_next(&nd)) {
+ *             if (nd.p.error != JSON_OK)
+ *                     continue; // or report nd.line and nd.p
+ *             json_easy_lookup(&nd.record, 0, "user.name", &index);
+ *     }
+ *     json_ndjson_destroy(&nd);
+ */
+struct json_ndjson {
+	/** @brief The current record (its input is the whole line) */
+	struct json_easy record;
+	/** @brief Parser result for the current record, within its line */
+	struct json_parser p;
+	/** @brief Line number of the current record, counting from 1 */
+	size_t line;
+
+	/* Private: the input buffer, or file and line buffer */
+	const char *buf;
+	size_t buf_len, buf_pos;
+	FILE *file;
+	char *line_buf;
+	size_t line_cap;
+};
+
+/**
+ * @brief Initialize an NDJSON reader over a buffer.
+ *
+ * The buffer need not be NUL-terminated, and is not copied: records point into
+ * it, so it must outlive the reader.
+ */
+void json_ndjson_init(struct json_ndjson *nd, const char *buf, size_t len);
+
+/**
+ * @brief Initialize an NDJSON reader over a file, read a line at a time.
+ */
+void json_ndjson_init_file(struct json_ndjson *nd, FILE *f);
+
+/**
+ * @brief Read and parse the next record, skipping blank lines.
+ *
+ * If the record is not valid JSON, or anything but whitespace follows the
+ * value on its line, `nd->p.error` is set and `nd->record` has no tokens.
+ * Reading may continue with the next record regardless.
+ *
+ * @returns True if a record was read, false at the end of input.
+ */
+bool json_ndjson_next(struct json_ndjson *nd);
+
+/**
+ * @brief Free the memory held by an NDJSON reader (but not its input).
+ */
+void json_ndjson_destroy(struct json_ndjson *nd);
+
+/**
+ * @brief Function called for each record by `json_ndjson_parallel()`.
+ *
+ * The reader passed in is only valid during the call, and only its public
+ * fields (record, p and line) are meaningful.  Return 0 to continue, or
+ * anything else to stop reading.
+ */
+typedef int (*json_ndjson_callback)(struct json_ndjson *nd, void *arg);
+
+/**
+ * @brief Read newline-delimited JSON from a buffer, using several threads.
+ *
+ * The buffer (typically a memory mapped file) is divided into chunks of whole
+ * lines, which are parsed by a pool of threads.  The callback is called for
+ * each record, just as `json_ndjson_next()` would produce it, including those
+ * with errors.
+ *
+ * If @a ordered is false, the callback is called from the worker threads as
+ * soon as each record is parsed, so it may be called concurrently and in any
+ * order, and `nd->line` is not counted (it is zero).  Otherwise, the callback
+ * is called for one record at a time, in the order of the input, and
+ * `nd->line` is set.  Either way, records point into the buffer.
+ *
+ * @param buf The input.  It need not be NUL-terminated.
+ * @param len The length of the input.
+ * @param nthreads Number of threads to use, or 0 for one per online CPU.
+ * @param ordered Whether to deliver records in order.
+ * @param cb Function to call for each record.
+ * @param arg Argument to pass to the callback.
+ * @returns 0 once all records are read, the first nonzero value returned by
+ * the callback, or JSONERR_NOMEM.
+ */
+int json_ndjson_parallel(const char *buf, size_t len, unsigned int nthreads,
+                         bool ordered, json_ndjson_callback cb, void *arg);
+
+/**
+ * @brief A document tokenized on demand, one container at a time.
+ *
+ * Parsing tokenizes only the members of the root, skipping over any nested
+ * object or array by matching brackets.  The members of a nested container are
+ * tokenized when a lookup first goes into it, and appended to the tokens.  So
+ * the tokens used, and the time taken, depend on how much of the document is
+ * looked at, rather than on its size.  The price is that only what has been
+ * tokenized is validated: a syntax error in a part of the document which is
+ * never looked into is never found.
+ *
+ * Token indices stay valid as more are added, and string and number tokens can
+ * be read with the usual functions (like `json_string_load()` with the input
+ * and tokens below).  Containers must be navigated with the functions here,
+ * since their members aren't stored just after them.  Lookups modify the
+ * tokens, so a json_lazy may only be used by one thread at a time.
+ */
+struct json_lazy {
+	const char *input;
+	uint32_t input_len;
+	struct json_token *tokens;
+	/** @brief Number of tokens so far (zero until json_lazy_parse()) */
+	uint32_t tokens_len;
+	/** @brief Number of token slots allocated */
+	uint32_t tokens_cap;
+	/**
+	 * @brief Parallel to tokens: for a container whose members have been
+	 * tokenized, the index of the first member (else 0).
+	 */
+	uint32_t *child;
+	/** @brief Position in the input of the last syntax error */
+	uint32_t error_at;
+};
+
+/**
+ * @brief Set up a json_lazy for an input of the given length.
+ */
+void json_lazy_init(struct json_lazy *lz, const char *input, uint32_t len);
+
+/**
+ * @brief Free the memory held by a json_lazy (but not its input).
+ */
+void json_lazy_destroy(struct json_lazy *lz);
+
+/**
+ * @brief Tokenize the root of the document (token 0), and its members.
+ *
+ * The whole input is scanned, but nested containers only to find where they
+ * end.
+ *
+ * @returns 0 on success, or a parser error (see error_at)
+ */
+int json_lazy_parse(struct json_lazy *lz);
+
+/**
+ * @brief Tokenize the members of a container, if that hasn't been done.
+ *
+ * Afterwards, `json_lazy_for_each()` may be used on the container.
+ *
+ * @returns 0 on success, JSONERR_TYPE if the token isn't a container, or a
+ * parser error (see error_at)
+ */
+int json_lazy_expand(struct json_lazy *lz, uint32_t tok);
+
+/**
+ * @brief Loop through each value in an expanded array, or each key in an
+ * expanded object (whose value is at var + 1).
+ */
+#define json_lazy_for_each(var, lz, idx)                                      \
+	for (var = (lz)->tokens[idx].length ? (lz)->child[idx] : 0; var != 0;  \
+	     var = (lz)->tokens[var].next)
+
+/**
+ * @brief Like `json_object_get()`, tokenizing the object if needed.
+ *
+ * @returns 0 on success, a lookup error, or a parser error
+ */
+int json_lazy_object_get(struct json_lazy *lz, uint32_t tok, const char *key,
+                         uint32_t *ret);
+
+/**
+ * @brief Like `json_array_get()`, tokenizing the array if needed.  Indexing
+ * an expanded array takes constant time.
+ *
+ * @returns 0 on success, a lookup error, or a parser error
+ */
+int json_lazy_array_get(struct json_lazy *lz, uint32_t tok, uint32_t index,
+                        uint32_t *ret);
+
+/**
+ * @brief Like `json_path_eval()`, tokenizing only the containers on the path.
+ *
+ * @returns 0 on success, a lookup error, or a parser error (with @a result
+ * set to the position in the expression, as for a lookup error)
+ */
+int json_lazy_path_eval(struct json_lazy *lz, const struct json_path *path,
+                        uint32_t tok, uint32_t *result);
+
+/**
+ * @brief Compile an expression and evaluate it with `json_lazy_path_eval()`.
+ *
+ * The expression is compiled each time, so use `json_lazy_path_eval()` for
+ * lookups done over and over.
+ *
+ * @returns 0 on success, JSONERR_NOMEM, or as for `json_lazy_path_eval()`
+ */
+int json_lazy_lookup(struct json_lazy *lz, uint32_t tok, const char *expr,
+                     uint32_t *result);
+
+/**
+ * @brief A document tokenized into separate arrays for each token field.
+ *
+ * The tokens are the same as those of `json_parse()`, but rather than one
+ * array of structs, there is one array per field ("structure of arrays").
+ * Navigating, which mostly follows next links and compares lengths, then
+ * reads only the arrays it needs, and fits more tokens in each cache line.
+ * Building the tape takes a little longer than a parse, since the tokens are
+ * split into columns afterwards.
+ *
+ * Token indices are the same as `json_parse()` gives, and the functions below
+ * mirror the json_easy ones.  Any other function taking tokens may be used
+ * with `json_tape_token()` and index 0.
+ */
+struct json_tape {
+	const char *input;
+	uint32_t input_len;
+	/** @brief Number of tokens (zero until json_tape_parse()) */
+	uint32_t len;
+	/** @brief Type of each token (enum json_type) */
+	uint8_t *type;
+	/** @brief Whether each token is a plain string (see json_token) */
+	uint8_t *plain;
+	uint32_t *start;
+	uint32_t *length;
+	uint32_t *next;
+	/** @brief Position in the input of the syntax error, if any */
+	uint32_t error_at;
+};
+
+/**
+ * @brief Set up a json_tape for an input of the given length.
+ */
+void json_tape_init(struct json_tape *tape, const char *input, uint32_t len);
+
+/**
+ * @brief Free the memory held by a json_tape (but not its input).
+ */
+void json_tape_destroy(struct json_tape *tape);
+
+/**
+ * @brief Tokenize the input into the tape, if that hasn't been done.
+ *
+ * @returns 0 on success, or a parser error (see error_at), or JSONERR_NOMEM
+ */
+int json_tape_parse(struct json_tape *tape);
+
+/**
+ * @brief Return a copy of a token of the tape, as json_parse() would have
+ * made it.
+ */
+static inline struct json_token json_tape_token(const struct json_tape *tape,
+                                                uint32_t index)
+{
+	struct json_token tok = { 0 };
+
+	tok.type = (enum json_type)tape->type[index];
+	tok.plain = tape->plain[index];
+	tok.start = tape->start[index];
+	tok.length = tape->length[index];
+	tok.next = tape->next[index];
+	return tok;
+}
+
+/**
+ * @brief Loop through each value in an array, or each key in an object (whose
+ * value is at var + 1).
+ */
+#define json_tape_for_each(var, tape, idx)                                     \
+	for (var = (tape)->length[idx] ? (idx) + 1 : 0; var != 0;              \
+	     var = (tape)->next[var])
+
+/**
+ * @brief Like `json_object_get()`, on a tape.
+ */
+int json_tape_object_get(const struct json_tape *tape, uint32_t tok,
+                         const char *key, uint32_t *ret);
+
+/**
+ * @brief Like `json_array_get()`, on a tape.
+ */
+int json_tape_array_get(const struct json_tape *tape, uint32_t tok,
+                        uint32_t index, uint32_t *ret);
+
+/**
+ * @brief Like `json_path_eval()`, on a tape.
+ *
+ * Only paths which select a single value are supported (others fail with
+ * JSONERR_BAD_EXPR).
+ */
+int json_tape_path_eval(const struct json_tape *tape,
+                        const struct json_path *path, uint32_t tok,
+                        uint32_t *result);
+
+/**
+ * @brief Compile an expression and evaluate it with `json_tape_path_eval()`.
+ *
+ * @returns 0 on success, JSONERR_NOMEM, or as for `json_tape_path_eval()`
+ */
+int json_tape_lookup(const struct json_tape *tape, uint32_t tok,
+                     const char *expr, uint32_t *result);
+
+static inline int json_tape_string_load(const struct json_tape *tape,
+                                        uint32_t index, char *buffer)
+{
+	struct json_token tok = json_tape_token(tape, index);
+	return json_string_load(tape->input, &tok, 0, buffer);
+}
+static inline int json_tape_string_match(const struct json_tape *tape,
+                                         uint32_t index, const char *other,
+                                         bool *result)
+{
+	struct json_token tok = json_tape_token(tape, index);
+	return json_string_match(tape->input, &tok, 0, other, result);
+}
+static inline int json_tape_number_get(const struct json_tape *tape,
+                                       uint32_t index, double *result)
+{
+	struct json_token tok = json_tape_token(tape, index);
+	return json_number_get(tape->input, &tok, 0, result);
+}
+static inline int json_tape_number_getint(const struct json_tape *tape,
+                                          uint32_t index, int64_t *result)
+{
+	struct json_token tok = json_tape_token(tape, index);
+	return json_number_getint(tape->input, &tok, 0, result);
+}
+static inline int json_tape_number_getuint(const struct json_tape *tape,
+                                           uint32_t index, uint64_t *result)
+{
+	struct json_token tok = json_tape_token(tape, index);
+	return json_number_getuint(tape->input, &tok, 0, result);
+}
+
 #endif // SMB_JSON
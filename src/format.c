@@ -1,119 +1,317 @@
 /* format.c: human friendly JSON formatter routines */
 #include <stdint.h>
+#include <string.h>
 
 #include "json_private.h"
 
-static void print_indent(int amt, FILE *f)
+/* Size of the buffer of a writer which gives its output to a callback. */
+#define JSON_WRITER_BLOCK 65536
+
+/* Room for nesting levels, allocated at first use and doubled as needed. */
+#define JSON_WRITER_MIN_NEST 32
+
+static void json_writer_setup(struct json_writer *w, json_write_callback cb,
+                              void *arg)
+{
+	memset(w, 0, sizeof(*w));
+	w->indent = 2;
+	w->newline = true;
+	w->cb = cb;
+	w->arg = arg;
+}
+
+void json_writer_init(struct json_writer *w)
 {
-	for (int i = 0; i < amt; i++)
-		fputs("  ", f);
+	json_writer_setup(w, NULL, NULL);
 }
 
-static void push(uint32_t val, uint32_t **stack, uint32_t *len, uint32_t *cap)
+void json_writer_init_cb(struct json_writer *w, json_write_callback cb,
+                         void *arg)
 {
-	if (*len == *cap) {
-		*cap *= 2;
-		*stack = reallocarray(*stack, *cap, sizeof(val));
+	json_writer_setup(w, cb, arg);
+}
+
+int json_writer_flush(struct json_writer *w)
+{
+	if (w->cb && w->len && !w->error) {
+		if (w->cb(w->buf, w->len, w->arg))
+			w->error = JSONERR_IO;
+		w->len = 0;
 	}
-	(*stack)[*len] = val;
-	*len += 1;
+	return w->error;
 }
 
-void json_format(const char *json, const struct json_token *arr, uint32_t len,
-                 uint32_t start, FILE *f)
+void json_writer_destroy(struct json_writer *w)
 {
+	free(w->buf);
+	free(w->nest);
+	free(w->scratch);
+	w->buf = w->scratch = NULL;
+	w->nest = NULL;
+	w->len = w->cap = 0;
+}
+
+/*
+ * Return a pointer to room for n more bytes at the end of the output (and a
+ * NUL after them, when writing to memory), or NULL on error.  A callback is
+ * given the output so far before the buffer would have to grow.
+ */
+static char *json_writer_reserve(struct json_writer *w, size_t n)
+{
+	size_t cap;
+	char *buf;
+
+	if (w->error)
+		return NULL;
+	if (w->cb && w->len + n + 1 > w->cap && json_writer_flush(w))
+		return NULL;
+	if (w->len + n + 1 > w->cap) {
+		cap = w->cap ? w->cap : (w->cb ? JSON_WRITER_BLOCK : 256);
+		while (cap < w->len + n + 1)
+			cap *= 2;
+		if (!(buf = realloc(w->buf, cap))) {
+			w->error = JSONERR_NOMEM;
+			return NULL;
+		}
+		w->buf = buf;
+		w->cap = cap;
+	}
+	return w->buf + w->len;
+}
+
+static void json_writer_put(struct json_writer *w, const char *s, size_t n)
+{
+	char *out = json_writer_reserve(w, n);
+
+	if (out) {
+		memcpy(out, s, n);
+		w->len += n;
+	}
+}
+
+/* Start a new line, indented for the given depth, unless output is compact. */
+static void json_writer_newline(struct json_writer *w, uint32_t depth)
+{
+	size_t n;
+	char *out;
+
+	if (w->indent <= 0)
+		return;
+	n = (size_t)depth * w->indent;
+	if ((out = json_writer_reserve(w, n + 1))) {
+		out[0] = '\n';
+		memset(out + 1, ' ', n);
+		w->len += n + 1;
+	}
+}
+
+/* Write the comma between two members or elements, and the next line. */
+static void json_writer_comma(struct json_writer *w, uint32_t depth)
+{
+	json_writer_put(w, ",", 1);
+	json_writer_newline(w, depth);
+}
+
+/* Characters which json_string_print() escapes (see json_writer_escape) */
+static const bool json_writer_special[256] = {
+	['"'] = true,  ['\\'] = true, ['\b'] = true, ['\f'] = true,
+	['\n'] = true, ['\r'] = true, ['\t'] = true,
+};
+
+/*
+ * Write decoded string contents, escaped as by json_string_print().  Runs of
+ * characters which need no escape are copied whole, so a string without any
+ * is a single copy.
+ */
+static void json_writer_escape(struct json_writer *w, const char *s,
+                               uint32_t n)
+{
+	uint32_t i = 0, run;
+	char esc[2] = { '\\', 0 };
+
+	while (i < n) {
+		run = i;
+		while (run < n && !json_writer_special[(unsigned char)s[run]])
+			run++;
+		json_writer_put(w, s + i, run - i);
+		if (run == n)
+			break;
+		switch (s[run]) {
+		case '\b':
+			esc[1] = 'b';
+			break;
+		case '\n':
+			esc[1] = 'n';
+			break;
+		case '\f':
+			esc[1] = 'f';
+			break;
+		case '\r':
+			esc[1] = 'r';
+			break;
+		case '\t':
+			esc[1] = 't';
+			break;
+		default:
+			esc[1] = s[run];
+			break;
+		}
+		json_writer_put(w, esc, 2);
+		i = run + 1;
+	}
+}
+
+/*
+ * Write a string token in quotes.  Strings without escapes are taken straight
+ * from the input, the rest are decoded into the scratch buffer first.
+ */
+static void json_writer_string(struct json_writer *w, const char *json,
+                               const struct json_token *arr, uint32_t ix)
+{
+	uint32_t n = arr[ix].length;
+	const char *s;
+	char *scratch;
+
+	if (!arr[ix].plain && n + 1 > w->scratch_cap) {
+		if (!(scratch = realloc(w->scratch, n + 1))) {
+			w->error = JSONERR_NOMEM;
+			return;
+		}
+		w->scratch = scratch;
+		w->scratch_cap = n + 1;
+	}
+	if (json_string_view(json, arr, ix, w->scratch, &s, &n) != JSON_OK)
+		return;
+	json_writer_put(w, "\"", 1);
+	json_writer_escape(w, s, n);
+	json_writer_put(w, "\"", 1);
+}
+
+static void json_writer_key(struct json_writer *w, const char *json,
+                            const struct json_token *arr, uint32_t ix)
+{
+	json_writer_string(w, json, arr, ix);
+	json_writer_put(w, ": ", w->indent > 0 ? 2 : 1);
+}
+
+/* Push a container onto the nesting stack, returning the new depth. */
+static uint32_t json_writer_push(struct json_writer *w, uint32_t ix,
+                                 uint32_t depth)
+{
+	uint32_t cap = w->nest_cap ? w->nest_cap * 2 : JSON_WRITER_MIN_NEST;
 	uint32_t *nest;
-	uint32_t nest_len = 0;
-	uint32_t nest_cap = 32;
 
-	nest = calloc(nest_cap, sizeof(*nest));
+	if (depth == w->nest_cap) {
+		if (!(nest = reallocarray(w->nest, cap, sizeof(*nest)))) {
+			w->error = JSONERR_NOMEM;
+			return depth;
+		}
+		w->nest = nest;
+		w->nest_cap = cap;
+	}
+	w->nest[depth] = ix;
+	return depth + 1;
+}
+
+int json_write(struct json_writer *w, const char *json,
+               const struct json_token *arr, uint32_t len, uint32_t start)
+{
+	uint32_t depth = 0;
 
-	for (uint32_t ix = start; ix < len;) {
+	for (uint32_t ix = start; ix < len && !w->error;) {
 		switch (arr[ix].type) {
 		case JSON_NUMBER:
-			fprintf(f, "%.*s", arr[ix].length,
-			        &json[arr[ix].start]);
+			json_writer_put(w, &json[arr[ix].start],
+			                arr[ix].length);
 			break;
 		case JSON_TRUE:
-			fputs("true", f);
+			json_writer_put(w, "true", 4);
 			break;
 		case JSON_FALSE:
-			fputs("false", f);
+			json_writer_put(w, "false", 5);
 			break;
 		case JSON_NULL:
-			fputs("null", f);
+			json_writer_put(w, "null", 4);
 			break;
 		case JSON_STRING:
-			fputc('"', f);
-			json_string_print(json, arr, ix, f, true);
-			fputc('"', f);
+			json_writer_string(w, json, arr, ix);
 			break;
 		case JSON_ARRAY:
-			fputc('[', f);
+			json_writer_put(w, "[", 1);
 			if (arr[ix].length) {
-				fputc('\n', f);
-				push(ix, &nest, &nest_len, &nest_cap);
-				print_indent(nest_len, f);
+				depth = json_writer_push(w, ix, depth);
+				json_writer_newline(w, depth);
 				ix += 1;
 				continue;
 			} else {
-				fputc(']', f);
+				json_writer_put(w, "]", 1);
 			}
 			break;
 		case JSON_OBJECT:
-			fputc('{', f);
+			json_writer_put(w, "{", 1);
 			if (arr[ix].length) {
-				fputc('\n', f);
-				push(ix, &nest, &nest_len, &nest_cap);
+				depth = json_writer_push(w, ix, depth);
+				json_writer_newline(w, depth);
 				ix += 1;
-				/* We need to print the first key */
-				print_indent(nest_len, f);
-				fputc('"', f);
-				json_string_print(json, arr, ix, f, true);
-				fputs("\": ", f);
+				/* We need to write the first key */
+				json_writer_key(w, json, arr, ix);
 				ix += 1;
 				continue;
 			} else {
-				fputc('}', f);
+				json_writer_put(w, "}", 1);
 			}
 			break;
 		}
 	up_parent:
-		if (nest_len == 0)
+		if (depth == 0 || w->error)
 			break;
-		uint32_t pix = nest[nest_len - 1];
+		uint32_t pix = w->nest[depth - 1];
 		if (arr[pix].type == JSON_ARRAY) {
 			if (arr[ix].next) {
-				fputs(",\n", f);
-				print_indent(nest_len, f);
+				json_writer_comma(w, depth);
 				ix = arr[ix].next;
 			} else {
-				fputs("\n", f);
-				print_indent(nest_len - 1, f);
-				fputs("]", f);
-				nest_len -= 1;
+				json_writer_newline(w, depth - 1);
+				json_writer_put(w, "]", 1);
+				depth -= 1;
 				ix = pix;
 				goto up_parent;
 			}
 		} else if (arr[pix].type == JSON_OBJECT) {
 			if (arr[ix - 1].next) {
-				fputs(",\n", f);
-				print_indent(nest_len, f);
+				json_writer_comma(w, depth);
 				ix = arr[ix - 1].next;
-				fputc('"', f);
-				json_string_print(json, arr, ix, f, true);
-				fputs("\": ", f);
+				json_writer_key(w, json, arr, ix);
 				ix += 1;
 			} else {
-				fputc('\n', f);
-				print_indent(nest_len - 1, f);
-				fputc('}', f);
-				nest_len -= 1;
+				json_writer_newline(w, depth - 1);
+				json_writer_put(w, "}", 1);
+				depth -= 1;
 				ix = pix;
 				goto up_parent;
 			}
 		}
 	}
-	fputc('\n', f);
-	free(nest);
+	if (w->newline)
+		json_writer_put(w, "\n", 1);
+	/* Leave memory output NUL-terminated, even if it is empty. */
+	if (!w->cb && json_writer_reserve(w, 0))
+		w->buf[w->len] = '\0';
+	return w->error;
+}
+
+static int json_format_file(const char *buf, size_t len, void *arg)
+{
+	return fwrite(buf, 1, len, arg) != len;
+}
+
+void json_format(const char *json, const struct json_token *arr, uint32_t len,
+                 uint32_t start, FILE *f)
+{
+	struct json_writer w;
+
+	json_writer_init_cb(&w, json_format_file, f);
+	json_write(&w, json, arr, len, start);
+	json_writer_flush(&w);
+	json_writer_destroy(&w);
 }
@@ -0,0 +1,479 @@
+/***************************************************************************/ /**
+
+   @file         index.c
+
+   @author       Stephen Brennan
+
+   @brief        Indexes for fast lookups in parsed JSON.
+
+   @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the
+ Revised BSD License.  See LICENSE.txt for details.
+
+   Tokens link each array element to the next one, so finding element i means
+   following i links.  The index stores, for each array large enough to be
+   worth it, the token index of every element, so that element i is found with
+   one probe of a small hash table (keyed on the array's token index) and one
+   load.  All of the element lists share one allocation.
+
+   Likewise, finding a key in an object means decoding and comparing each key
+   in turn.  For each large enough object, the index stores every key in one
+   shared open addressing table, keyed on the object's token index and a hash
+   of the decoded key, so that a lookup hashes its key once and usually
+   decodes just the one key which matches.  Keys with equal hashes in the same
+   object are probed in document order, so that duplicate keys resolve to the
+   first one, as in json_object_get().
+
+   The index never changes after it is built, so it may be shared between
+   threads.  Containers which would have taken it over its memory limit are
+   left out, and lookups in those fall back to walking the tokens.
+
+   Since the tables hold no pointers, an index may be saved as they are, and
+   used again straight from a mapping of the file (see sidecar.c).
+
+ *******************************************************************************/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_private.h"
+#include "nosj.h"
+
+/**
+   @brief Arrays shorter than this are quick enough to walk.
+ */
+#define JSON_INDEX_MIN_ARRAY 16
+
+/**
+   @brief Objects with fewer keys than this are quick enough to search.
+ */
+#define JSON_INDEX_MIN_OBJECT 8
+
+/**
+   @brief An entry in the table of indexed arrays and objects.
+ */
+struct json_index_container {
+	/** @brief Token index of the container, plus one (0 for an empty entry) */
+	uint32_t tok;
+	/** @brief Offset of an array's elements in the elems list */
+	uint32_t off;
+};
+
+/**
+   @brief An entry in the table of object keys.
+ */
+struct json_index_key {
+	/** @brief Token index of the object */
+	uint32_t obj;
+	/** @brief Token index of the key (0 for an empty entry) */
+	uint32_t key;
+	/** @brief Hash of the decoded key */
+	uint32_t hash;
+};
+
+struct json_index {
+	const char *json;
+	const struct json_token *tokens;
+	uint32_t ntokens;
+
+	/**
+	   @brief Open addressing table of indexed containers (mask + 1 entries).
+	 */
+	struct json_index_container *containers;
+	uint32_t containers_mask;
+	/**
+	   @brief Token index of each element of each indexed array.
+	 */
+	uint32_t *elems;
+	uint32_t nelems;
+	/**
+	   @brief Open addressing table of the keys of indexed objects.
+	 */
+	struct json_index_key *keys;
+	uint32_t keys_mask;
+	/**
+	   @brief Set if the tables belong to someone else (json_index_map()).
+	 */
+	bool mapped;
+};
+
+/**
+   @brief Header of a saved index (see json_index_save()).
+ */
+struct json_index_saved {
+	uint32_t containers_mask;
+	uint32_t nelems;
+	uint32_t keys_mask;
+	/** @brief Whether there is a containers table (1) and a keys table (2) */
+	uint32_t tables;
+};
+
+/**
+   @brief Return the first slot to probe for a token index (or hash).
+ */
+static inline uint32_t json_index_slot(uint32_t tok, uint32_t mask)
+{
+	uint32_t h = tok * 2654435761u;
+	return (h ^ (h >> 16)) & mask;
+}
+
+/**
+   @brief Return the first slot to probe for a key of an object.
+ */
+static inline uint32_t json_index_key_slot(uint32_t obj, uint32_t hash,
+                                           uint32_t mask)
+{
+	return json_index_slot(hash ^ obj, mask);
+}
+
+/**
+   @brief Return the smallest power of two which is at least n (and nonzero).
+ */
+static uint32_t json_index_pow2(uint32_t n)
+{
+	uint32_t p = 1;
+	while (p < n)
+		p <<= 1;
+	return p;
+}
+
+/**
+   @brief Return the memory needed to index a token, or 0 if it isn't worth it.
+
+   Table entries are counted three times over, since tables are sized to the
+   power of two above one and a half times their number of entries.
+ */
+static size_t json_index_cost(const struct json_token *tok)
+{
+	if (tok->type == JSON_ARRAY && tok->length >= JSON_INDEX_MIN_ARRAY)
+		return (size_t)tok->length * sizeof(uint32_t) +
+		       3 * sizeof(struct json_index_container);
+	if (tok->type == JSON_OBJECT && tok->length >= JSON_INDEX_MIN_OBJECT)
+		return (size_t)tok->length * 3 * sizeof(struct json_index_key) +
+		       3 * sizeof(struct json_index_container);
+	return 0;
+}
+
+/**
+   @brief Add a container to the containers table.
+ */
+static void json_index_add_container(struct json_index *ix, uint32_t tok,
+                                     uint32_t off)
+{
+	uint32_t slot = json_index_slot(tok, ix->containers_mask);
+
+	while (ix->containers[slot].tok != 0)
+		slot = (slot + 1) & ix->containers_mask;
+	ix->containers[slot].tok = tok + 1;
+	ix->containers[slot].off = off;
+}
+
+/**
+   @brief Return the containers table entry for a token, or NULL.
+ */
+static const struct json_index_container *
+json_index_find_container(const struct json_index *ix, uint32_t tok)
+{
+	uint32_t slot = json_index_slot(tok, ix->containers_mask);
+
+	while (ix->containers[slot].tok != 0) {
+		if (ix->containers[slot].tok == tok + 1)
+			return &ix->containers[slot];
+		slot = (slot + 1) & ix->containers_mask;
+	}
+	return NULL;
+}
+
+/**
+   @brief Add the keys of an object to the keys table.
+   @returns 0 on success, or an error from decoding a key.
+ */
+static int json_index_add_keys(struct json_index *ix, uint32_t obj)
+{
+	uint32_t key, hash, slot;
+	int rv;
+
+	json_array_for_each(key, ix->tokens, obj) {
+		rv = json_string_hash(ix->json, ix->tokens, key, &hash);
+		if (rv != JSON_OK)
+			return rv;
+		slot = json_index_key_slot(obj, hash, ix->keys_mask);
+		while (ix->keys[slot].key != 0)
+			slot = (slot + 1) & ix->keys_mask;
+		ix->keys[slot].obj = obj;
+		ix->keys[slot].key = key;
+		ix->keys[slot].hash = hash;
+	}
+	return 0;
+}
+
+/**
+   @brief Index the arrays and objects which fit within the memory limit.
+   @returns 0 on success, or an error code.
+ */
+static int json_index_build_tables(struct json_index *ix, size_t max_bytes)
+{
+	const struct json_token *tokens = ix->tokens;
+	uint32_t ncontainers = 0, nelems = 0, nkeys = 0, off = 0, i, elem;
+	size_t used = 0, cost;
+	int rv;
+
+	// Choose the containers to index, in document order, until full.
+	for (i = 0; i < ix->ntokens; i++) {
+		cost = json_index_cost(&tokens[i]);
+		if (cost == 0 || cost > max_bytes - used)
+			continue;
+		used += cost;
+		ncontainers++;
+		if (tokens[i].type == JSON_ARRAY)
+			nelems += tokens[i].length;
+		else
+			nkeys += tokens[i].length;
+	}
+	if (ncontainers == 0)
+		return 0;
+
+	ix->containers_mask =
+	        json_index_pow2(ncontainers + ncontainers / 2 + 1) - 1;
+	ix->containers = calloc((size_t)ix->containers_mask + 1,
+	                        sizeof(*ix->containers));
+	if (!ix->containers)
+		return JSONERR_NOMEM;
+	ix->nelems = nelems;
+	if (nelems) {
+		ix->elems = malloc((size_t)nelems * sizeof(*ix->elems));
+		if (!ix->elems)
+			return JSONERR_NOMEM;
+	}
+	if (nkeys) {
+		ix->keys_mask = json_index_pow2(nkeys + nkeys / 2 + 1) - 1;
+		ix->keys = calloc((size_t)ix->keys_mask + 1, sizeof(*ix->keys));
+		if (!ix->keys)
+			return JSONERR_NOMEM;
+	}
+
+	// Go through the same containers again, filling in the tables.
+	used = 0;
+	for (i = 0; i < ix->ntokens && ncontainers; i++) {
+		cost = json_index_cost(&tokens[i]);
+		if (cost == 0 || cost > max_bytes - used)
+			continue;
+		used += cost;
+		ncontainers--;
+
+		json_index_add_container(ix, i, off);
+		if (tokens[i].type == JSON_ARRAY) {
+			json_array_for_each(elem, tokens, i) {
+				ix->elems[off++] = elem;
+			}
+		} else if ((rv = json_index_add_keys(ix, i)) != JSON_OK) {
+			return rv;
+		}
+	}
+	return 0;
+}
+
+struct json_index *json_index_build(const char *json,
+                                    const struct json_token *tokens,
+                                    uint32_t ntokens, size_t max_bytes)
+{
+	struct json_index *ix = calloc(1, sizeof(*ix));
+
+	if (!ix)
+		return NULL;
+	ix->json = json;
+	ix->tokens = tokens;
+	ix->ntokens = ntokens;
+	if (json_index_build_tables(ix, max_bytes) != JSON_OK) {
+		json_index_free(ix);
+		return NULL;
+	}
+	return ix;
+}
+
+void json_index_free(struct json_index *ix)
+{
+	if (!ix)
+		return;
+	if (!ix->mapped) {
+		free(ix->containers);
+		free(ix->elems);
+		free(ix->keys);
+	}
+	free(ix);
+}
+
+/**
+   @brief Return the sizes of the tables of an index, as they are saved.
+ */
+static void json_index_sizes(const struct json_index_saved *h, size_t *sizes)
+{
+	sizes[0] = (h->tables & 1) ? ((size_t)h->containers_mask + 1) *
+	                                     sizeof(struct json_index_container)
+	                           : 0;
+	sizes[1] = (size_t)h->nelems * sizeof(uint32_t);
+	sizes[2] = (h->tables & 2) ? ((size_t)h->keys_mask + 1) *
+	                                     sizeof(struct json_index_key)
+	                           : 0;
+}
+
+/**
+   @brief Write an index into buf, or if buf is null, just count the bytes.
+   @returns The number of bytes.
+ */
+size_t json_index_save(const struct json_index *ix, void *buf)
+{
+	struct json_index_saved h = {
+		.containers_mask = ix->containers_mask,
+		.nelems = ix->nelems,
+		.keys_mask = ix->keys_mask,
+		.tables = (ix->containers ? 1 : 0) | (ix->keys ? 2 : 0),
+	};
+	const void *tables[3] = { ix->containers, ix->elems, ix->keys };
+	size_t sizes[3], n = sizeof(h);
+	char *out = buf;
+
+	json_index_sizes(&h, sizes);
+	if (out)
+		memcpy(out, &h, sizeof(h));
+	for (int i = 0; i < 3; i++) {
+		if (out && sizes[i])
+			memcpy(out + n, tables[i], sizes[i]);
+		n += sizes[i];
+	}
+	return n;
+}
+
+/**
+   @brief Make an index whose tables are those saved in buf by
+   json_index_save(), without copying them.  The buffer must outlive the index.
+   @returns The index, or NULL if buf is too short or allocation fails.
+ */
+struct json_index *json_index_map(const char *json,
+                                  const struct json_token *tokens,
+                                  uint32_t ntokens, const void *buf,
+                                  size_t len)
+{
+	const char *in = buf;
+	struct json_index_saved h;
+	struct json_index *ix;
+	size_t sizes[3], n = sizeof(h);
+
+	if (len < sizeof(h))
+		return NULL;
+	memcpy(&h, in, sizeof(h));
+	json_index_sizes(&h, sizes);
+	if (sizes[0] + sizes[1] + sizes[2] > len - n)
+		return NULL;
+	if (!(ix = calloc(1, sizeof(*ix))))
+		return NULL;
+	ix->json = json;
+	ix->tokens = tokens;
+	ix->ntokens = ntokens;
+	ix->mapped = true;
+	ix->containers_mask = h.containers_mask;
+	ix->nelems = h.nelems;
+	ix->keys_mask = h.keys_mask;
+	if (sizes[0])
+		ix->containers = (struct json_index_container *)(in + n);
+	n += sizes[0];
+	if (sizes[1])
+		ix->elems = (uint32_t *)(in + n);
+	n += sizes[1];
+	if (sizes[2])
+		ix->keys = (struct json_index_key *)(in + n);
+	return ix;
+}
+
+int json_index_array_get(const struct json_index *ix, uint32_t index,
+                         uint32_t array_index, uint32_t *result)
+{
+	const struct json_token *tokens = ix->tokens;
+	const struct json_index_container *c;
+
+	if (tokens[index].type != JSON_ARRAY)
+		return JSONERR_TYPE;
+	if (array_index >= tokens[index].length)
+		return JSONERR_INDEX;
+
+	if (ix->containers && tokens[index].length >= JSON_INDEX_MIN_ARRAY &&
+	    (c = json_index_find_container(ix, index)) != NULL) {
+		*result = ix->elems[c->off + array_index];
+		return JSON_OK;
+	}
+	return json_array_get(ix->json, tokens, index, array_index, result);
+}
+
+/**
+   @brief Look up a key, given its length and hash, in an indexed object.
+   @returns 0 or JSONERR_LOOKUP, or -1 if the object isn't in the index.
+ */
+int json_index_key_get(const struct json_index *ix, uint32_t index,
+                       const char *key, size_t keylen, uint32_t hash,
+                       uint32_t *ret)
+{
+	const struct json_token *tokens = ix->tokens;
+	const struct json_index_key *k;
+	uint32_t slot;
+	bool match;
+
+	if (!ix->keys || tokens[index].type != JSON_OBJECT ||
+	    tokens[index].length < JSON_INDEX_MIN_OBJECT ||
+	    !json_index_find_container(ix, index))
+		return -1;
+
+	slot = json_index_key_slot(index, hash, ix->keys_mask);
+	while ((k = &ix->keys[slot])->key != 0) {
+		if (k->obj == index && k->hash == hash) {
+			if (tokens[k->key].plain)
+				match = json_string_match_plain(
+				        ix->json, &tokens[k->key], key, keylen);
+			else if (json_string_match(ix->json, tokens, k->key,
+			                           key, &match) != JSON_OK)
+				match = false;
+			if (match) {
+				/* Value has index one greater than key */
+				*ret = k->key + 1;
+				return JSON_OK;
+			}
+		}
+		slot = (slot + 1) & ix->keys_mask;
+	}
+	return JSONERR_LOOKUP;
+}
+
+int json_index_object_get(const struct json_index *ix, uint32_t index,
+                          const char *key, uint32_t *ret)
+{
+	size_t keylen = strlen(key);
+	uint32_t hash = json_hash_str(key);
+	int rv = json_index_key_get(ix, index, key, keylen, hash, ret);
+
+	if (rv >= 0)
+		return rv;
+	return json_object_find(ix->json, ix->tokens, NULL, index, key, keylen,
+	                        hash, ret);
+}
+
+int json_index_lookup(const struct json_index *ix, uint32_t tok,
+                      const char *key, uint32_t *result)
+{
+	return json_lookup_ix(ix->json, ix->tokens, ix, tok, key, result);
+}
+
+int json_index_path_eval(const struct json_index *ix,
+                         const struct json_path *path, uint32_t tok,
+                         uint32_t *result)
+{
+	return json_path_run(path, ix->json, ix->tokens, NULL, ix, tok,
+	                     result);
+}
+
+int json_index_path_set_eval(const struct json_index *ix,
+                             const struct json_path_set *set, uint32_t tok,
+                             uint32_t *results, int *errors)
+{
+	return json_path_set_run(set, ix->json, ix->tokens, NULL, ix, tok,
+	                         results, errors);
+}
@@ -22,20 +22,6 @@
 #include "json_private.h"
 #include "nosj.h"
 
-// forward declaration of the main parser
-static struct json_parser json_parse_rec(const char *text,
-                                         struct json_token *arr,
-                                         uint32_t maxtoken,
-                                         struct json_parser p);
-
-/**
-   @brief Return true if c is a whitespace character according to the JSON spec.
- */
-static bool json_isspace(char c)
-{
-	return (c == ' ' || c == '\t' || c == '\r' || c == '\n');
-}
-
 /**
    @brief Return true if c could be the beginning of a JSON number.
  */
@@ -72,8 +58,8 @@ void json_settoken(struct json_token *arr, struct json_token tok,
    @param tokidx The index of the token to update.
    @param next New value for next.
  */
-static void json_setnext(struct json_token *arr, uint32_t tokidx, size_t next,
-                         uint32_t maxtoken)
+void json_setnext(struct json_token *arr, uint32_t tokidx, size_t next,
+                  uint32_t maxtoken)
 {
 	if (arr == NULL || tokidx >= maxtoken) {
 		return;
@@ -92,8 +78,8 @@ static void json_setnext(struct json_token *arr, uint32_t tokidx, size_t next,
    @param tokidx The index of the token to update.
    @param length New value for end.
  */
-static void json_setlength(struct json_token *arr, uint32_t tokidx,
-                           size_t length, uint32_t maxtoken)
+void json_setlength(struct json_token *arr, uint32_t tokidx, size_t length,
+                    uint32_t maxtoken)
 {
 	if (arr == NULL || tokidx >= maxtoken) {
 		return;
@@ -109,15 +95,24 @@ static void json_setlength(struct json_token *arr, uint32_t tokidx,
    @param p The current parser state
    @returns The new parser state
  */
-static struct json_parser json_skip_whitespace(const char *text,
+static struct json_parser json_skip_whitespace(const char *text, uint32_t len,
                                                struct json_parser p)
 {
-	while (json_isspace(text[p.textidx]) && text[p.textidx] != '\0') {
+	while (p.textidx < len && json_isspace(text[p.textidx])) {
 		p.textidx++;
 	}
 	return p;
 }
 
+/**
+   @brief Return true if the literal lit appears in the text at idx.
+ */
+static bool json_match_literal(const char *text, uint32_t len, uint32_t idx,
+                               const char *lit, uint32_t litlen)
+{
+	return len - idx >= litlen && memcmp(text + idx, lit, litlen) == 0;
+}
+
 /**
    @brief Parse the "true" literal.
    @param text The text we're parsing.
@@ -126,17 +121,17 @@ static struct json_parser json_skip_whitespace(const char *text,
    @param p The parser state.
    @returns Parser state after parsing true.
  */
-static struct json_parser json_parse_true(const char *text,
+static struct json_parser json_parse_true(const char *text, uint32_t len,
                                           struct json_token *arr,
                                           uint32_t maxtoken,
                                           struct json_parser p)
 {
-	struct json_token tok;
+	struct json_token tok = { 0 };
 	tok.type = JSON_TRUE;
 	tok.start = p.textidx;
 	tok.length = 0;
 	tok.next = 0;
-	if (strncmp("true", text + p.textidx, 4) == 0) {
+	if (json_match_literal(text, len, p.textidx, "true", 4)) {
 		json_settoken(arr, tok, p, maxtoken);
 		p.textidx += 4;
 		p.tokenidx += 1;
@@ -155,18 +150,18 @@ static struct json_parser json_parse_true(const char *text,
    @param p The parser state.
    @returns Parser state after parsing false.
  */
-static struct json_parser json_parse_false(const char *text,
+static struct json_parser json_parse_false(const char *text, uint32_t len,
                                            struct json_token *arr,
                                            uint32_t maxtoken,
                                            struct json_parser p)
 {
 	(void)maxtoken; // unused
-	struct json_token tok;
+	struct json_token tok = { 0 };
 	tok.type = JSON_FALSE;
 	tok.start = p.textidx;
 	tok.length = 0;
 	tok.next = 0;
-	if (strncmp("false", text + p.textidx, 5) == 0) {
+	if (json_match_literal(text, len, p.textidx, "false", 5)) {
 		json_settoken(arr, tok, p, maxtoken);
 		p.textidx += 5;
 		p.tokenidx += 1;
@@ -185,17 +180,17 @@ static struct json_parser json_parse_false(const char *text,
    @param p The parser state.
    @returns Parser state after parsing null.
  */
-static struct json_parser json_parse_null(const char *text,
+static struct json_parser json_parse_null(const char *text, uint32_t len,
                                           struct json_token *arr,
                                           uint32_t maxtoken,
                                           struct json_parser p)
 {
-	struct json_token tok;
+	struct json_token tok = { 0 };
 	tok.type = JSON_NULL;
 	tok.start = p.textidx;
 	tok.length = 0;
 	tok.next = 0;
-	if (strncmp("null", text + p.textidx, 4) == 0) {
+	if (json_match_literal(text, len, p.textidx, "null", 4)) {
 		json_settoken(arr, tok, p, maxtoken);
 		p.textidx += 4;
 		p.tokenidx += 1;
@@ -206,178 +201,123 @@ static struct json_parser json_parse_null(const char *text,
 	}
 }
 
-/**
-   @brief Parse an array.
-   @param text The text we're parsing.
-   @param arr The token buffer.
-   @param maxtoken The length of the token buffer.
-   @param p The parser state.
-   @returns Parser state after parsing the array.
- */
-static struct json_parser json_parse_array(const char *text,
-                                           struct json_token *arr,
-                                           uint32_t maxtoken,
-                                           struct json_parser p)
-{
-	uint32_t array_tokenidx = p.tokenidx, prev_tokenidx, curr_tokenidx = 0,
-	         length = 0;
-	struct json_token tok = {
-		.type = JSON_ARRAY,
-		.start = p.textidx,
-		.length = 0,
-		.next = 0,
-	};
-	json_settoken(arr, tok, p, maxtoken);
-
-	// current char is [, so we need to go past it.
-	p.textidx++;
-	p.tokenidx++;
-
-	// Skip through whitespace.
-	p = json_skip_whitespace(text, p);
-	while (text[p.textidx] != ']') {
-
-		if (text[p.textidx] == '\0') {
-			p.error = JSONERR_PREMATURE_EOF;
-			return p;
-		}
-		// Parse a value.
-		prev_tokenidx = curr_tokenidx;
-		curr_tokenidx = p.tokenidx;
-		p = json_parse_rec(text, arr, maxtoken, p);
-		if (p.error != JSON_OK) {
-			return p;
-		}
-
-		/* Set the previous token's "next" field to point at this one.
-		 */
-		if (prev_tokenidx != 0) {
-			json_setnext(arr, prev_tokenidx, curr_tokenidx,
-			             maxtoken);
-		}
-
-		length++;
-
-		// Skip whitespace.
-		p = json_skip_whitespace(text, p);
-		if (text[p.textidx] == ',') {
-			p.textidx++;
-			p = json_skip_whitespace(text, p);
-		} else if (text[p.textidx] != ']') {
-			// If there was no comma, this better be the end of the
-			// object.
-			p.error = JSONERR_MISSING_COMMA;
-			return p;
-		}
-	}
-
-	// Set the end of the array token to point to the closing bracket, then
-	// move it up.
-	json_setlength(arr, array_tokenidx, length, maxtoken);
-	p.textidx++;
-	return p;
-}
+char *parse_number_state[] = {
+	"START",    "MINUS",          "ZERO",
+	"DIGIT",    "DECIMAL",        "DECIMAL_ACCEPT",
+	"EXPONENT", "EXPONENT_DIGIT", "EXPONENT_DIGIT_ACCEPT",
+	"END",      "INVALID"
+};
 
 /**
-   @brief Parse an object.
-   @param text The text we're parsing.
-   @param arr The token buffer.
-   @param maxtoken The length of the token buffer.
-   @param p The parser state.
-   @returns Parser state after parsing the object.
+   @brief Advance the number state machine by one character.
+
+   This function is completely described by this FSM.  States marked by
+   asterisk are accepting.  Unexpected input at accepting states ends the
+   number (JSON_NUM_END), and unexpected input at rejecting states is an error
+   (JSON_NUM_INVALID).  In both cases, c is not part of the number.  This state
+   machine is designed to accept any input given by the diagram in the ECMA
+   JSON spec.
+
+                        -----START-----
+                       /       | (-)   \
+                      /        v        \
+                  (0) | +----MINUS----+ | (1-9)
+                      v v (0)   (1-9) v v
+                   *ZERO*            *DIGIT*--------
+                    |  \ (.)       (.) / |-\ (0-9)  \
+                    |   --->DECIMAL<---              \
+                    |          |                      \
+                    |          v (0-9)  /----\ (0-9)  |
+                    |   *DECIMAL_ACCEPT* ----/        |
+                    |          |                     /
+                    |(e,E)     v (e,E)   (e,E)      /
+                    +-----> EXPONENT <-------------
+                          /        \
+                     (+,-)v        v (0-9)
+             EXPONENT_DIGIT        *EXPONENT_DIGIT_ACCEPT*
+                         \-----------/         \    /(0-9)
+                                (0-9)           \--/
+
+   @param state The current state (neither JSON_NUM_END nor JSON_NUM_INVALID).
+   @param c The next character of input.
+   @returns The next state.
  */
-static struct json_parser json_parse_object(const char *text,
-                                            struct json_token *arr,
-                                            uint32_t maxtoken,
-                                            struct json_parser p)
+enum json_number_state json_number_step(enum json_number_state state, char c)
 {
-	uint32_t object_tokenidx = p.tokenidx, prev_keyidx, curr_keyidx = 0,
-	         length = 0;
-	struct json_token tok = {
-		.type = JSON_OBJECT,
-		.start = p.textidx,
-		.length = 0,
-		.next = 0,
-	};
-	json_settoken(arr, tok, p, maxtoken);
-
-	// current char is {, so we need to go past it.
-	p.textidx++;
-	p.tokenidx++;
-
-	// Skip through whitespace.
-	p = json_skip_whitespace(text, p);
-	while (text[p.textidx] != '}') {
-		// Make sure the string didn't end.
-		if (text[p.textidx] == '\0') {
-			p.error = JSONERR_PREMATURE_EOF;
-			return p;
-		}
-
-		// Parse a string (key) and value.
-		prev_keyidx = curr_keyidx;
-		curr_keyidx = p.tokenidx;
-		p = json_parse_string(text, arr, maxtoken, p);
-		if (p.error != JSON_OK) {
-			return p;
-		}
-		p = json_skip_whitespace(text, p);
-		if (text[p.textidx] != ':') {
-			p.error = JSONERR_MISSING_COLON;
-			return p;
-		}
-		p.textidx++;
-		p = json_parse_rec(text, arr, maxtoken, p);
-		if (p.error != JSON_OK) {
-			return p;
-		}
-
-		/* Set the previous key's "next" field to point to this */
-		if (prev_keyidx != 0) {
-			// Otherwise set the previous element's next pointer to
-			// point to it.
-			json_setnext(arr, prev_keyidx, curr_keyidx, maxtoken);
-		}
-
-		length++;
-
-		// Skip whitespace.
-		p = json_skip_whitespace(text, p);
-		if (text[p.textidx] == ',') {
-			p.textidx++;
-			p = json_skip_whitespace(text, p);
-		} else if (text[p.textidx] != '}') {
-			// If there was no comma, this better be the end of the
-			// object.
-			p.error = JSONERR_MISSING_COMMA;
-			return p;
-		}
+	switch (state) {
+	case JSON_NUM_START:
+		if (c == '0')
+			return JSON_NUM_ZERO;
+		else if (c == '-')
+			return JSON_NUM_MINUS;
+		else if ('1' <= c && c <= '9')
+			return JSON_NUM_DIGIT;
+		return JSON_NUM_INVALID;
+	case JSON_NUM_MINUS:
+		if (c == '0')
+			return JSON_NUM_ZERO;
+		else if ('1' <= c && c <= '9')
+			return JSON_NUM_DIGIT;
+		return JSON_NUM_INVALID;
+	case JSON_NUM_ZERO:
+		if (c == '.')
+			return JSON_NUM_DECIMAL;
+		else if (c == 'e' || c == 'E')
+			return JSON_NUM_EXPONENT;
+		return JSON_NUM_END;
+	case JSON_NUM_DIGIT:
+		if (c == '.')
+			return JSON_NUM_DECIMAL;
+		else if (c == 'e' || c == 'E')
+			return JSON_NUM_EXPONENT;
+		else if ('0' <= c && c <= '9')
+			return JSON_NUM_DIGIT;
+		return JSON_NUM_END;
+	case JSON_NUM_DECIMAL:
+		if ('0' <= c && c <= '9')
+			return JSON_NUM_DECIMAL_ACCEPT;
+		return JSON_NUM_INVALID;
+	case JSON_NUM_DECIMAL_ACCEPT:
+		if ('0' <= c && c <= '9')
+			return JSON_NUM_DECIMAL_ACCEPT;
+		else if (c == 'e' || c == 'E')
+			return JSON_NUM_EXPONENT;
+		return JSON_NUM_END;
+	case JSON_NUM_EXPONENT:
+		if (c == '+' || c == '-')
+			return JSON_NUM_EXPONENT_DIGIT;
+		else if ('0' <= c && c <= '9')
+			return JSON_NUM_EXPONENT_DIGIT_ACCEPT;
+		return JSON_NUM_INVALID;
+	case JSON_NUM_EXPONENT_DIGIT:
+		if ('0' <= c && c <= '9')
+			return JSON_NUM_EXPONENT_DIGIT_ACCEPT;
+		return JSON_NUM_INVALID;
+	case JSON_NUM_EXPONENT_DIGIT_ACCEPT:
+		if ('0' <= c && c <= '9')
+			return JSON_NUM_EXPONENT_DIGIT_ACCEPT;
+		return JSON_NUM_END;
+	case JSON_NUM_END:
+	case JSON_NUM_INVALID:
+		// never happens
+		assert(false);
 	}
-
-	// Set the end of the array token to point to the closing bracket, then
-	// move it up.
-	json_setlength(arr, object_tokenidx, length, maxtoken);
-	p.textidx++;
-	return p;
+	return JSON_NUM_INVALID;
 }
 
-char *parse_number_state[] = {
-	"START",    "MINUS",          "ZERO",
-	"DIGIT",    "DECIMAL",        "DECIMAL_ACCEPT",
-	"EXPONENT", "EXPONENT_DIGIT", "EXPONENT_DIGIT_ACCEPT",
-	"END"
-};
-
 /**
    @brief Parse a string number.
    @param text The text we're parsing.
    @param arr The token buffer.
+   @param ints Buffer for the value of each integer (see json_parse_ints_n()).
+   May be null.
    @param maxtoken The length of the token buffer.
    @param p The parser state.
    @returns Parser state after parsing the number.
  */
-static struct json_parser json_parse_number(const char *text,
+static struct json_parser json_parse_number(const char *text, uint32_t len,
                                             struct json_token *arr,
+                                            struct json_int *ints,
                                             uint32_t maxtoken,
                                             struct json_parser p)
 {
@@ -385,186 +325,66 @@ static struct json_parser json_parse_number(const char *text,
 		                  .start = p.textidx,
 		                  .length = 0, // will become string length
 		                  .next = 0 };
-	enum state {
-		START,
-		MINUS,
-		ZERO,
-		DIGIT,
-		DECIMAL,
-		DECIMAL_ACCEPT,
-		EXPONENT,
-		EXPONENT_DIGIT,
-		EXPONENT_DIGIT_ACCEPT,
-		END
-	} state = START;
-
-	/*
-	  This function is completely described by this FSM.  States marked by
-	  asterisk are accepting.  Unexpected input at accepting states ends the
-	  number, and unexpected input at rejecting states causes an error. This
-	  state machine is designed to accept any input given by the diagram in
-	  the ECMA JSON spec.
-
-	                       -----START-----
-	                      /       | (-)   \
-	                     /        v        \
-	                 (0) | +----MINUS----+ | (1-9)
-	                     v v (0)   (1-9) v v
-	                  *ZERO*            *DIGIT*--------
-	                   |  \ (.)       (.) / |-\ (0-9)  \
-	                   |   --->DECIMAL<---              \
-	                   |          |                      \
-	                   |          v (0-9)  /----\ (0-9)  |
-	                   |   *DECIMAL_ACCEPT* ----/        |
-	                   |          |                     /
-	                   |(e,E)     v (e,E)   (e,E)      /
-	                   +-----> EXPONENT <-------------
-	                         /        \
-	                    (+,-)v        v (0-9)
-	            EXPONENT_DIGIT        *EXPONENT_DIGIT_ACCEPT*
-	                        \-----------/         \    /(0-9)
-	                               (0-9)           \--/
-	 */
-
-	// printf("input: %s\n", text + p.textidx);
-	while (state != END) {
-		char c = text[p.textidx];
-		// printf("state: %s\n", parse_number_state[state]);
-		switch (state) {
-		case START:
-			if (c == '0') {
-				state = ZERO;
-			} else if (c == '-') {
-				state = MINUS;
-			} else if ('1' <= c && c <= '9') {
-				state = DIGIT;
-			} else {
-				p.error = JSONERR_INVALID_NUMBER;
-				state = END; // ERROR
-			}
-			break;
-		case MINUS:
-			if (c == '0') {
-				state = ZERO;
-			} else if ('1' <= c && c <= '9') {
-				state = DIGIT;
-			} else {
-				p.error = JSONERR_INVALID_NUMBER;
-				state = END; // ERROR
-			}
-			break;
-		case ZERO:
-			if (c == '.') {
-				state = DECIMAL;
-			} else if (c == 'e' || c == 'E') {
-				state = EXPONENT;
-			} else {
-				state = END;
-			}
-			break;
-		case DIGIT:
-			if (c == '.') {
-				state = DECIMAL;
-			} else if (c == 'e' || c == 'E') {
-				state = EXPONENT;
-			} else if ('0' <= c && c <= '9') {
-				state = DIGIT;
-			} else {
-				state = END;
-			}
-			break;
-		case DECIMAL:
-			if ('0' <= c && c <= '9') {
-				state = DECIMAL_ACCEPT;
-			} else {
-				p.error = JSONERR_INVALID_NUMBER;
-				state = END; // ERROR
-			}
-			break;
-		case DECIMAL_ACCEPT:
-			if ('0' <= c && c <= '9') {
-				state = DECIMAL_ACCEPT;
-			} else if (c == 'e' || c == 'E') {
-				state = EXPONENT;
-			} else {
-				state = END;
-			}
-			break;
-		case EXPONENT:
-			if (c == '+' || c == '-') {
-				state = EXPONENT_DIGIT;
-			} else if ('0' <= c && c <= '9') {
-				state = EXPONENT_DIGIT_ACCEPT;
-			} else {
-				p.error = JSONERR_INVALID_NUMBER;
-				state = END; // ERROR
-			}
-			break;
-		case EXPONENT_DIGIT:
-			if ('0' <= c && c <= '9') {
-				state = EXPONENT_DIGIT_ACCEPT;
-			} else {
-				p.error = JSONERR_INVALID_NUMBER;
-				state = END; // ERROR
-			}
-			break;
-		case EXPONENT_DIGIT_ACCEPT:
-			if ('0' <= c && c <= '9') {
-				state = EXPONENT_DIGIT_ACCEPT;
-			} else {
-				state = END;
-			}
-			break;
-		case END:
-			// never happens
-			assert(false);
-		}
+	enum json_number_state state = JSON_NUM_START;
+	struct json_int val = { .integer = true };
+	char c;
+
+	while (state != JSON_NUM_END && state != JSON_NUM_INVALID) {
+		c = json_peek(text, len, p.textidx);
+		state = json_number_step(state, c);
 		p.textidx++;
+		if (!ints)
+			continue;
+		// The digits before any fraction or exponent are the value.
+		if (state == JSON_NUM_DIGIT)
+			val.integer = val.integer && json_int_push(&val.mag, c);
+		else if (state == JSON_NUM_MINUS)
+			val.neg = true;
+		else if (state != JSON_NUM_ZERO && state != JSON_NUM_END)
+			val.integer = false;
 	}
+	if (state == JSON_NUM_INVALID)
+		p.error = JSONERR_INVALID_NUMBER;
 
 	p.textidx--; // the character we failed on
 	tok.length = p.textidx - tok.start;
 	json_settoken(arr, tok, p, maxtoken);
+	if (ints && p.tokenidx < maxtoken)
+		ints[p.tokenidx] = val;
 	p.tokenidx++;
 	return p;
 }
 
 /**
-   @brief Parse any JSON value.
+   @brief Parse a scalar JSON value (anything but an object or array).
    @param text The text we're parsing.
    @param arr The token buffer.
+   @param ints Buffer for the value of each integer.  May be null.
    @param maxtoken The length of the token buffer.
    @param p The parser state.
    @returns Parser state after parsing the value.
  */
-static struct json_parser json_parse_rec(const char *text,
-                                         struct json_token *arr,
-                                         uint32_t maxtoken,
-                                         struct json_parser p)
+struct json_parser json_parse_scalar(const char *text, uint32_t len,
+                                     struct json_token *arr,
+                                     struct json_int *ints, uint32_t maxtoken,
+                                     struct json_parser p)
 {
-	p = json_skip_whitespace(text, p);
-
-	if (text[p.textidx] == '\0') {
+	switch (json_peek(text, len, p.textidx)) {
+	case '\0':
 		p.error = JSONERR_PREMATURE_EOF;
 		return p;
-	}
-
-	switch (text[p.textidx]) {
-	case '{':
-		return json_parse_object(text, arr, maxtoken, p);
-	case '[':
-		return json_parse_array(text, arr, maxtoken, p);
 	case '"':
-		return json_parse_string(text, arr, maxtoken, p);
+		return json_parse_string(text, len, arr, maxtoken, p);
 	case 't':
-		return json_parse_true(text, arr, maxtoken, p);
+		return json_parse_true(text, len, arr, maxtoken, p);
 	case 'f':
-		return json_parse_false(text, arr, maxtoken, p);
+		return json_parse_false(text, len, arr, maxtoken, p);
 	case 'n':
-		return json_parse_null(text, arr, maxtoken, p);
+		return json_parse_null(text, len, arr, maxtoken, p);
 	default:
 		if (json_isnumber(text[p.textidx])) {
-			return json_parse_number(text, arr, maxtoken, p);
+			return json_parse_number(text, len, arr, ints,
+			                         maxtoken, p);
 		} else {
 			p.error = JSONERR_UNEXPECTED_TOKEN;
 			return p;
@@ -572,6 +392,138 @@ static struct json_parser json_parse_rec(const char *text,
 	}
 }
 
+/**
+   @brief Parse any JSON value, without recursion.
+
+   Objects and arrays are tracked on an explicit stack of at most
+   NOSJ_MAX_DEPTH frames, so that neither the C stack nor the running time
+   depend on how deeply the input nests.  Inputs nested deeper than that fail
+   with JSONERR_TOO_DEEP.
+
+   @param text The text we're parsing.
+   @param arr The token buffer.
+   @param hashes Buffer for the hash of each object key (see
+   json_parse_hashed_n()).  May be null.
+   @param ints Buffer for the value of each integer (see json_parse_ints_n()).
+   May be null.
+   @param maxtoken The length of the token buffer.
+   @param p The parser state.
+   @param maxdepth Nesting depth limit (at most NOSJ_MAX_DEPTH).
+   @returns Parser state after parsing the value.
+ */
+struct json_parser json_parse_value_depth(const char *text, uint32_t len,
+                                          struct json_token *arr,
+                                          uint32_t *hashes,
+                                          struct json_int *ints,
+                                          uint32_t maxtoken,
+                                          struct json_parser p,
+                                          uint32_t maxdepth)
+{
+	struct json_frame stack[NOSJ_MAX_DEPTH];
+	struct json_frame *top = NULL;
+	struct json_token tok = { 0 };
+	uint32_t depth = 0;
+	char c;
+
+	if (json_too_long(len)) {
+		p.error = JSONERR_NOMEM;
+		return p;
+	}
+
+value:
+	p = json_skip_whitespace(text, len, p);
+	c = json_peek(text, len, p.textidx);
+	if (c != '{' && c != '[') {
+		p = json_parse_scalar(text, len, arr, ints, maxtoken, p);
+		if (p.error != JSON_OK)
+			return p;
+		goto end_value;
+	}
+	if (depth == maxdepth) {
+		p.error = JSONERR_TOO_DEEP;
+		return p;
+	}
+	top = &stack[depth++];
+	top->tokenidx = p.tokenidx;
+	top->previdx = 0;
+	top->length = 0;
+	top->object = (c == '{');
+	tok.type = top->object ? JSON_OBJECT : JSON_ARRAY;
+	tok.start = p.textidx;
+	tok.length = 0;
+	tok.next = 0;
+	json_settoken(arr, tok, p, maxtoken);
+	// current char is [ or {, so we need to go past it.
+	p.textidx++;
+	p.tokenidx++;
+	p = json_skip_whitespace(text, len, p);
+
+next_member:
+	// We're at the start of a member of the container on top of the stack.
+	c = json_peek(text, len, p.textidx);
+	if (c == (top->object ? '}' : ']')) {
+		goto end_container;
+	} else if (c == '\0') {
+		p.error = JSONERR_PREMATURE_EOF;
+		return p;
+	}
+
+	// Set the previous member's "next" field to point at this one.
+	if (top->previdx != 0)
+		json_setnext(arr, top->previdx, p.tokenidx, maxtoken);
+	top->previdx = p.tokenidx;
+
+	if (top->object) {
+		// Parse a string (key), then fall through to its value.
+		p = json_parse_key(text, len, arr, hashes, maxtoken, p);
+		if (p.error != JSON_OK)
+			return p;
+		p = json_skip_whitespace(text, len, p);
+		if (json_peek(text, len, p.textidx) != ':') {
+			p.error = JSONERR_MISSING_COLON;
+			return p;
+		}
+		p.textidx++;
+	}
+	goto value;
+
+end_value:
+	// A value just ended.  If it is in a container, find out what's next.
+	if (depth == 0)
+		return p;
+	top = &stack[depth - 1];
+	top->length++;
+	p = json_skip_whitespace(text, len, p);
+	c = json_peek(text, len, p.textidx);
+	if (c == ',') {
+		p.textidx++;
+		p = json_skip_whitespace(text, len, p);
+		goto next_member;
+	} else if (c != (top->object ? '}' : ']')) {
+		// If there was no comma, this better be the end of the
+		// container.
+		p.error = JSONERR_MISSING_COMMA;
+		return p;
+	}
+
+end_container:
+	json_setlength(arr, top->tokenidx, top->length, maxtoken);
+	p.textidx++;
+	depth--;
+	goto end_value;
+}
+
+/**
+   @brief Parse any JSON value, nested at most NOSJ_MAX_DEPTH deep.
+ */
+struct json_parser json_parse_value(const char *text, uint32_t len,
+                                    struct json_token *arr, uint32_t maxtoken,
+                                    struct json_parser p)
+{
+	return json_parse_value_depth(text, len, arr, NULL, NULL, maxtoken, p,
+	                              NOSJ_MAX_DEPTH);
+}
+
 char *json_type_str[] = { "object", "array", "number", "string",
 	                  "true",   "false", "null" };
 
@@ -588,15 +540,47 @@ char *json_error_str[] = {
 	"the array index is out of bounds",
 	"invalid object lookup syntax",
 	"the number provided is not an integer",
+	"memory allocation failed",
+	"maximum nesting depth exceeded",
+	"could not read or write a file",
+	"saved tokens do not match the input",
 };
 
-struct json_parser json_parse(const char *text, struct json_token *arr,
-                              uint32_t maxtoken)
+struct json_parser json_parse_n(const char *text, uint32_t len,
+                                struct json_token *arr, uint32_t maxtoken)
+{
+	struct json_parser parser = { .textidx = 0,
+		                      .tokenidx = 0,
+		                      .error = JSON_OK };
+	return json_parse_value(text, len, arr, maxtoken, parser);
+}
+
+struct json_parser json_parse_hashed_n(const char *text, uint32_t len,
+                                       struct json_token *arr,
+                                       uint32_t *hashes, uint32_t maxtoken)
 {
 	struct json_parser parser = { .textidx = 0,
 		                      .tokenidx = 0,
 		                      .error = JSON_OK };
-	return json_parse_rec(text, arr, maxtoken, parser);
+	return json_parse_value_depth(text, len, arr, hashes, NULL, maxtoken,
+	                              parser, NOSJ_MAX_DEPTH);
+}
+
+struct json_parser json_parse_ints_n(const char *text, uint32_t len,
+                                     struct json_token *arr,
+                                     struct json_int *ints, uint32_t maxtoken)
+{
+	struct json_parser parser = { .textidx = 0,
+		                      .tokenidx = 0,
+		                      .error = JSON_OK };
+	return json_parse_value_depth(text, len, arr, NULL, ints, maxtoken,
+	                              parser, NOSJ_MAX_DEPTH);
+}
+
+struct json_parser json_parse(const char *text, struct json_token *arr,
+                              uint32_t maxtoken)
+{
+	return json_parse_n(text, json_strlen(text), arr, maxtoken);
 }
 
 void json_print(struct json_token *arr, uint32_t n)
@@ -18,6 +18,143 @@
 
 #include "nosj.h"
 
+/**
+   @brief Maximum nesting depth of objects and arrays accepted by the parser.
+
+   The parser keeps one struct json_frame per open container on the C stack,
+   so this bounds its stack use.  It may be overridden at build time (see the
+   max_depth meson option).
+ */
+#ifndef NOSJ_MAX_DEPTH
+#define NOSJ_MAX_DEPTH 1024
+#endif
+
+/**
+   @brief Parser state for an object or array which has not been closed yet.
+ */
+struct json_frame {
+	/**
+	   @brief Index of the container's token.
+	 */
+	uint32_t tokenidx;
+	/**
+	   @brief Index of the last array element or object key (0 if none).
+	 */
+	uint32_t previdx;
+	/**
+	   @brief Number of members parsed so far.
+	 */
+	uint32_t length : 31;
+	/**
+	   @brief Whether the container is an object (otherwise, an array).
+	 */
+	uint32_t object : 1;
+};
+
+/**
+   @brief States of the number parsing state machine (see json_number_step()).
+ */
+enum json_number_state {
+	JSON_NUM_START,
+	JSON_NUM_MINUS,
+	JSON_NUM_ZERO,
+	JSON_NUM_DIGIT,
+	JSON_NUM_DECIMAL,
+	JSON_NUM_DECIMAL_ACCEPT,
+	JSON_NUM_EXPONENT,
+	JSON_NUM_EXPONENT_DIGIT,
+	JSON_NUM_EXPONENT_DIGIT_ACCEPT,
+	JSON_NUM_END,
+	JSON_NUM_INVALID
+};
+
+/**
+   @brief Saved state of the string parser, so that it can resume on new input.
+
+   The initial state (all zeroes) expects the opening quote.
+ */
+struct json_string_state {
+	/**
+	   @brief State of the string parsing state machine.
+	 */
+	uint32_t state;
+	/**
+	   @brief Number of decoded bytes so far.
+	 */
+	uint32_t outidx;
+	/**
+	   @brief Pending high surrogate, and the escape being decoded.
+	 */
+	uint32_t prev, curr;
+	/**
+	   @brief Set once the closing quote (or an error) has been reached.
+	 */
+	bool done;
+};
+
+/**
+   @brief Kinds of step in a compiled lookup expression.
+ */
+enum json_path_kind {
+	JSON_PATH_KEY,
+	JSON_PATH_INDEX,
+	/** @brief Every key's value or array element ("*" or "[*]") */
+	JSON_PATH_ANY,
+	/** @brief A range of array elements ("[a:b]") */
+	JSON_PATH_SLICE,
+};
+
+/**
+   @brief One step of a compiled lookup expression (see json_path_compile()).
+ */
+struct json_path_step {
+	/**
+	   @brief Key to look up (NUL-terminated), or NULL for other kinds.
+	 */
+	const char *key;
+	/**
+	   @brief Length and hash (see json_hash_step()) of the key.
+	 */
+	uint32_t keylen, hash;
+	/**
+	   @brief Array index to look up, or the start of a slice (UINT32_MAX if
+	   it was larger).
+	 */
+	uint32_t index;
+	/**
+	   @brief End of a slice (exclusive, UINT32_MAX if open or larger).
+	 */
+	uint32_t stop;
+	/**
+	   @brief Position in the expression to report if the step fails.
+	 */
+	uint32_t end;
+	/**
+	   @brief Kind of step (enum json_path_kind).
+	 */
+	uint8_t kind;
+	/**
+	   @brief Whether the step applies to every descendant (".."), rather
+	   than just the current token.
+	 */
+	bool descend;
+};
+
+/**
+   @brief A compiled lookup expression.
+
+   The steps are followed in one allocation by the keys they point to.
+ */
+struct json_path {
+	uint32_t nsteps;
+	/**
+	   @brief Index of the first step which may match more than one token
+	   (nsteps if none does).
+	 */
+	uint32_t multi;
+	struct json_path_step steps[];
+};
+
 /**
    @brief Array mapping JSON type to a string representation of that type.
  */
@@ -28,9 +165,169 @@ extern char *json_type_str[JSON_NULL + 1];
  */
 extern char *json_error_str[_LAST_JSONERR];
 
+/**
+   @brief Return text[idx], or the NUL character if idx is past the end.
+
+   The parser reads input through this, so that a length-bounded input looks
+   NUL-terminated, and a NUL-terminated one needs no special handling.
+ */
+static inline char json_peek(const char *text, uint32_t len, uint32_t idx)
+{
+	return idx < len ? text[idx] : '\0';
+}
+
+/**
+   @brief Return the length of a NUL-terminated input, capped to 32 bits.
+ */
+static inline uint32_t json_strlen(const char *text)
+{
+	size_t len = strlen(text);
+	return len > UINT32_MAX ? UINT32_MAX : (uint32_t)len;
+}
+
+/**
+   @brief Return whether an input is too long for the offsets in a token (see
+   NOSJ_MAX_INPUT).
+ */
+static inline bool json_too_long(uint64_t len)
+{
+	return len > NOSJ_MAX_INPUT;
+}
+
+/**
+   @brief Return true if c is a whitespace character according to the JSON spec.
+ */
+static inline bool json_isspace(char c)
+{
+	return (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+}
+
+/**
+   @brief Return the index of the first non-whitespace character at or after
+   idx, or len if there is none.
+ */
+static inline uint32_t json_skip_space(const char *text, uint32_t len,
+                                       uint32_t idx)
+{
+	while (idx < len && json_isspace(text[idx]))
+		idx++;
+	return idx;
+}
+
+/**
+   @brief Initial value of a key hash (32-bit FNV-1a).
+ */
+#define JSON_HASH_INIT 2166136261u
+
+/**
+   @brief Add one byte to a key hash.
+ */
+static inline uint32_t json_hash_step(uint32_t hash, char c)
+{
+	return (hash ^ (unsigned char)c) * 16777619u;
+}
+
+/**
+   @brief Return the hash of a NUL-terminated key.
+ */
+static inline uint32_t json_hash_str(const char *key)
+{
+	uint32_t hash = JSON_HASH_INIT;
+	while (*key)
+		hash = json_hash_step(hash, *key++);
+	return hash;
+}
+
+/**
+   @brief Append a decimal digit to an integer, returning false (and leaving it
+   alone) if the result would not fit in 64 bits.
+ */
+static inline bool json_int_push(uint64_t *n, char c)
+{
+	uint64_t d = (uint64_t)(c - '0');
+
+	if (*n > (UINT64_MAX - 9) / 10 &&
+	    (*n > UINT64_MAX / 10 || *n * 10 > UINT64_MAX - d))
+		return false;
+	*n = *n * 10 + d;
+	return true;
+}
+
+/**
+   @brief Return whether a plain string token (see json_token.plain) equals a
+   string of length len, by comparing the raw bytes.
+ */
+static inline bool json_string_match_plain(const char *json,
+                                           const struct json_token *tok,
+                                           const char *other, size_t len)
+{
+	return tok->length == len &&
+	       memcmp(json + tok->start + 1, other, len) == 0;
+}
+
 void json_settoken(struct json_token *arr, struct json_token tok,
                    struct json_parser p, uint32_t maxtoken);
-struct json_parser json_parse_string(const char *text, struct json_token *arr,
-                                     uint32_t maxtoken, struct json_parser p);
+void json_setnext(struct json_token *arr, uint32_t tokidx, size_t next,
+                  uint32_t maxtoken);
+void json_setlength(struct json_token *arr, uint32_t tokidx, size_t length,
+                    uint32_t maxtoken);
+struct json_parser json_parse_value(const char *text, uint32_t len,
+                                    struct json_token *arr, uint32_t maxtoken,
+                                    struct json_parser p);
+struct json_parser json_parse_value_depth(const char *text, uint32_t len,
+                                          struct json_token *arr,
+                                          uint32_t *hashes,
+                                          struct json_int *ints,
+                                          uint32_t maxtoken,
+                                          struct json_parser p,
+                                          uint32_t maxdepth);
+struct json_parser json_parse_scalar(const char *text, uint32_t len,
+                                     struct json_token *arr,
+                                     struct json_int *ints, uint32_t maxtoken,
+                                     struct json_parser p);
+struct json_parser json_parse_string(const char *text, uint32_t len,
+                                     struct json_token *arr, uint32_t maxtoken,
+                                     struct json_parser p);
+struct json_parser json_parse_key(const char *text, uint32_t len,
+                                  struct json_token *arr, uint32_t *hashes,
+                                  uint32_t maxtoken, struct json_parser p);
+int json_lookup_ix(const char *json, const struct json_token *arr,
+                   const struct json_index *ix, uint32_t tok, const char *key,
+                   uint32_t *result);
+bool json_key_match(const char *json, const struct json_token *tokens,
+                    const uint32_t *hashes, uint32_t index, const char *key,
+                    size_t keylen, uint32_t hash);
+int json_object_find(const char *json, const struct json_token *tokens,
+                     const uint32_t *hashes, uint32_t index, const char *key,
+                     size_t keylen, uint32_t hash, uint32_t *ret);
+int json_index_key_get(const struct json_index *ix, uint32_t index,
+                       const char *key, size_t keylen, uint32_t hash,
+                       uint32_t *ret);
+int json_path_run(const struct json_path *path, const char *json,
+                  const struct json_token *tokens, const uint32_t *hashes,
+                  const struct json_index *ix, uint32_t tok, uint32_t *result);
+int json_path_set_run(const struct json_path_set *set, const char *json,
+                      const struct json_token *tokens, const uint32_t *hashes,
+                      const struct json_index *ix, uint32_t tok,
+                      uint32_t *results, int *errors);
+int json_easy_reserve(struct json_easy *easy, uint32_t n);
+int json_easy_detach(struct json_easy *easy);
+void json_easy_unmap(struct json_easy *easy);
+size_t json_index_save(const struct json_index *ix, void *buf);
+struct json_index *json_index_map(const char *json,
+                                  const struct json_token *tokens,
+                                  uint32_t ntokens, const void *buf,
+                                  size_t len);
+struct json_parser json_easy_tokenize(struct json_easy *easy);
+enum json_number_state json_number_step(enum json_number_state state, char c);
+enum json_error json_string_resume(struct json_string_state *st,
+                                   const char *text, uint32_t *idx,
+                                   uint32_t len, bool eof);
+uint32_t json_skip_container(const char *text, uint32_t len, uint32_t idx);
+double json_number_double(const char *text, uint32_t len);
+bool json_number_integer(const char *text, uint32_t len, uint64_t *mag,
+                         bool *neg);
+int json_string_hash(const char *json, const struct json_token *tokens,
+                     uint32_t index, uint32_t *hash);
 
 #endif // SMB_JSON_PRIVATE_H
@@ -0,0 +1,305 @@
+/***************************************************************************/ /**
+
+   @file         lazy.c
+
+   @author       Stephen Brennan
+
+   @brief        On-demand tokenizing, one container at a time.
+
+   @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the
+ Revised BSD License.  See LICENSE.txt for details.
+
+   json_lazy_parse() tokenizes only the members of the root container.  Any
+   container among them becomes a single token, whose extent is found by
+   counting brackets outside of strings, 64 bytes at a time, with the block
+   classifier used by json_parse_indexed() (see json_skip_container()).
+   Nothing else inside it is looked at.  When a lookup first needs the members
+   of such a container, json_lazy_expand() tokenizes them the same way,
+   appending them to the end of the token array, and records where they went
+   in a side array (child).
+   So the tokens of a container's members are contiguous, and hold no nested
+   subtrees: element i of an array is token child + i, and member i of an
+   object has its key at child + 2 * i and its value just after.
+
+   Only the members which are tokenized are validated.  A syntax error in a
+   subtree which is never expanded goes unnoticed, and one which is expanded
+   is reported by the lookup which expanded it.  Since expanding one container
+   takes no more than its members, there is no nesting depth limit.
+
+ *******************************************************************************/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_private.h"
+#include "nosj.h"
+
+/**
+   @brief Number of tokens to allocate room for at first.
+ */
+#define JSON_LAZY_MIN_TOKENS 64
+
+/**
+   @brief Make room for n tokens in total.
+ */
+static int json_lazy_reserve(struct json_lazy *lz, uint32_t n)
+{
+	struct json_token *tokens;
+	uint32_t *child;
+	uint32_t cap = lz->tokens_cap;
+
+	if (n <= cap)
+		return 0;
+	if (cap < JSON_LAZY_MIN_TOKENS)
+		cap = JSON_LAZY_MIN_TOKENS;
+	while (cap < n)
+		cap = (cap > UINT32_MAX / 2) ? n : cap * 2;
+	child = realloc(lz->child, (size_t)cap * sizeof(*child));
+	if (!child)
+		return -1;
+	lz->child = child;
+	tokens = realloc(lz->tokens, (size_t)cap * sizeof(*tokens));
+	if (!tokens)
+		return -1;
+	lz->tokens = tokens;
+	lz->tokens_cap = cap;
+	return 0;
+}
+
+/**
+   @brief Tokenize a value which starts at p.textidx into p.tokenidx.
+
+   A container becomes a single token, with no members yet.
+ */
+static struct json_parser json_lazy_value(struct json_lazy *lz,
+                                          struct json_parser p)
+{
+	const char *text = lz->input;
+	uint32_t len = lz->input_len, end;
+	char c = json_peek(text, len, p.textidx);
+
+	if (c == '{' || c == '[') {
+		end = json_skip_container(text, len, p.textidx);
+		if (!end) {
+			p.textidx = len;
+			p.error = JSONERR_PREMATURE_EOF;
+			return p;
+		}
+		lz->tokens[p.tokenidx] = (struct json_token){
+			.type = c == '{' ? JSON_OBJECT : JSON_ARRAY,
+			.start = p.textidx,
+		};
+		p.textidx = end;
+		p.tokenidx++;
+	} else {
+		p = json_parse_scalar(text, len, lz->tokens, NULL,
+		                      lz->tokens_cap, p);
+		if (p.error != JSON_OK)
+			return p;
+	}
+	lz->child[p.tokenidx - 1] = 0;
+	return p;
+}
+
+void json_lazy_init(struct json_lazy *lz, const char *input, uint32_t len)
+{
+	memset(lz, 0, sizeof(*lz));
+	lz->input = input;
+	lz->input_len = len;
+}
+
+void json_lazy_destroy(struct json_lazy *lz)
+{
+	free(lz->child);
+	free(lz->tokens);
+}
+
+int json_lazy_parse(struct json_lazy *lz)
+{
+	struct json_parser p = { 0 };
+	char c;
+
+	/* Already parsed? */
+	if (lz->tokens_len)
+		return 0;
+	if (json_too_long(lz->input_len))
+		return JSONERR_NOMEM;
+	if (json_lazy_reserve(lz, 1))
+		return JSONERR_NOMEM;
+	p.textidx = json_skip_space(lz->input, lz->input_len, 0);
+	c = json_peek(lz->input, lz->input_len, p.textidx);
+	if (c != '{' && c != '[') {
+		p = json_lazy_value(lz, p);
+		if (p.error != JSON_OK)
+			lz->error_at = p.textidx;
+		else
+			lz->tokens_len = 1;
+		return p.error;
+	}
+
+	// Expanding the root finds where it ends, so don't skip it first.
+	lz->tokens[0] = (struct json_token){
+		.type = c == '{' ? JSON_OBJECT : JSON_ARRAY,
+		.start = p.textidx,
+	};
+	lz->child[0] = 0;
+	lz->tokens_len = 1;
+	p.error = json_lazy_expand(lz, 0);
+	if (p.error != JSON_OK)
+		lz->tokens_len = 0;
+	return p.error;
+}
+
+int json_lazy_expand(struct json_lazy *lz, uint32_t tok)
+{
+	const char *text = lz->input;
+	uint32_t len = lz->input_len, prev = 0, n = 0;
+	struct json_parser p = { 0 };
+	bool object = lz->tokens[tok].type == JSON_OBJECT;
+	char close = object ? '}' : ']', c;
+
+	if (!object && lz->tokens[tok].type != JSON_ARRAY)
+		return JSONERR_TYPE;
+	if (lz->child[tok])
+		return 0;
+
+	p.textidx = lz->tokens[tok].start + 1;
+	p.tokenidx = lz->tokens_len;
+	for (;;) {
+		p.textidx = json_skip_space(text, len, p.textidx);
+		c = json_peek(text, len, p.textidx);
+		if (c == close) {
+			break;
+		} else if (c == '\0') {
+			p.error = JSONERR_PREMATURE_EOF;
+			goto err;
+		}
+		if (json_lazy_reserve(lz, p.tokenidx + 2)) {
+			p.error = JSONERR_NOMEM;
+			goto err;
+		}
+		if (prev)
+			lz->tokens[prev].next = p.tokenidx;
+		prev = p.tokenidx;
+		if (object) {
+			p = json_parse_key(text, len, lz->tokens, NULL,
+			                   lz->tokens_cap, p);
+			if (p.error != JSON_OK)
+				goto err;
+			lz->child[prev] = 0;
+			p.textidx = json_skip_space(text, len, p.textidx);
+			if (json_peek(text, len, p.textidx) != ':') {
+				p.error = JSONERR_MISSING_COLON;
+				goto err;
+			}
+			p.textidx = json_skip_space(text, len, p.textidx + 1);
+		}
+		p = json_lazy_value(lz, p);
+		if (p.error != JSON_OK)
+			goto err;
+		n++;
+		p.textidx = json_skip_space(text, len, p.textidx);
+		c = json_peek(text, len, p.textidx);
+		if (c == ',') {
+			p.textidx++;
+		} else if (c == close) {
+			break;
+		} else {
+			p.error = JSONERR_MISSING_COMMA;
+			goto err;
+		}
+	}
+	lz->tokens[tok].length = n;
+	lz->child[tok] = lz->tokens_len;
+	lz->tokens_len = p.tokenidx;
+	return JSON_OK;
+err:
+	lz->error_at = p.textidx;
+	return p.error;
+}
+
+/**
+   @brief Look up a key whose length is known in an object.
+ */
+static int json_lazy_key(struct json_lazy *lz, uint32_t tok, const char *key,
+                         size_t keylen, uint32_t *ret)
+{
+	uint32_t i, k;
+	int rv;
+
+	if (lz->tokens[tok].type != JSON_OBJECT)
+		return JSONERR_TYPE;
+	if ((rv = json_lazy_expand(lz, tok)))
+		return rv;
+	for (i = 0; i < lz->tokens[tok].length; i++) {
+		k = lz->child[tok] + 2 * i;
+		if (lz->tokens[k].length == keylen &&
+		    json_key_match(lz->input, lz->tokens, NULL, k, key, keylen,
+		                   0)) {
+			*ret = k + 1;
+			return JSON_OK;
+		}
+	}
+	return JSONERR_LOOKUP;
+}
+
+int json_lazy_object_get(struct json_lazy *lz, uint32_t tok, const char *key,
+                         uint32_t *ret)
+{
+	return json_lazy_key(lz, tok, key, strlen(key), ret);
+}
+
+int json_lazy_array_get(struct json_lazy *lz, uint32_t tok, uint32_t index,
+                        uint32_t *ret)
+{
+	int rv;
+
+	if (lz->tokens[tok].type != JSON_ARRAY)
+		return JSONERR_TYPE;
+	if ((rv = json_lazy_expand(lz, tok)))
+		return rv;
+	if (index >= lz->tokens[tok].length)
+		return JSONERR_INDEX;
+	*ret = lz->child[tok] + index;
+	return JSON_OK;
+}
+
+int json_lazy_path_eval(struct json_lazy *lz, const struct json_path *path,
+                        uint32_t tok, uint32_t *result)
+{
+	const struct json_path_step *st;
+	int rv;
+
+	if (path->multi < path->nsteps) {
+		*result = path->steps[path->multi].end;
+		return JSONERR_BAD_EXPR;
+	}
+	for (uint32_t i = 0; i < path->nsteps; i++) {
+		st = &path->steps[i];
+		if (st->key)
+			rv = json_lazy_key(lz, tok, st->key, st->keylen, &tok);
+		else
+			rv = json_lazy_array_get(lz, tok, st->index, &tok);
+		if (rv != JSON_OK) {
+			*result = st->end;
+			return rv;
+		}
+	}
+	*result = tok;
+	return JSON_OK;
+}
+
+int json_lazy_lookup(struct json_lazy *lz, uint32_t tok, const char *expr,
+                     uint32_t *result)
+{
+	struct json_path *path;
+	int rv;
+
+	if ((rv = json_path_compile(expr, &path, result)))
+		return rv;
+	rv = json_lazy_path_eval(lz, path, tok, result);
+	json_path_free(path);
+	return rv;
+}
@@ -0,0 +1,128 @@
+/***************************************************************************/ /**
+
+   @file         ndjson.c
+
+   @author       Stephen Brennan
+
+   @brief        Reading newline-delimited JSON (JSON Lines).
+
+   @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the
+ Revised BSD License.  See LICENSE.txt for details.
+
+   Each line of input holds one JSON value.  The reader hands them out one at
+   a time as a struct json_easy, which points straight into the input buffer
+   (or a line buffer, when reading a file) and shares one token buffer across
+   all records.  Both buffers only grow when a record is larger than any seen
+   before, so that in the steady state nothing is allocated per record.
+
+ *******************************************************************************/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_private.h"
+#include "nosj.h"
+
+/**
+   @brief Initialize the fields shared by both kinds of reader.
+ */
+static void json_ndjson_init_common(struct json_ndjson *nd)
+{
+	memset(nd, 0, sizeof(*nd));
+	json_easy_init_n(&nd->record, NULL, 0);
+}
+
+void json_ndjson_init(struct json_ndjson *nd, const char *buf, size_t len)
+{
+	json_ndjson_init_common(nd);
+	nd->buf = buf;
+	nd->buf_len = len;
+}
+
+void json_ndjson_init_file(struct json_ndjson *nd, FILE *f)
+{
+	json_ndjson_init_common(nd);
+	nd->file = f;
+}
+
+/**
+   @brief Find the next line of input.
+   @param nd The reader.
+   @param[out] line The start of the line.
+   @param[out] len Its length, including any newline.
+   @returns False at the end of input.
+ */
+static bool json_ndjson_getline(struct json_ndjson *nd, const char **line,
+                                size_t *len)
+{
+	const char *end;
+	ssize_t rv;
+
+	if (nd->file) {
+		rv = getline(&nd->line_buf, &nd->line_cap, nd->file);
+		if (rv < 0)
+			return false;
+		*line = nd->line_buf;
+		*len = rv;
+		return true;
+	}
+
+	if (nd->buf_pos >= nd->buf_len)
+		return false;
+	*line = nd->buf + nd->buf_pos;
+	end = memchr(*line, '\n', nd->buf_len - nd->buf_pos);
+	*len = end ? (size_t)(end - *line) + 1 : nd->buf_len - nd->buf_pos;
+	nd->buf_pos += *len;
+	return true;
+}
+
+bool json_ndjson_next(struct json_ndjson *nd)
+{
+	const char *line;
+	size_t len, i;
+
+	for (;;) {
+		if (!json_ndjson_getline(nd, &line, &len))
+			return false;
+		nd->line++;
+		for (i = 0; i < len && json_isspace(line[i]); i++)
+			;
+		if (i < len)
+			break;
+	}
+
+	memset(&nd->p, 0, sizeof(nd->p));
+	nd->record.input = line;
+	nd->record.tokens_len = 0;
+	if (json_too_long(len)) {
+		nd->record.input_len = 0;
+		nd->p.error = JSONERR_NOMEM;
+		return true;
+	}
+	nd->record.input_len = len;
+
+	nd->p = json_easy_tokenize(&nd->record);
+	if (nd->p.error != JSON_OK)
+		return true;
+
+	// Only whitespace may follow the value on its line.
+	for (i = nd->p.textidx; i < len && json_isspace(line[i]); i++)
+		;
+	if (i < len) {
+		nd->record.tokens_len = 0;
+		nd->p.textidx = i;
+		nd->p.error = JSONERR_UNEXPECTED_TOKEN;
+	}
+	return true;
+}
+
+void json_ndjson_destroy(struct json_ndjson *nd)
+{
+	json_easy_destroy(&nd->record);
+	free(nd->line_buf);
+	nd->record.tokens = NULL;
+	nd->line_buf = NULL;
+}
@@ -0,0 +1,398 @@
+/***************************************************************************/ /**
+
+   @file         ndjson_parallel.c
+
+   @author       Stephen Brennan
+
+   @brief        Reading newline-delimited JSON on several threads.
+
+   @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the
+ Revised BSD License.  See LICENSE.txt for details.
+
+   The input is divided into fixed-size chunks, each of which is extended to
+   whole lines: chunk k holds the lines which start in bytes [k * S, (k+1) *
+   S).  Each worker finds the bounds of the chunks it handles itself (with a
+   memchr() for the next newline), so no thread has to scan the whole input.
+   Workers claim chunks by incrementing an atomic counter, which balances the
+   load when some chunks take longer than others, and each parses its chunks
+   with its own struct json_ndjson.
+
+   Unordered delivery simply calls the callback from the workers.  For ordered
+   delivery, a worker instead copies the results for its chunk into one of a
+   ring of slots.  Whichever worker completes the chunk which is next in line
+   takes over delivery, and hands out every completed chunk in order until it
+   reaches one which isn't complete.  So that memory use doesn't depend on the
+   input size, a worker may only claim a chunk once there is a free slot for
+   it.
+
+ *******************************************************************************/
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "json_private.h"
+#include "nosj.h"
+
+/**
+   @brief Bounds on the size of a chunk of input.
+ */
+#define JSON_NDJSON_MIN_CHUNK (64 * 1024)
+#define JSON_NDJSON_MAX_CHUNK (4 * 1024 * 1024)
+
+/**
+   @brief Number of chunks per thread, to give room for balancing the load.
+ */
+#define JSON_NDJSON_CHUNKS_PER_THREAD 16
+
+/**
+   @brief Number of result slots per thread (for ordered delivery).
+ */
+#define JSON_NDJSON_SLOTS_PER_THREAD 4
+
+/**
+   @brief A record saved for ordered delivery.
+ */
+struct json_ndjson_result {
+	const char *input;
+	uint32_t input_len;
+	struct json_parser p;
+	uint32_t tokens_len;
+	/** @brief Line number within the chunk */
+	size_t line;
+	/** @brief Index of the first token in the slot's token buffer */
+	size_t first_token;
+};
+
+/**
+   @brief Results of one chunk, waiting for ordered delivery.
+ */
+struct json_ndjson_slot {
+	struct json_ndjson_result *records;
+	size_t nrecords, records_cap;
+	struct json_token *tokens;
+	size_t ntokens, tokens_cap;
+	/** @brief Number of lines in the chunk */
+	size_t lines;
+	/** @brief Whether the chunk is complete (protected by the job lock) */
+	bool done;
+};
+
+/**
+   @brief State shared by all of the workers.
+ */
+struct json_ndjson_job {
+	const char *buf;
+	size_t len;
+	size_t chunk_size, nchunks;
+	bool ordered;
+	json_ndjson_callback cb;
+	void *arg;
+
+	/** @brief The next chunk to be claimed by a worker */
+	atomic_size_t next;
+	/** @brief Result to return (nonzero stops all of the workers) */
+	atomic_int result;
+
+	/* Ordered delivery only: everything below is protected by lock */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct json_ndjson_slot *slots;
+	size_t nslots;
+	/** @brief Number of chunks delivered */
+	size_t delivered;
+	/** @brief Number of lines in the chunks delivered */
+	size_t lines;
+	/** @brief Whether some worker is delivering results */
+	bool delivering;
+};
+
+/**
+   @brief Record a result, unless one has been recorded already.
+ */
+static void json_ndjson_stop(struct json_ndjson_job *job, int result)
+{
+	int expected = 0;
+	atomic_compare_exchange_strong(&job->result, &expected, result);
+}
+
+/**
+   @brief Return the offset of the first line which starts in chunk k.
+ */
+static size_t json_ndjson_chunk_start(const struct json_ndjson_job *job,
+                                      size_t k)
+{
+	const char *nl;
+	size_t pos;
+
+	if (k == 0)
+		return 0;
+	if (k >= job->nchunks)
+		return job->len;
+	pos = k * job->chunk_size - 1;
+	nl = memchr(job->buf + pos, '\n', job->len - pos);
+	return nl ? (size_t)(nl - job->buf) + 1 : job->len;
+}
+
+/**
+   @brief Grow an array to hold at least n elements of the given size.
+   @returns 0 on success, -1 if memory allocation failed.
+ */
+static int json_ndjson_reserve(void **arr, size_t *cap, size_t n, size_t size)
+{
+	size_t newcap = *cap ? *cap : 64;
+	void *mem;
+
+	if (n <= *cap)
+		return 0;
+	while (newcap < n)
+		newcap *= 2;
+	mem = realloc(*arr, newcap * size);
+	if (!mem)
+		return -1;
+	*arr = mem;
+	*cap = newcap;
+	return 0;
+}
+
+/**
+   @brief Copy the current record of a reader into a slot.
+   @returns 0 on success, -1 if memory allocation failed.
+ */
+static int json_ndjson_save(struct json_ndjson_slot *slot,
+                            const struct json_ndjson *nd)
+{
+	struct json_ndjson_result *rec;
+
+	if (json_ndjson_reserve((void **)&slot->records, &slot->records_cap,
+	                        slot->nrecords + 1, sizeof(*slot->records)) ||
+	    json_ndjson_reserve((void **)&slot->tokens, &slot->tokens_cap,
+	                        slot->ntokens + nd->record.tokens_len,
+	                        sizeof(*slot->tokens)))
+		return -1;
+	rec = &slot->records[slot->nrecords++];
+	rec->input = nd->record.input;
+	rec->input_len = nd->record.input_len;
+	rec->p = nd->p;
+	rec->tokens_len = nd->record.tokens_len;
+	rec->line = nd->line;
+	rec->first_token = slot->ntokens;
+	memcpy(slot->tokens + slot->ntokens, nd->record.tokens,
+	       nd->record.tokens_len * sizeof(*slot->tokens));
+	slot->ntokens += nd->record.tokens_len;
+	return 0;
+}
+
+/**
+   @brief Call the callback for each record in a slot.
+   @param job The job.
+   @param slot The slot.
+   @param lines Number of lines before the slot's chunk.
+   @returns The first nonzero return value of the callback, or 0.
+ */
+static int json_ndjson_deliver(struct json_ndjson_job *job,
+                               struct json_ndjson_slot *slot, size_t lines)
+{
+	struct json_ndjson nd;
+	int rv;
+
+	memset(&nd, 0, sizeof(nd));
+	for (size_t i = 0; i < slot->nrecords; i++) {
+		struct json_ndjson_result *rec = &slot->records[i];
+		nd.record.input = rec->input;
+		nd.record.input_len = rec->input_len;
+		nd.record.tokens = slot->tokens + rec->first_token;
+		nd.record.tokens_len = rec->tokens_len;
+		nd.record.tokens_cap = nd.record.tokens_len;
+		nd.p = rec->p;
+		nd.line = lines + rec->line;
+		if ((rv = job->cb(&nd, job->arg)) != 0)
+			return rv;
+	}
+	return 0;
+}
+
+/**
+   @brief Mark chunk k complete, and deliver all chunks that are now in order.
+ */
+static void json_ndjson_complete(struct json_ndjson_job *job, size_t k)
+{
+	struct json_ndjson_slot *slot;
+	size_t lines;
+	int rv;
+
+	pthread_mutex_lock(&job->lock);
+	job->slots[k % job->nslots].done = true;
+	if (job->delivering) {
+		pthread_mutex_unlock(&job->lock);
+		return;
+	}
+	job->delivering = true;
+	while (job->delivered < job->nchunks &&
+	       job->slots[job->delivered % job->nslots].done) {
+		slot = &job->slots[job->delivered % job->nslots];
+		lines = job->lines;
+		pthread_mutex_unlock(&job->lock);
+
+		rv = 0;
+		if (atomic_load(&job->result) == 0)
+			rv = json_ndjson_deliver(job, slot, lines);
+		if (rv)
+			json_ndjson_stop(job, rv);
+
+		pthread_mutex_lock(&job->lock);
+		job->lines += slot->lines;
+		slot->done = false;
+		slot->nrecords = 0;
+		slot->ntokens = 0;
+		job->delivered++;
+		pthread_cond_broadcast(&job->cond);
+	}
+	job->delivering = false;
+	pthread_mutex_unlock(&job->lock);
+}
+
+/**
+   @brief Wait until there is a free slot for chunk k.
+   @returns False if the job was stopped in the meantime.
+ */
+static bool json_ndjson_wait_slot(struct json_ndjson_job *job, size_t k)
+{
+	bool ok;
+
+	pthread_mutex_lock(&job->lock);
+	while (atomic_load(&job->result) == 0 &&
+	       k >= job->delivered + job->nslots)
+		pthread_cond_wait(&job->cond, &job->lock);
+	ok = atomic_load(&job->result) == 0;
+	pthread_mutex_unlock(&job->lock);
+	return ok;
+}
+
+/**
+   @brief Claim and parse chunks until there are none left.
+ */
+static void *json_ndjson_worker(void *varg)
+{
+	struct json_ndjson_job *job = varg;
+	struct json_ndjson_slot *slot;
+	struct json_ndjson nd;
+	size_t k, start, end;
+	int rv;
+
+	json_ndjson_init(&nd, NULL, 0);
+	while (atomic_load(&job->result) == 0) {
+		k = atomic_fetch_add(&job->next, 1);
+		if (k >= job->nchunks)
+			break;
+		if (job->ordered && !json_ndjson_wait_slot(job, k))
+			break;
+
+		// Reuse the reader (and so its token buffer) for each chunk.
+		start = json_ndjson_chunk_start(job, k);
+		end = json_ndjson_chunk_start(job, k + 1);
+		nd.buf = job->buf + start;
+		nd.buf_len = end > start ? end - start : 0;
+		nd.buf_pos = 0;
+		nd.line = 0;
+
+		if (!job->ordered) {
+			while (json_ndjson_next(&nd)) {
+				nd.line = 0;
+				if ((rv = job->cb(&nd, job->arg)) != 0) {
+					json_ndjson_stop(job, rv);
+					break;
+				}
+			}
+			continue;
+		}
+
+		slot = &job->slots[k % job->nslots];
+		while (json_ndjson_next(&nd)) {
+			if (json_ndjson_save(slot, &nd)) {
+				json_ndjson_stop(job, JSONERR_NOMEM);
+				break;
+			}
+		}
+		slot->lines = nd.line;
+		json_ndjson_complete(job, k);
+	}
+	json_ndjson_destroy(&nd);
+
+	// Wake up anybody waiting for a slot which will never free up.
+	if (job->ordered) {
+		pthread_mutex_lock(&job->lock);
+		pthread_cond_broadcast(&job->cond);
+		pthread_mutex_unlock(&job->lock);
+	}
+	return NULL;
+}
+
+int json_ndjson_parallel(const char *buf, size_t len, unsigned int nthreads,
+                         bool ordered, json_ndjson_callback cb, void *arg)
+{
+	struct json_ndjson_job job;
+	pthread_t *threads;
+	unsigned int started = 0;
+	long ncpu;
+
+	if (nthreads == 0) {
+		ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = ncpu > 0 ? (unsigned int)ncpu : 1;
+	}
+
+	memset(&job, 0, sizeof(job));
+	job.buf = buf;
+	job.len = len;
+	job.ordered = ordered;
+	job.cb = cb;
+	job.arg = arg;
+	job.chunk_size = len / ((size_t)nthreads * JSON_NDJSON_CHUNKS_PER_THREAD);
+	if (job.chunk_size < JSON_NDJSON_MIN_CHUNK)
+		job.chunk_size = JSON_NDJSON_MIN_CHUNK;
+	if (job.chunk_size > JSON_NDJSON_MAX_CHUNK)
+		job.chunk_size = JSON_NDJSON_MAX_CHUNK;
+	job.nchunks = (len + job.chunk_size - 1) / job.chunk_size;
+	if (nthreads > job.nchunks)
+		nthreads = job.nchunks ? job.nchunks : 1;
+	atomic_init(&job.next, 0);
+	atomic_init(&job.result, 0);
+
+	if (ordered) {
+		job.nslots = (size_t)nthreads * JSON_NDJSON_SLOTS_PER_THREAD;
+		job.slots = calloc(job.nslots, sizeof(*job.slots));
+		if (!job.slots)
+			return JSONERR_NOMEM;
+		pthread_mutex_init(&job.lock, NULL);
+		pthread_cond_init(&job.cond, NULL);
+	}
+
+	// The calling thread is one of the workers.  If some threads can't be
+	// started, the ones that were do all of the work.
+	threads = calloc(nthreads, sizeof(*threads));
+	if (threads) {
+		while (started + 1 < nthreads &&
+		       pthread_create(&threads[started], NULL,
+		                      json_ndjson_worker, &job) == 0)
+			started++;
+	}
+	json_ndjson_worker(&job);
+	for (unsigned int i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	if (ordered) {
+		for (size_t i = 0; i < job.nslots; i++) {
+			free(job.slots[i].records);
+			free(job.slots[i].tokens);
+		}
+		free(job.slots);
+		pthread_mutex_destroy(&job.lock);
+		pthread_cond_destroy(&job.cond);
+	}
+	return atomic_load(&job.result);
+}
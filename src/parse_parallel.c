@@ -0,0 +1,362 @@
+/***************************************************************************/ /**
+
+   @file         parse_parallel.c
+
+   @author       Stephen Brennan
+
+   @brief        Tokenizing one large array on several threads.
+
+   @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the
+ Revised BSD License.  See LICENSE.txt for details.
+
+   The elements of a top-level array can be tokenized independently, given
+   where each one starts.  Finding that out for certain takes a serial scan,
+   so instead we guess: the commas between the first two elements, along with
+   the surrounding whitespace and brackets, form a pattern (like "},\n  {" in
+   a pretty-printed array of objects) which is searched for near evenly spaced
+   points of the input.  Each match splits the array into a segment, which is
+   tokenized on its own thread into its own token buffer, element by element,
+   by json_parse_value().
+
+   A guess may be wrong, say if the match is inside a string or a nested
+   array.  But the first segment starts at a known element boundary, so if it
+   ends exactly at the first split, that split is a real element boundary too,
+   and so on for each following segment.  Hence the speculation is verified by
+   checking that every segment ended exactly at the next split.  If any did
+   not, or anything else went wrong, the input is simply parsed serially, which
+   also reports any errors.  Otherwise, the token buffers are concatenated,
+   with next links adjusted, and the last element of each segment linked to
+   the first element of the next.
+
+ *******************************************************************************/
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "json_private.h"
+#include "nosj.h"
+
+/**
+   @brief Inputs smaller than this are not worth parsing in parallel.
+ */
+#define JSON_PARALLEL_MIN_BYTES (1024 * 1024)
+
+/**
+   @brief Longest separator pattern to search for.
+ */
+#define JSON_PARALLEL_MAX_PATTERN 64
+
+/**
+   @brief A part of the array, tokenized by one thread.
+ */
+struct json_segment {
+	const char *text;
+	uint32_t len;
+	/** @brief Where the segment starts (just after a bracket or comma) */
+	uint32_t start;
+	/** @brief Where the segment must end (the next comma), if not last */
+	uint32_t end;
+	bool last;
+
+	struct json_token *tokens;
+	uint32_t ntokens, cap;
+	/** @brief Number of elements, and the index of the last one */
+	uint32_t nelems, lastelem;
+	/** @brief Whether the segment ended where it should have */
+	bool ok;
+	/** @brief Whether memory allocation failed */
+	bool nomem;
+};
+
+/**
+   @brief Make room for at least n tokens in a segment's buffer.
+ */
+static int json_segment_reserve(struct json_segment *seg, uint32_t n)
+{
+	struct json_token *tokens;
+	uint32_t cap = seg->cap;
+
+	if (n <= cap)
+		return 0;
+	if (cap < 64)
+		cap = 64;
+	while (cap < n)
+		cap = (cap > UINT32_MAX / 2) ? n : cap * 2;
+	tokens = realloc(seg->tokens, (size_t)cap * sizeof(*tokens));
+	if (!tokens)
+		return -1;
+	seg->tokens = tokens;
+	seg->cap = cap;
+	return 0;
+}
+
+/**
+   @brief Tokenize the elements of a segment.
+
+   This follows json_parse_value() for the members of an array, except that
+   the token indices are relative to the segment, and a segment which isn't
+   the last stops at its end.
+ */
+static void *json_segment_parse(void *arg)
+{
+	struct json_segment *seg = arg;
+	struct json_parser p = { .textidx = seg->start };
+	struct json_parser q;
+	uint32_t elem;
+	char c;
+
+	if (json_segment_reserve(seg, (seg->end - seg->start) / 8 + 64)) {
+		seg->nomem = true;
+		return NULL;
+	}
+	for (;;) {
+		p.textidx = json_skip_space(seg->text, seg->len, p.textidx);
+		if (seg->last &&
+		    json_peek(seg->text, seg->len, p.textidx) == ']') {
+			// A trailing comma, which json_parse() allows.
+			seg->ok = true;
+			break;
+		}
+
+		// Tokenize one element, growing the buffer if it didn't fit.
+		elem = p.tokenidx;
+		q = json_parse_value_depth(seg->text, seg->len, seg->tokens,
+		                           NULL, NULL, seg->cap, p,
+		                           NOSJ_MAX_DEPTH - 1);
+		if (q.error != JSON_OK)
+			return NULL;
+		if (q.tokenidx > seg->cap) {
+			if (json_segment_reserve(seg, q.tokenidx)) {
+				seg->nomem = true;
+				return NULL;
+			}
+			q = json_parse_value_depth(seg->text, seg->len,
+			                           seg->tokens, NULL, NULL,
+			                           seg->cap, p,
+			                           NOSJ_MAX_DEPTH - 1);
+		}
+		p = q;
+		if (seg->nelems++)
+			seg->tokens[seg->lastelem].next = elem;
+		seg->lastelem = elem;
+
+		p.textidx = json_skip_space(seg->text, seg->len, p.textidx);
+		if (!seg->last && p.textidx >= seg->end) {
+			seg->ok = (p.textidx == seg->end);
+			break;
+		}
+		c = json_peek(seg->text, seg->len, p.textidx);
+		if (c == ',') {
+			p.textidx++;
+		} else if (c == ']' && seg->last) {
+			seg->ok = true;
+			break;
+		} else {
+			return NULL;
+		}
+	}
+	seg->ntokens = p.tokenidx;
+	return NULL;
+}
+
+/**
+   @brief Return the first occurrence of pat in text[from..to), or NULL.
+ */
+static const char *json_find_pattern(const char *text, uint32_t from,
+                                     uint32_t to, const char *pat,
+                                     uint32_t patlen)
+{
+	const char *s = text + from, *end = text + to;
+
+	while ((size_t)(end - s) >= patlen &&
+	       (s = memchr(s, pat[0], end - s - patlen + 1)) != NULL) {
+		if (memcmp(s, pat, patlen) == 0)
+			return s;
+		s++;
+	}
+	return NULL;
+}
+
+/**
+   @brief Choose the segments to split a top-level array into.
+   @param text The input.
+   @param len Its length.
+   @param open Index of the opening bracket.
+   @param segs Array of up to nsegs segments to fill in.
+   @param nsegs Number of segments wanted.
+   @returns Number of segments chosen (0 if the input doesn't suit).
+ */
+static uint32_t json_parallel_split(const char *text, uint32_t len,
+                                    uint32_t open, struct json_segment *segs,
+                                    uint32_t nsegs)
+{
+	struct json_parser p = { .textidx = open + 1 };
+	uint32_t first_end, comma, second, pat_start, pat_end;
+	uint32_t n = 0, prev;
+
+	// Find the separator between the first two elements.
+	p.textidx = json_skip_space(text, len, p.textidx);
+	p = json_parse_value_depth(text, len, NULL, NULL, NULL, 0, p,
+	                           NOSJ_MAX_DEPTH - 1);
+	if (p.error != JSON_OK)
+		return 0;
+	first_end = p.textidx;
+	comma = json_skip_space(text, len, first_end);
+	if (json_peek(text, len, comma) != ',')
+		return 0;
+	second = json_skip_space(text, len, comma + 1);
+	if (second >= len)
+		return 0;
+
+	// Include the brackets around it, which make it more distinctive.
+	pat_start = (text[first_end - 1] == '}' || text[first_end - 1] == ']')
+	                    ? first_end - 1
+	                    : first_end;
+	pat_end = (text[second] == '{' || text[second] == '[') ? second + 1
+	                                                        : second;
+	if (pat_end - pat_start > JSON_PARALLEL_MAX_PATTERN)
+		return 0;
+
+	segs[n].start = open + 1;
+	prev = comma;
+	for (uint32_t k = 1; k < nsegs; k++) {
+		uint64_t from = open + (uint64_t)(len - open) * k / nsegs;
+		uint64_t to = open + (uint64_t)(len - open) * (k + 1) / nsegs;
+		const char *match;
+
+		if (from <= prev)
+			from = prev + 1;
+		if (from >= to)
+			continue;
+		match = json_find_pattern(text, from, to, text + pat_start,
+		                          pat_end - pat_start);
+		if (!match)
+			continue;
+		prev = (match - text) + (comma - pat_start);
+		segs[n++].end = prev;
+		segs[n].start = prev + 1;
+	}
+	segs[n].end = len;
+	segs[n].last = true;
+	return n + 1;
+}
+
+/**
+   @brief Tokenize a top-level array in parallel, if it can be done.
+   @returns 0 on success, JSONERR_NOMEM, or -1 to parse serially instead.
+ */
+static int json_parse_parallel(struct json_easy *easy, unsigned int nthreads)
+{
+	const char *text = easy->input;
+	uint32_t len = easy->input_len;
+	struct json_segment *segs;
+	pthread_t *threads;
+	uint32_t nsegs, open, i, started = 0;
+	uint64_t total = 1, nelems = 0;
+	struct json_token *out;
+	int rv = -1;
+
+	open = json_skip_space(text, len, 0);
+	if (json_peek(text, len, open) != '[')
+		return -1;
+
+	segs = calloc(nthreads, sizeof(*segs));
+	threads = calloc(nthreads, sizeof(*threads));
+	if (!segs || !threads) {
+		free(segs);
+		free(threads);
+		return JSONERR_NOMEM;
+	}
+	nsegs = json_parallel_split(text, len, open, segs, nthreads);
+	if (nsegs < 2)
+		goto out;
+	for (i = 0; i < nsegs; i++) {
+		segs[i].text = text;
+		segs[i].len = len;
+	}
+
+	// The calling thread takes the first segment.  If a thread can't be
+	// started, its segment is parsed here too.
+	for (i = 1; i < nsegs; i++) {
+		if (pthread_create(&threads[i], NULL, json_segment_parse,
+		                   &segs[i]) != 0)
+			break;
+		started = i;
+	}
+	json_segment_parse(&segs[0]);
+	for (i = started + 1; i < nsegs; i++)
+		json_segment_parse(&segs[i]);
+	for (i = 1; i <= started; i++)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < nsegs; i++) {
+		if (segs[i].nomem)
+			rv = JSONERR_NOMEM;
+		if (!segs[i].ok)
+			goto out;
+		total += segs[i].ntokens;
+		nelems += segs[i].nelems;
+	}
+	if (total > UINT32_MAX || nelems > UINT32_MAX)
+		goto out;
+
+	// Stitch the segments together after the array's token.
+	if (json_easy_reserve(easy, total)) {
+		rv = JSONERR_NOMEM;
+		goto out;
+	}
+	out = easy->tokens;
+	out[0] = (struct json_token){ .type = JSON_ARRAY,
+		                      .start = open,
+		                      .length = nelems,
+		                      .next = 0 };
+	total = 1;
+	for (i = 0; i < nsegs; i++) {
+		for (uint32_t j = 0; j < segs[i].ntokens; j++) {
+			struct json_token tok = segs[i].tokens[j];
+			if (tok.next)
+				tok.next += total;
+			out[total + j] = tok;
+		}
+		if (i + 1 < nsegs && segs[i + 1].nelems)
+			out[total + segs[i].lastelem].next =
+			        total + segs[i].ntokens;
+		total += segs[i].ntokens;
+	}
+	easy->tokens_len = total;
+	easy->projected = false;
+	rv = 0;
+out:
+	for (i = 0; i < nthreads; i++)
+		free(segs[i].tokens);
+	free(segs);
+	free(threads);
+	return rv;
+}
+
+int json_easy_parse_parallel(struct json_easy *easy, unsigned int nthreads)
+{
+	long ncpu;
+	int rv;
+
+	/* Already parsed? */
+	if (easy->tokens_len)
+		return 0;
+	if (nthreads == 0) {
+		ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = ncpu > 0 ? (unsigned int)ncpu : 1;
+	}
+	/* The segment parsers don't hash keys or decode integers. */
+	if (nthreads < 2 || easy->input_len < JSON_PARALLEL_MIN_BYTES ||
+	    easy->hashes || easy->ints)
+		return json_easy_parse(easy);
+
+	rv = json_parse_parallel(easy, nthreads);
+	if (rv >= 0)
+		return rv;
+	return json_easy_parse(easy);
+}
@@ -0,0 +1,883 @@
+/***************************************************************************/ /**
+
+   @file         path.c
+
+   @author       Stephen Brennan
+
+   @brief        Compiled lookup expressions.
+
+   @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the
+ Revised BSD License.  See LICENSE.txt for details.
+
+   json_lookup() parses its expression as it goes, every time it is called.
+   Here, the expression is parsed once, into a list of steps: a key, with its
+   length and hash worked out in advance, or an array index.  Evaluating the
+   steps against a document then just follows them from token to token, using
+   an index or key hashes where the document has them.  Evaluation allocates
+   nothing and modifies nothing, so a compiled path may be used by any number
+   of threads at once.
+
+   The expression language is that of json_lookup(), and a path evaluates to
+   the same token, or the same error at the same position in the expression.
+   The difference is that syntax errors are found by json_path_compile(),
+   rather than as far as evaluation gets.
+
+   The language is extended with steps which match any number of tokens:
+   wildcards ("*" and "[*]"), slices ("[a:b]") and recursive descent ("..").
+   A path using them is a query, which json_path_query() evaluates by calling
+   back for each match, recursing once per step rather than building lists of
+   intermediate results.
+
+ *******************************************************************************/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_private.h"
+#include "nosj.h"
+
+/**
+   @brief Parse a decimal number, saturating at UINT32_MAX.
+ */
+static uint32_t json_path_number(const char *expr, uint32_t *i)
+{
+	uint64_t n = 0;
+
+	while ('0' <= expr[*i] && expr[*i] <= '9') {
+		if (n < UINT32_MAX)
+			n = n * 10 + (expr[*i] - '0');
+		(*i)++;
+	}
+	return n < UINT32_MAX ? (uint32_t)n : UINT32_MAX;
+}
+
+/**
+   @brief Parse an expression into steps.
+   @param expr The expression.
+   @param steps Array to fill in with the steps, or NULL to just count them.
+   @param keys Buffer for the keys (as long as the expression), if steps is set.
+   @param[out] nsteps The number of steps.
+   @param[out] erridx The position of a syntax error.
+   @returns 0 on success, or JSONERR_BAD_EXPR.
+ */
+static int json_path_parse(const char *expr, struct json_path_step *steps,
+                           char *keys, uint32_t *nsteps, uint32_t *erridx)
+{
+	uint32_t i = 0, start, n = 0;
+	struct json_path_step st;
+	bool descend = false;
+
+	if (expr[0] == '.' && expr[1] == '.') {
+		i = 2;
+		descend = true;
+	}
+	if (expr[i] == '[')
+		goto index;
+key:
+	start = i;
+	while (expr[i] != '.' && expr[i] != '[' && expr[i] != '\0')
+		i++;
+	st = (struct json_path_step){ .kind = JSON_PATH_KEY };
+	if (i - start == 1 && expr[start] == '*') {
+		st.kind = JSON_PATH_ANY;
+	} else if (steps) {
+		memcpy(keys, &expr[start], i - start);
+		keys[i - start] = '\0';
+		st.key = keys;
+		st.keylen = i - start;
+		st.hash = json_hash_str(keys);
+		keys += i - start + 1;
+	}
+	st.end = i;
+	goto step;
+index:
+	// expr[i] is the opening bracket.
+	start = ++i;
+	st = (struct json_path_step){ .kind = JSON_PATH_INDEX };
+	if (expr[i] == '*' && expr[i + 1] == ']') {
+		st.kind = JSON_PATH_ANY;
+		i++;
+		goto close;
+	}
+	st.index = json_path_number(expr, &i);
+	if (expr[i] == ':') {
+		st.kind = JSON_PATH_SLICE;
+		start = ++i;
+		st.stop = json_path_number(expr, &i);
+		if (i == start)
+			st.stop = UINT32_MAX;
+	} else if (i == start) {
+		goto err;
+	}
+	if (expr[i] != ']')
+		goto err;
+close:
+	st.end = i++;
+step:
+	// expr[i] is just past the step.
+	st.descend = descend;
+	descend = false;
+	if (steps)
+		steps[n] = st;
+	n++;
+	if (expr[i] == '.') {
+		i++;
+		if (expr[i] == '.') {
+			i++;
+			descend = true;
+			if (expr[i] == '[')
+				goto index;
+		}
+		goto key;
+	} else if (expr[i] == '[') {
+		goto index;
+	} else if (expr[i] != '\0') {
+		goto err;
+	}
+	*nsteps = n;
+	return JSON_OK;
+err:
+	*erridx = i;
+	return JSONERR_BAD_EXPR;
+}
+
+int json_path_compile(const char *expr, struct json_path **path,
+                      uint32_t *erridx)
+{
+	uint32_t nsteps, pos = 0;
+	size_t len = strlen(expr);
+	struct json_path *p;
+	int rv;
+
+	if (len >= UINT32_MAX) {
+		rv = JSONERR_BAD_EXPR;
+		goto err;
+	}
+	rv = json_path_parse(expr, NULL, NULL, &nsteps, &pos);
+	if (rv != JSON_OK)
+		goto err;
+
+	p = malloc(sizeof(*p) + nsteps * sizeof(p->steps[0]) + len + 1);
+	if (!p) {
+		rv = JSONERR_NOMEM;
+		goto err;
+	}
+	json_path_parse(expr, p->steps, (char *)&p->steps[nsteps], &p->nsteps,
+	                &pos);
+	for (p->multi = 0; p->multi < p->nsteps; p->multi++)
+		if (p->steps[p->multi].kind > JSON_PATH_INDEX ||
+		    p->steps[p->multi].descend)
+			break;
+	*path = p;
+	return JSON_OK;
+err:
+	if (erridx)
+		*erridx = pos;
+	return rv;
+}
+
+void json_path_free(struct json_path *path)
+{
+	free(path);
+}
+
+/**
+   @brief Evaluate a path, using key hashes or an index if given.
+ */
+int json_path_run(const struct json_path *path, const char *json,
+                  const struct json_token *tokens, const uint32_t *hashes,
+                  const struct json_index *ix, uint32_t tok, uint32_t *result)
+{
+	const struct json_path_step *st;
+	int rv;
+
+	if (path->multi < path->nsteps) {
+		*result = path->steps[path->multi].end;
+		return JSONERR_BAD_EXPR;
+	}
+	for (uint32_t i = 0; i < path->nsteps; i++) {
+		st = &path->steps[i];
+		if (st->key) {
+			rv = -1;
+			if (ix)
+				rv = json_index_key_get(ix, tok, st->key,
+				                        st->keylen, st->hash, &tok);
+			if (rv < 0)
+				rv = json_object_find(json, tokens, hashes, tok,
+				                      st->key, st->keylen,
+				                      st->hash, &tok);
+		} else if (ix) {
+			rv = json_index_array_get(ix, tok, st->index, &tok);
+		} else {
+			rv = json_array_get(json, tokens, tok, st->index, &tok);
+		}
+		if (rv != JSON_OK) {
+			*result = st->end;
+			return rv;
+		}
+	}
+	*result = tok;
+	return JSON_OK;
+}
+
+int json_path_eval(const struct json_path *path, const char *json,
+                   const struct json_token *tokens, uint32_t tok,
+                   uint32_t *result)
+{
+	return json_path_run(path, json, tokens, NULL, NULL, tok, result);
+}
+
+int json_easy_path_eval(struct json_easy *easy, const struct json_path *path,
+                        uint32_t tok, uint32_t *result)
+{
+	return json_path_run(path, easy->input, easy->tokens, easy->hashes,
+	                     easy->index, tok, result);
+}
+
+/*******************************************************************************
+
+                               Sets of Paths
+
+   A set of paths is a trie: each node is a step from its parent, and each
+   path ends at some node.  Evaluating the set visits each node once, looking
+   up all of its children together, so that shared prefixes are followed once
+   and each object's keys are scanned once, rather than once per path.
+
+   The nodes are stored in breadth-first order, so that each node's children
+   are contiguous (keys first, then indices in increasing order).  The paths
+   are numbered in depth-first order, so that the paths through each node are
+   contiguous too, starting with those which end there.  Failing to look up a
+   node fails all of the paths through it.
+
+*******************************************************************************/
+
+/**
+   @brief Number of key children looked up in one scan of an object.
+
+   Which of them have been found is kept in a bitmap, so that duplicate keys
+   resolve to the first, like json_object_get().
+ */
+#define JSON_PATH_SET_BATCH 64
+
+struct json_path_node {
+	/**
+	   @brief Step from the parent (unused for the root).
+	 */
+	struct json_path_step step;
+	/**
+	   @brief Number of steps from the root.
+	 */
+	uint32_t depth;
+	/**
+	   @brief First child, and the number of key and index children.
+	 */
+	uint32_t child, nkeys, nindices;
+	/**
+	   @brief Range of paths through this node, and how many end here.
+	 */
+	uint32_t lo, hi, nterm;
+};
+
+struct json_path_set {
+	struct json_path_node *nodes;
+	/**
+	   @brief The paths, in depth-first order.
+	 */
+	uint32_t *order;
+	/**
+	   @brief Error position of each step, for each path.
+	 */
+	uint32_t *ends, *ends_off;
+	/**
+	   @brief Storage for the keys of the steps.
+	 */
+	char *keys;
+};
+
+/**
+   @brief A node of the trie while it is being built.
+ */
+struct json_path_tmp {
+	const struct json_path_step *step;
+	uint32_t first, sibling;
+};
+
+static bool json_path_step_equal(const struct json_path_step *a,
+                                 const struct json_path_step *b)
+{
+	if (!a->key || !b->key)
+		return !a->key && !b->key && a->index == b->index;
+	return a->keylen == b->keylen && a->hash == b->hash &&
+	       memcmp(a->key, b->key, a->keylen) == 0;
+}
+
+/**
+   @brief Return whether step a goes before b: keys, then increasing indices.
+ */
+static bool json_path_step_before(const struct json_path_step *a,
+                                  const struct json_path_step *b)
+{
+	if (a->key || b->key)
+		return a->key && !b->key;
+	return a->index < b->index;
+}
+
+void json_path_set_free(struct json_path_set *set)
+{
+	if (!set)
+		return;
+	free(set->nodes);
+	free(set->order);
+	free(set->ends);
+	free(set->ends_off);
+	free(set->keys);
+	free(set);
+}
+
+/**
+   @brief Flatten a trie into set->nodes, in breadth-first order.
+   @param set The set, with room for nnodes nodes and their keys.
+   @param tmp The trie.
+   @param nnodes Number of nodes in the trie.
+   @param bfs Scratch space for nnodes entries: on return, maps new node
+   numbers to old ones.
+   @param map Scratch space for nnodes entries: on return, maps old node
+   numbers to new ones.
+ */
+static void json_path_set_flatten(struct json_path_set *set,
+                                  const struct json_path_tmp *tmp,
+                                  uint32_t nnodes, uint32_t *bfs, uint32_t *map)
+{
+	struct json_path_node *node;
+	char *keys = set->keys;
+	uint32_t i, j, n = 1, c;
+
+	bfs[0] = 0;
+	for (i = 0; i < nnodes; i++) {
+		node = &set->nodes[i];
+		map[bfs[i]] = i;
+		if (i == 0) {
+			memset(node, 0, sizeof(*node));
+		} else {
+			struct json_path_step *st = &node->step;
+			*st = *tmp[bfs[i]].step;
+			if (st->key) {
+				memcpy(keys, st->key, st->keylen + 1);
+				st->key = keys;
+				keys += st->keylen + 1;
+			}
+		}
+		node->child = n;
+		node->nkeys = node->nindices = 0;
+		// Queue the children, by insertion sort.
+		for (c = tmp[bfs[i]].first; c != 0; c = tmp[c].sibling) {
+			const struct json_path_step *st = tmp[c].step;
+			for (j = n++; j > node->child; j--) {
+				uint32_t prev = bfs[j - 1];
+				if (!json_path_step_before(st, tmp[prev].step))
+					break;
+				bfs[j] = bfs[j - 1];
+			}
+			bfs[j] = c;
+			if (tmp[c].step->key)
+				node->nkeys++;
+			else
+				node->nindices++;
+		}
+		for (j = node->child; j < n; j++)
+			set->nodes[j].depth = node->depth + 1;
+	}
+}
+
+int json_path_set_build(struct json_path *const *paths, uint32_t npaths,
+                        struct json_path_set **out)
+{
+	struct json_path_set *set = calloc(1, sizeof(*set));
+	struct json_path_tmp *tmp = NULL;
+	uint32_t *leaf = NULL, *bfs = NULL, *map = NULL;
+	uint32_t nnodes = 1, nsteps = 0, i, j, cur, c;
+	size_t keylen = 0;
+	int rv = JSONERR_NOMEM;
+
+	if (!set)
+		return JSONERR_NOMEM;
+	for (i = 0; i < npaths; i++) {
+		if (paths[i]->multi < paths[i]->nsteps) {
+			json_path_set_free(set);
+			return JSONERR_BAD_EXPR;
+		}
+		nsteps += paths[i]->nsteps;
+		for (j = 0; j < paths[i]->nsteps; j++)
+			keylen += paths[i]->steps[j].keylen + 1;
+	}
+	tmp = calloc(nsteps + 1, sizeof(*tmp));
+	leaf = calloc(npaths + 1, sizeof(*leaf));
+	bfs = calloc(nsteps + 1, sizeof(*bfs));
+	map = calloc(nsteps + 1, sizeof(*map));
+	set->nodes = calloc(nsteps + 1, sizeof(*set->nodes));
+	set->order = calloc(npaths + 1, sizeof(*set->order));
+	set->ends = calloc(nsteps + 1, sizeof(*set->ends));
+	set->ends_off = calloc(npaths + 1, sizeof(*set->ends_off));
+	set->keys = malloc(keylen + 1);
+	if (!tmp || !leaf || !bfs || !map || !set->nodes || !set->order ||
+	    !set->ends || !set->ends_off || !set->keys)
+		goto out;
+
+	// Insert each path into the trie, remembering where it ends.
+	nsteps = 0;
+	for (i = 0; i < npaths; i++) {
+		cur = 0;
+		set->ends_off[i] = nsteps;
+		for (j = 0; j < paths[i]->nsteps; j++) {
+			const struct json_path_step *st = &paths[i]->steps[j];
+			set->ends[nsteps++] = st->end;
+			for (c = tmp[cur].first; c != 0; c = tmp[c].sibling)
+				if (json_path_step_equal(tmp[c].step, st))
+					break;
+			if (c == 0) {
+				c = nnodes++;
+				tmp[c].step = st;
+				tmp[c].sibling = tmp[cur].first;
+				tmp[cur].first = c;
+			}
+			cur = c;
+		}
+		leaf[i] = cur;
+	}
+	json_path_set_flatten(set, tmp, nnodes, bfs, map);
+
+	// Count the paths through each node: children come after their parent,
+	// so walking backwards adds each subtree up before its parent is done.
+	for (i = 0; i < npaths; i++) {
+		leaf[i] = map[leaf[i]];
+		set->nodes[leaf[i]].nterm++;
+	}
+	for (i = nnodes; i-- > 0;) {
+		struct json_path_node *node = &set->nodes[i];
+		node->hi = node->nterm;
+		for (j = 0; j < node->nkeys + node->nindices; j++)
+			node->hi += set->nodes[node->child + j].hi;
+	}
+	// Now lay the ranges out depth first: each node's paths, then those of
+	// each child in turn.
+	set->nodes[0].lo = 0;
+	for (i = 0; i < nnodes; i++) {
+		struct json_path_node *node = &set->nodes[i];
+		uint32_t pos = node->lo + node->nterm;
+		node->hi += node->lo;
+		for (j = 0; j < node->nkeys + node->nindices; j++) {
+			set->nodes[node->child + j].lo = pos;
+			pos += set->nodes[node->child + j].hi;
+		}
+	}
+	for (i = 0; i < nnodes; i++)
+		map[i] = set->nodes[i].lo;
+	for (i = 0; i < npaths; i++)
+		set->order[map[leaf[i]]++] = i;
+
+	*out = set;
+	set = NULL;
+	rv = JSON_OK;
+out:
+	free(tmp);
+	free(leaf);
+	free(bfs);
+	free(map);
+	json_path_set_free(set);
+	return rv;
+}
+
+/**
+   @brief Everything an evaluation needs, aside from the node and token.
+ */
+struct json_path_set_arg {
+	const struct json_path_set *set;
+	const char *json;
+	const struct json_token *tokens;
+	const uint32_t *hashes;
+	const struct json_index *ix;
+	uint32_t *results;
+	int *errors;
+};
+
+/**
+   @brief Fail every path through a node, at that node's step.
+ */
+static void json_path_set_fail(const struct json_path_set_arg *r,
+                               uint32_t n, int err)
+{
+	const struct json_path_set *set = r->set;
+	const struct json_path_node *node = &set->nodes[n];
+
+	for (uint32_t i = node->lo; i < node->hi; i++) {
+		uint32_t p = set->order[i];
+		r->errors[p] = err;
+		r->results[p] = set->ends[set->ends_off[p] + node->depth - 1];
+	}
+}
+
+static void json_path_set_visit(const struct json_path_set_arg *r,
+                                uint32_t n, uint32_t tok);
+
+/**
+   @brief Look up a node's key children, in one scan of the object's keys.
+ */
+static void json_path_set_keys(const struct json_path_set_arg *r,
+                               const struct json_path_node *node, uint32_t tok)
+{
+	const struct json_path_node *nodes = r->set->nodes;
+	uint32_t first = node->child, end = node->child + node->nkeys;
+	const struct json_path_step *st;
+	uint32_t b, c, n, key, val;
+	uint64_t want;
+	int rv;
+
+	if (r->tokens[tok].type != JSON_OBJECT) {
+		for (c = first; c < end; c++)
+			json_path_set_fail(r, c, JSONERR_TYPE);
+		return;
+	}
+	// json_array_for_each() would walk past an empty object.
+	if (r->tokens[tok].length == 0) {
+		for (c = first; c < end; c++)
+			json_path_set_fail(r, c, JSONERR_LOOKUP);
+		return;
+	}
+	if (r->ix) {
+		// Either every key is looked up in the index, or none is.
+		for (c = first; c < end; c++) {
+			st = &nodes[c].step;
+			rv = json_index_key_get(r->ix, tok, st->key, st->keylen,
+			                        st->hash, &val);
+			if (rv < 0)
+				break;
+			else if (rv == JSON_OK)
+				json_path_set_visit(r, c, val);
+			else
+				json_path_set_fail(r, c, rv);
+		}
+		if (c == end)
+			return;
+	}
+
+	for (b = first; b < end; b += JSON_PATH_SET_BATCH) {
+		n = end - b;
+		if (n < JSON_PATH_SET_BATCH) {
+			want = ((uint64_t)1 << n) - 1;
+		} else {
+			n = JSON_PATH_SET_BATCH;
+			want = UINT64_MAX;
+		}
+		json_array_for_each(key, r->tokens, tok) {
+			for (c = 0; c < n; c++) {
+				st = &nodes[b + c].step;
+				if (!(want & ((uint64_t)1 << c)) ||
+				    r->tokens[key].length != st->keylen)
+					continue;
+				if (!json_key_match(r->json, r->tokens,
+				                    r->hashes, key, st->key,
+				                    st->keylen, st->hash))
+					continue;
+				want &= ~((uint64_t)1 << c);
+				json_path_set_visit(r, b + c, key + 1);
+				break;
+			}
+			if (!want)
+				break;
+		}
+		for (c = 0; c < n; c++)
+			if (want & ((uint64_t)1 << c))
+				json_path_set_fail(r, b + c, JSONERR_LOOKUP);
+	}
+}
+
+/**
+   @brief Look up a node's index children, in one scan of the array.
+ */
+static void json_path_set_indices(const struct json_path_set_arg *r,
+                                  const struct json_path_node *node,
+                                  uint32_t tok)
+{
+	const struct json_path_node *nodes = r->set->nodes;
+	uint32_t c = node->child + node->nkeys;
+	uint32_t end = c + node->nindices;
+	uint32_t i = 0, elem;
+	int rv;
+
+	if (r->ix) {
+		for (; c < end; c++) {
+			uint32_t index = nodes[c].step.index;
+			rv = json_index_array_get(r->ix, tok, index, &elem);
+			if (rv == JSON_OK)
+				json_path_set_visit(r, c, elem);
+			else
+				json_path_set_fail(r, c, rv);
+		}
+		return;
+	}
+	if (r->tokens[tok].type != JSON_ARRAY) {
+		for (; c < end; c++)
+			json_path_set_fail(r, c, JSONERR_TYPE);
+		return;
+	}
+	// The children are in increasing order of index, and all different.
+	if (r->tokens[tok].length) {
+		json_array_for_each(elem, r->tokens, tok) {
+			if (c == end)
+				break;
+			if (nodes[c].step.index == i++)
+				json_path_set_visit(r, c++, elem);
+		}
+	}
+	for (; c < end; c++)
+		json_path_set_fail(r, c, JSONERR_INDEX);
+}
+
+/**
+   @brief Resolve the paths through a node, given the node's token.
+ */
+static void json_path_set_visit(const struct json_path_set_arg *r,
+                                uint32_t n, uint32_t tok)
+{
+	const struct json_path_set *set = r->set;
+	const struct json_path_node *node = &set->nodes[n];
+
+	for (uint32_t i = node->lo; i < node->lo + node->nterm; i++) {
+		r->errors[set->order[i]] = JSON_OK;
+		r->results[set->order[i]] = tok;
+	}
+	if (node->nkeys)
+		json_path_set_keys(r, node, tok);
+	if (node->nindices)
+		json_path_set_indices(r, node, tok);
+}
+
+/**
+   @brief Evaluate a set of paths, using key hashes or an index if given.
+ */
+int json_path_set_run(const struct json_path_set *set, const char *json,
+                      const struct json_token *tokens, const uint32_t *hashes,
+                      const struct json_index *ix, uint32_t tok,
+                      uint32_t *results, int *errors)
+{
+	struct json_path_set_arg r = { set,     json,    tokens, hashes,
+		                       ix,      results, errors };
+	uint32_t n = set->nodes[0].hi;
+
+	json_path_set_visit(&r, 0, tok);
+	for (uint32_t i = 0; i < n; i++)
+		if (errors[i] != JSON_OK)
+			return errors[i];
+	return JSON_OK;
+}
+
+int json_path_set_eval(const struct json_path_set *set, const char *json,
+                       const struct json_token *tokens, uint32_t tok,
+                       uint32_t *results, int *errors)
+{
+	return json_path_set_run(set, json, tokens, NULL, NULL, tok, results,
+	                         errors);
+}
+
+int json_easy_path_set_eval(struct json_easy *easy,
+                            const struct json_path_set *set, uint32_t tok,
+                            uint32_t *results, int *errors)
+{
+	return json_path_set_run(set, easy->input, easy->tokens, easy->hashes,
+	                         easy->index, tok, results, errors);
+}
+
+/*******************************************************************************
+
+                                  Queries
+
+*******************************************************************************/
+
+/**
+   @brief Everything a query needs, aside from the step and token.
+ */
+struct json_path_query_arg {
+	const struct json_path *path;
+	const char *json;
+	const struct json_token *tokens;
+	const uint32_t *hashes;
+	const struct json_index *ix;
+	json_path_callback cb;
+	void *arg;
+};
+
+/**
+   @brief Return one past the last token in the value starting at tok.
+ */
+static uint32_t json_path_value_end(const struct json_token *tokens,
+                                    uint32_t tok)
+{
+	uint32_t last;
+
+	// Descend through the last member of each container.
+	while ((tokens[tok].type == JSON_OBJECT ||
+	        tokens[tok].type == JSON_ARRAY) && tokens[tok].length) {
+		last = tok + 1;
+		while (tokens[last].next)
+			last = tokens[last].next;
+		tok = tokens[tok].type == JSON_OBJECT ? last + 1 : last;
+	}
+	return tok + 1;
+}
+
+static int json_path_match(const struct json_path_query_arg *q, uint32_t i,
+                           uint32_t tok);
+
+/**
+   @brief Apply step i to one token, matching the rest of the path against
+   each token it leads to.
+ */
+static int json_path_apply(const struct json_path_query_arg *q, uint32_t i,
+                           uint32_t tok)
+{
+	const struct json_path_step *st = &q->path->steps[i];
+	const struct json_token *tokens = q->tokens;
+	const struct json_token *t = &tokens[tok];
+	uint32_t elem, n;
+	int rv = -1;
+
+	switch (st->kind) {
+	case JSON_PATH_KEY:
+		if (t->type != JSON_OBJECT)
+			return 0;
+		if (q->ix)
+			rv = json_index_key_get(q->ix, tok, st->key, st->keylen,
+			                        st->hash, &elem);
+		if (rv < 0)
+			rv = json_object_find(q->json, tokens, q->hashes, tok,
+			                      st->key, st->keylen, st->hash,
+			                      &elem);
+		return rv == JSON_OK ? json_path_match(q, i + 1, elem) : 0;
+	case JSON_PATH_ANY:
+		// json_array_for_each() would walk past an empty container.
+		if ((t->type != JSON_OBJECT && t->type != JSON_ARRAY) ||
+		    t->length == 0)
+			return 0;
+		json_array_for_each(elem, tokens, tok) {
+			n = t->type == JSON_OBJECT ? elem + 1 : elem;
+			if ((rv = json_path_match(q, i + 1, n)))
+				return rv;
+		}
+		return 0;
+	case JSON_PATH_INDEX:
+	case JSON_PATH_SLICE:
+		n = st->index;
+		if (t->type != JSON_ARRAY || n >= t->length)
+			return 0;
+		if (q->ix)
+			json_index_array_get(q->ix, tok, n, &elem);
+		else
+			json_array_get(q->json, tokens, tok, n, &elem);
+		if (st->kind == JSON_PATH_INDEX)
+			return json_path_match(q, i + 1, elem);
+		for (; elem && n < st->stop; elem = tokens[elem].next, n++)
+			if ((rv = json_path_match(q, i + 1, elem)))
+				return rv;
+		return 0;
+	}
+	return 0;
+}
+
+/**
+   @brief Match steps i onwards against a token, calling back for each match.
+ */
+static int json_path_match(const struct json_path_query_arg *q, uint32_t i,
+                           uint32_t tok)
+{
+	uint32_t end;
+	int rv;
+
+	if (i == q->path->nsteps)
+		return q->cb(tok, q->arg);
+	if (!q->path->steps[i].descend)
+		return json_path_apply(q, i, tok);
+
+	// The descendants of a token follow it in the array, in document order.
+	end = json_path_value_end(q->tokens, tok);
+	for (; tok < end; tok++) {
+		if (q->tokens[tok].type != JSON_OBJECT &&
+		    q->tokens[tok].type != JSON_ARRAY)
+			continue;
+		if ((rv = json_path_apply(q, i, tok)))
+			return rv;
+	}
+	return 0;
+}
+
+/**
+   @brief Evaluate a query, using key hashes or an index if given.
+ */
+static int json_path_query_run(const struct json_path *path,
+                               const char *json,
+                               const struct json_token *tokens,
+                               const uint32_t *hashes,
+                               const struct json_index *ix, uint32_t tok,
+                               json_path_callback cb, void *arg)
+{
+	struct json_path_query_arg q = { path,     json, tokens, hashes,
+		                         ix,       cb,   arg };
+
+	return json_path_match(&q, 0, tok);
+}
+
+int json_path_query(const struct json_path *path, const char *json,
+                    const struct json_token *tokens, uint32_t tok,
+                    json_path_callback cb, void *arg)
+{
+	return json_path_query_run(path, json, tokens, NULL, NULL, tok, cb,
+	                           arg);
+}
+
+int json_easy_path_query(struct json_easy *easy, const struct json_path *path,
+                         uint32_t tok, json_path_callback cb, void *arg)
+{
+	return json_path_query_run(path, easy->input, easy->tokens,
+	                           easy->hashes, easy->index, tok, cb, arg);
+}
+
+/**
+   @brief Buffer filled in by json_path_select().
+ */
+struct json_path_select_arg {
+	uint32_t *out;
+	uint32_t max, count;
+};
+
+static int json_path_select_cb(uint32_t tok, void *arg)
+{
+	struct json_path_select_arg *sel = arg;
+
+	if (sel->count < sel->max)
+		sel->out[sel->count] = tok;
+	sel->count++;
+	return 0;
+}
+
+int json_path_select(const struct json_path *path, const char *json,
+                     const struct json_token *tokens, uint32_t tok,
+                     uint32_t *out, uint32_t max, uint32_t *count)
+{
+	struct json_path_select_arg sel = { out, max, 0 };
+
+	json_path_query(path, json, tokens, tok, json_path_select_cb, &sel);
+	*count = sel.count;
+	return JSON_OK;
+}
+
+int json_easy_path_select(struct json_easy *easy, const struct json_path *path,
+                          uint32_t tok, uint32_t *out, uint32_t max,
+                          uint32_t *count)
+{
+	struct json_path_select_arg sel = { out, max, 0 };
+
+	json_easy_path_query(easy, path, tok, json_path_select_cb, &sel);
+	*count = sel.count;
+	return JSON_OK;
+}
@@ -0,0 +1,386 @@
+/***************************************************************************/ /**
+
+   @file         project.c
+
+   @author       Stephen Brennan
+
+   @brief        Parsing only the parts of a document that some paths select.
+
+   @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the
+ Revised BSD License.  See LICENSE.txt for details.
+
+   json_parse_projected_n() is given a list of compiled paths, and produces
+   tokens only for the values they select and the containers on the way to
+   them.  It walks the document one container at a time, keeping a list of the
+   paths which still match at each level.  A member which a path ends at is
+   tokenized in full by json_parse_value_depth(), and one which paths go on
+   through is walked into the same way.  Anything else is parsed with no token
+   buffer, which validates it exactly as json_parse() would without writing
+   anything, and then forgotten.
+
+   The result is a token array in the usual layout, so that it may be used with
+   every lookup function, and the paths evaluate to the same values as they
+   would against the whole document.  To keep array indices meaning the same
+   thing, an array keeps its elements up to the last one that holds something
+   selected, and the elements among those which don't are left as a single
+   token each: a scalar as usual, and a container with no members.  An object
+   just keeps the members which hold something selected.
+
+   A path which selects nothing still fails, but not necessarily with the same
+   error, because the value it failed on may be among those dropped.
+
+   A container is tokenized before it is known whether anything in it will be
+   selected, and is rolled back afterwards if nothing was.  Since tokens are
+   laid out in document order, that is only a matter of moving the token index
+   back.  When the token buffer is too small, the count of tokens needed is
+   still exact, as for json_parse().
+
+ *******************************************************************************/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_private.h"
+#include "nosj.h"
+
+/**
+   @brief Number of tokens json_easy_parse_projected() makes room for at first.
+ */
+#define JSON_PROJECT_MIN_TOKENS 256
+
+/**
+   @brief State of a projected parse.
+ */
+struct json_project_arg {
+	const char *text;
+	uint32_t len;
+	struct json_path *const *paths;
+	uint32_t npaths;
+	struct json_token *arr;
+	uint32_t *hashes;
+	struct json_int *ints;
+	uint32_t maxtoken;
+	/**
+	   @brief For each depth, the list of paths which match down to it
+	   (npaths entries per depth).
+	 */
+	uint32_t *active;
+};
+
+/**
+   @brief Return whether a step matches an object member with the given key,
+   or (if key is null) array element n.
+ */
+static bool json_project_match(const struct json_project_arg *a,
+                               const struct json_path_step *st,
+                               const struct json_token *key, uint32_t n)
+{
+	switch (st->kind) {
+	case JSON_PATH_KEY:
+		return key && key->length == st->keylen &&
+		       json_key_match(a->text, key, NULL, 0, st->key,
+		                      st->keylen, 0);
+	case JSON_PATH_INDEX:
+		return !key && n == st->index;
+	case JSON_PATH_SLICE:
+		return !key && st->index <= n && n < st->stop;
+	default:
+		return true;
+	}
+}
+
+/**
+   @brief Return the number of elements an array must keep for the steps at
+   depth of the active paths.
+ */
+static uint32_t json_project_limit(const struct json_project_arg *a,
+                                   const uint32_t *active, uint32_t nactive,
+                                   uint32_t depth)
+{
+	const struct json_path_step *st;
+	uint32_t limit = 0, n;
+
+	for (uint32_t i = 0; i < nactive; i++) {
+		st = &a->paths[active[i]]->steps[depth];
+		if (st->kind == JSON_PATH_INDEX)
+			n = st->index < UINT32_MAX ? st->index + 1 : UINT32_MAX;
+		else if (st->kind == JSON_PATH_SLICE)
+			n = st->stop;
+		else if (st->kind == JSON_PATH_ANY)
+			n = UINT32_MAX;
+		else
+			n = 0;
+		if (n > limit)
+			limit = n;
+	}
+	return limit;
+}
+
+/**
+   @brief Validate a value without keeping any of it, or (if stub) keeping
+   just its first token, with no members.
+ */
+static struct json_parser json_project_skip(const struct json_project_arg *a,
+                                            struct json_parser p,
+                                            uint32_t depth, bool stub)
+{
+	uint32_t tokenidx = p.tokenidx, start = p.textidx;
+	char c = json_peek(a->text, a->len, p.textidx);
+	bool object = c == '{';
+
+	if (stub && c != '{' && c != '[')
+		return json_parse_scalar(a->text, a->len, a->arr, a->ints,
+		                         a->maxtoken, p);
+	p = json_parse_value_depth(a->text, a->len, NULL, NULL, NULL, 0, p,
+	                           NOSJ_MAX_DEPTH - depth);
+	p.tokenidx = tokenidx;
+	if (stub && p.error == JSON_OK) {
+		json_settoken(a->arr,
+		              (struct json_token){
+		                      .type = object ? JSON_OBJECT : JSON_ARRAY,
+		                      .start = start,
+		              },
+		              p, a->maxtoken);
+		p.tokenidx++;
+	}
+	return p;
+}
+
+/**
+   @brief Parse a value at depth, which the active paths match so far.
+
+   The value is tokenized along with the members which hold something
+   selected.  The rest are validated and dropped, or left as single tokens if
+   an array needs them to keep its indices.
+   @param[out] found Whether anything was selected.
+ */
+static struct json_parser json_project_value(const struct json_project_arg *a,
+                                             struct json_parser p,
+                                             const uint32_t *active,
+                                             uint32_t nactive, uint32_t depth,
+                                             bool *found)
+{
+	const char *text = a->text;
+	uint32_t len = a->len, tokidx = p.tokenidx, limit = 0, n = 0;
+	uint32_t member, prev = 0, kept = 0, last = 0, lastend, nchild;
+	uint32_t *child = NULL;
+	const struct json_path *path;
+	struct json_token key = { 0 };
+	struct json_parser kp;
+	uint32_t hash = 0;
+	bool object, sel, keep;
+	char close, c = json_peek(text, len, p.textidx);
+
+	*found = false;
+	if (c != '{' && c != '[')
+		return json_parse_scalar(text, len, a->arr, a->ints,
+		                         a->maxtoken, p);
+	if (depth == NOSJ_MAX_DEPTH) {
+		p.error = JSONERR_TOO_DEEP;
+		return p;
+	}
+	object = c == '{';
+	close = object ? '}' : ']';
+	if (nactive)
+		child = a->active + (depth + 1) * a->npaths;
+	if (!object)
+		limit = json_project_limit(a, active, nactive, depth);
+	json_settoken(a->arr,
+	              (struct json_token){
+	                      .type = object ? JSON_OBJECT : JSON_ARRAY,
+	                      .start = p.textidx,
+	              },
+	              p, a->maxtoken);
+	p.textidx++;
+	p.tokenidx++;
+	lastend = p.tokenidx;
+
+	for (;; n++) {
+		p.textidx = json_skip_space(text, len, p.textidx);
+		c = json_peek(text, len, p.textidx);
+		if (c == close) {
+			break;
+		} else if (c == '\0') {
+			p.error = JSONERR_PREMATURE_EOF;
+			return p;
+		}
+		member = p.tokenidx;
+		if (object) {
+			kp = p;
+			kp.tokenidx = 0;
+			kp = json_parse_key(text, len, &key,
+			                    a->hashes ? &hash : NULL, 1, kp);
+			p.textidx = kp.textidx;
+			if ((p.error = kp.error) != JSON_OK)
+				return p;
+			p.textidx = json_skip_space(text, len, p.textidx);
+			if (json_peek(text, len, p.textidx) != ':') {
+				p.error = JSONERR_MISSING_COLON;
+				return p;
+			}
+			p.textidx = json_skip_space(text, len, p.textidx + 1);
+		}
+
+		sel = false;
+		nchild = 0;
+		for (uint32_t i = 0; i < nactive; i++) {
+			path = a->paths[active[i]];
+			if (!json_project_match(a, &path->steps[depth],
+			                        object ? &key : NULL, n))
+				continue;
+			if (path->nsteps == depth + 1)
+				sel = true;
+			else
+				child[nchild++] = active[i];
+		}
+
+		keep = false;
+		if (object && (sel || nchild)) {
+			json_settoken(a->arr, key, p, a->maxtoken);
+			if (a->hashes && p.tokenidx < a->maxtoken)
+				a->hashes[p.tokenidx] = hash;
+			p.tokenidx++;
+		}
+		if (sel) {
+			p = json_parse_value_depth(text, len, a->arr, a->hashes,
+			                           a->ints, a->maxtoken, p,
+			                           NOSJ_MAX_DEPTH - depth - 1);
+			keep = true;
+		} else if (nchild) {
+			p = json_project_value(a, p, child, nchild, depth + 1,
+			                       &keep);
+		} else {
+			p = json_project_skip(a, p, depth + 1, n < limit);
+		}
+		if (p.error != JSON_OK)
+			return p;
+
+		if (keep || (!object && n < limit)) {
+			if (prev)
+				json_setnext(a->arr, prev, member, a->maxtoken);
+			prev = member;
+		} else {
+			p.tokenidx = member;
+		}
+		if (keep) {
+			*found = true;
+			last = member;
+			lastend = p.tokenidx;
+			kept = object ? kept + 1 : n + 1;
+		}
+
+		p.textidx = json_skip_space(text, len, p.textidx);
+		c = json_peek(text, len, p.textidx);
+		if (c == ',') {
+			p.textidx++;
+		} else if (c != close) {
+			p.error = JSONERR_MISSING_COMMA;
+			return p;
+		} else {
+			break;
+		}
+	}
+
+	if (!object) {
+		// Drop the elements after the last one with something selected.
+		p.tokenidx = lastend;
+		if (last)
+			json_setnext(a->arr, last, 0, a->maxtoken);
+	}
+	json_setlength(a->arr, tokidx, kept, a->maxtoken);
+	p.textidx++;
+	return p;
+}
+
+/**
+   @brief Implementation of json_parse_projected_n(), filling in key hashes and
+   integer values too if there are buffers for them.
+ */
+static struct json_parser json_project(const char *text, uint32_t len,
+                                       struct json_path *const *paths,
+                                       uint32_t npaths, struct json_token *arr,
+                                       uint32_t *hashes, struct json_int *ints,
+                                       uint32_t maxtoken)
+{
+	struct json_project_arg a = {
+		.text = text,
+		.len = len,
+		.paths = paths,
+		.npaths = npaths,
+		.arr = arr,
+		.hashes = hashes,
+		.ints = ints,
+		.maxtoken = maxtoken,
+	};
+	struct json_parser p = { 0 };
+	uint32_t maxsteps = 0;
+	bool found;
+
+	if (json_too_long(len)) {
+		p.error = JSONERR_NOMEM;
+		return p;
+	}
+	for (uint32_t i = 0; i < npaths; i++) {
+		for (uint32_t j = 0; j < paths[i]->nsteps; j++) {
+			if (paths[i]->steps[j].descend) {
+				p.error = JSONERR_BAD_EXPR;
+				return p;
+			}
+		}
+		if (paths[i]->nsteps > maxsteps)
+			maxsteps = paths[i]->nsteps;
+	}
+
+	if (npaths) {
+		a.active = malloc((size_t)npaths * maxsteps *
+		                  sizeof(*a.active));
+		if (!a.active) {
+			p.error = JSONERR_NOMEM;
+			return p;
+		}
+		for (uint32_t i = 0; i < npaths; i++)
+			a.active[i] = i;
+	}
+	p.textidx = json_skip_space(text, len, 0);
+	p = json_project_value(&a, p, a.active, npaths, 0, &found);
+	free(a.active);
+	return p;
+}
+
+struct json_parser json_parse_projected_n(const char *json, uint32_t len,
+                                          struct json_path *const *paths,
+                                          uint32_t npaths,
+                                          struct json_token *arr, uint32_t n)
+{
+	return json_project(json, len, paths, npaths, arr, NULL, NULL, n);
+}
+
+int json_easy_parse_projected(struct json_easy *easy,
+                              struct json_path *const *paths, uint32_t npaths)
+{
+	struct json_parser p;
+
+	// The index, if any, is of the tokens about to be replaced.
+	json_index_free(easy->index);
+	easy->index = NULL;
+	easy->tokens_len = 0;
+	if (json_easy_reserve(easy, JSON_PROJECT_MIN_TOKENS))
+		return JSONERR_NOMEM;
+	p = json_project(easy->input, easy->input_len, paths, npaths,
+	                 easy->tokens, easy->hashes, easy->ints,
+	                 easy->tokens_cap);
+	if (p.error == JSON_OK && p.tokenidx > easy->tokens_cap) {
+		if (json_easy_reserve(easy, p.tokenidx))
+			return JSONERR_NOMEM;
+		p = json_project(easy->input, easy->input_len, paths, npaths,
+		                 easy->tokens, easy->hashes, easy->ints,
+		                 easy->tokens_cap);
+	}
+	if (p.error == JSON_OK) {
+		easy->tokens_len = p.tokenidx;
+		easy->projected = true;
+	}
+	return p.error;
+}
@@ -0,0 +1,374 @@
+/***************************************************************************/ /**
+
+   @file         sidecar.c
+
+   @author       Stephen Brennan
+
+   @brief        Saving parsed tokens to a file, and mapping them back in.
+
+   @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the
+ Revised BSD License.  See LICENSE.txt for details.
+
+   A sidecar file holds the buffers of a json_easy in their in-memory layout:
+   a header, then the tokens, and the key hashes, integer values and saved
+   index (see json_index_save()) if there are any, each starting on an 8 byte
+   boundary.  Loading it is then a matter of mapping the file and pointing the
+   json_easy into the mapping.  Nothing is copied or converted, so a file is
+   only good for a build of nosj with the same token layout and byte order,
+   which the header records along with a format version.
+
+   The header also records the length of the input and a hash of its
+   contents, which must match for the file to be used.  The hash reads the
+   input 8 bytes at a time, so checking it costs far less than parsing.
+
+   The buffers of a loaded json_easy are read only.  Anything which would
+   change them, such as parsing again, first copies them out of the mapping
+   (json_easy_detach()).
+
+ *******************************************************************************/
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "json_private.h"
+#include "nosj.h"
+
+/**
+   @brief Version of the file format, changed whenever it changes.
+ */
+#define JSON_SIDECAR_VERSION 1
+
+/**
+   @brief Written in the header as a 32-bit value, to detect the byte order.
+ */
+#define JSON_SIDECAR_ORDER 0x01020304u
+
+/**
+   @brief Flags for the optional sections of the file.
+ */
+#define JSON_SIDECAR_HASHES 1u
+#define JSON_SIDECAR_INTS   2u
+#define JSON_SIDECAR_INDEX  4u
+
+static const char json_sidecar_magic[8] = "nosjtok";
+
+struct json_sidecar_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t order;
+	/** @brief sizeof(struct json_token), smaller with compact tokens */
+	uint32_t token_size;
+	/** @brief Which optional sections follow (JSON_SIDECAR_*) */
+	uint32_t flags;
+	uint32_t input_len;
+	uint32_t ntokens;
+	uint64_t input_hash;
+	/** @brief Length of the saved index, if there is one */
+	uint64_t index_len;
+};
+
+/**
+   @brief The sections of the file, in order.
+ */
+enum json_sidecar_section {
+	JSON_SIDECAR_TOKENS_AT,
+	JSON_SIDECAR_HASHES_AT,
+	JSON_SIDECAR_INTS_AT,
+	JSON_SIDECAR_INDEX_AT,
+	JSON_SIDECAR_END,
+};
+
+/**
+   @brief Return the hash of an input recorded in the header.
+
+   Each 8 bytes are mixed in with a multiply and a shift.  This is meant only
+   to notice that the input has changed, not to resist attacks.
+ */
+static uint64_t json_sidecar_hash(const char *text, uint32_t len)
+{
+	uint64_t h = len, w;
+	uint32_t i;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		memcpy(&w, text + i, 8);
+		h = (h ^ w) * 0x9e3779b97f4a7c15ull;
+		h ^= h >> 29;
+	}
+	w = 0;
+	memcpy(&w, text + i, len - i);
+	h = (h ^ w) * 0x9e3779b97f4a7c15ull;
+	return h ^ (h >> 29);
+}
+
+/**
+   @brief Round a file offset up to the next multiple of 8.
+ */
+static size_t json_sidecar_align(size_t off)
+{
+	return (off + 7) & ~(size_t)7;
+}
+
+/**
+   @brief Compute where each section starts, and where the file ends.
+ */
+static void json_sidecar_layout(const struct json_sidecar_header *h,
+                                size_t *at)
+{
+	size_t n = h->ntokens;
+
+	at[JSON_SIDECAR_TOKENS_AT] = json_sidecar_align(sizeof(*h));
+	at[JSON_SIDECAR_HASHES_AT] = json_sidecar_align(
+	        at[JSON_SIDECAR_TOKENS_AT] + n * sizeof(struct json_token));
+	at[JSON_SIDECAR_INTS_AT] = json_sidecar_align(
+	        at[JSON_SIDECAR_HASHES_AT] +
+	        ((h->flags & JSON_SIDECAR_HASHES) ? n * sizeof(uint32_t) : 0));
+	at[JSON_SIDECAR_INDEX_AT] = json_sidecar_align(
+	        at[JSON_SIDECAR_INTS_AT] +
+	        ((h->flags & JSON_SIDECAR_INTS) ? n * sizeof(struct json_int)
+	                                        : 0));
+	at[JSON_SIDECAR_END] = at[JSON_SIDECAR_INDEX_AT] +
+	                       ((h->flags & JSON_SIDECAR_INDEX) ? h->index_len
+	                                                        : 0);
+}
+
+/**
+   @brief Fill in the sections of a file image, which starts out zeroed.
+
+   Only the fields of each entry are copied, so that neither padding nor the
+   hashes and integer values of tokens which have none (left as they were in
+   the buffers) reach the file, and the same input always saves the same.
+ */
+static void json_sidecar_fill(const struct json_easy *easy, char *image,
+                              const size_t *at)
+{
+	struct json_token *tokens =
+	        (struct json_token *)(image + at[JSON_SIDECAR_TOKENS_AT]);
+	uint32_t *hashes = (uint32_t *)(image + at[JSON_SIDECAR_HASHES_AT]);
+	struct json_int *ints =
+	        (struct json_int *)(image + at[JSON_SIDECAR_INTS_AT]);
+	const struct json_token *t;
+
+	for (uint32_t i = 0; i < easy->tokens_len; i++) {
+		t = &easy->tokens[i];
+		tokens[i].type = t->type;
+		tokens[i].plain = t->plain;
+		tokens[i].start = t->start;
+		tokens[i].length = t->length;
+		tokens[i].next = t->next;
+		if (easy->hashes && t->type == JSON_STRING)
+			hashes[i] = easy->hashes[i];
+		if (easy->ints && t->type == JSON_NUMBER) {
+			ints[i].mag = easy->ints[i].mag;
+			ints[i].integer = easy->ints[i].integer;
+			ints[i].neg = easy->ints[i].neg;
+		}
+	}
+	if (easy->index)
+		json_index_save(easy->index, image + at[JSON_SIDECAR_INDEX_AT]);
+}
+
+int json_easy_save(struct json_easy *easy, const char *path)
+{
+	struct json_sidecar_header h = { 0 };
+	size_t at[JSON_SIDECAR_END + 1];
+	char *image;
+	bool ok;
+	FILE *f;
+	int rv;
+
+	if ((rv = json_easy_parse(easy)))
+		return rv;
+	// A projection would pass for the whole document when loaded.
+	if (easy->projected)
+		return JSONERR_STALE;
+	memcpy(h.magic, json_sidecar_magic, sizeof(h.magic));
+	h.version = JSON_SIDECAR_VERSION;
+	h.order = JSON_SIDECAR_ORDER;
+	h.token_size = sizeof(struct json_token);
+	h.flags = (easy->hashes ? JSON_SIDECAR_HASHES : 0) |
+	          (easy->ints ? JSON_SIDECAR_INTS : 0) |
+	          (easy->index ? JSON_SIDECAR_INDEX : 0);
+	h.input_len = easy->input_len;
+	h.ntokens = easy->tokens_len;
+	h.input_hash = json_sidecar_hash(easy->input, easy->input_len);
+	if (easy->index)
+		h.index_len = json_index_save(easy->index, NULL);
+	json_sidecar_layout(&h, at);
+
+	// Build the whole file in memory, and write it at once.
+	if (!(image = calloc(1, at[JSON_SIDECAR_END])))
+		return JSONERR_NOMEM;
+	memcpy(image, &h, sizeof(h));
+	json_sidecar_fill(easy, image, at);
+	if (!(f = fopen(path, "wb"))) {
+		free(image);
+		return JSONERR_IO;
+	}
+	ok = fwrite(image, 1, at[JSON_SIDECAR_END], f) == at[JSON_SIDECAR_END];
+	free(image);
+	if (fclose(f) != 0 || !ok) {
+		remove(path);
+		return JSONERR_IO;
+	}
+	return JSON_OK;
+}
+
+/**
+   @brief Return whether a header is for this build of nosj, and this input.
+ */
+static bool json_sidecar_matches(const struct json_sidecar_header *h,
+                                 const struct json_easy *easy)
+{
+	return memcmp(h->magic, json_sidecar_magic, sizeof(h->magic)) == 0 &&
+	       h->version == JSON_SIDECAR_VERSION &&
+	       h->order == JSON_SIDECAR_ORDER &&
+	       h->token_size == sizeof(struct json_token) &&
+	       h->ntokens != 0 && h->input_len == easy->input_len &&
+	       h->input_hash ==
+	               json_sidecar_hash(easy->input, easy->input_len);
+}
+
+int json_easy_load(struct json_easy *easy, const char *path)
+{
+	struct json_sidecar_header h;
+	size_t at[JSON_SIDECAR_END + 1];
+	struct json_index *index = NULL;
+	struct json_token *tokens;
+	const char *input;
+	struct stat st;
+	char *map;
+	uint32_t len;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return JSONERR_IO;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return JSONERR_IO;
+	}
+	if ((size_t)st.st_size < sizeof(h)) {
+		close(fd);
+		return JSONERR_STALE;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return JSONERR_IO;
+
+	memcpy(&h, map, sizeof(h));
+	if (!json_sidecar_matches(&h, easy))
+		goto stale;
+	json_sidecar_layout(&h, at);
+	if (at[JSON_SIDECAR_END] > (size_t)st.st_size)
+		goto stale;
+	tokens = (struct json_token *)(map + at[JSON_SIDECAR_TOKENS_AT]);
+	if (h.flags & JSON_SIDECAR_INDEX) {
+		index = json_index_map(easy->input, tokens, h.ntokens,
+		                       map + at[JSON_SIDECAR_INDEX_AT],
+		                       h.index_len);
+		if (!index) {
+			munmap(map, st.st_size);
+			return JSONERR_NOMEM;
+		}
+	}
+
+	// Replace whatever the json_easy had with the buffers in the file.
+	input = easy->input;
+	len = easy->input_len;
+	json_easy_destroy(easy);
+	json_easy_init_n(easy, input, len);
+	easy->tokens = tokens;
+	easy->tokens_len = easy->tokens_cap = h.ntokens;
+	if (h.flags & JSON_SIDECAR_HASHES)
+		easy->hashes = (uint32_t *)(map + at[JSON_SIDECAR_HASHES_AT]);
+	if (h.flags & JSON_SIDECAR_INTS)
+		easy->ints =
+		        (struct json_int *)(map + at[JSON_SIDECAR_INTS_AT]);
+	easy->index = index;
+	easy->map = map;
+	easy->map_len = st.st_size;
+	return JSON_OK;
+stale:
+	munmap(map, st.st_size);
+	return JSONERR_STALE;
+}
+
+void json_easy_unmap(struct json_easy *easy)
+{
+	if (!easy->map)
+		return;
+	munmap(easy->map, easy->map_len);
+	easy->map = NULL;
+	easy->map_len = 0;
+	easy->tokens = NULL;
+	easy->hashes = NULL;
+	easy->ints = NULL;
+}
+
+/**
+   @brief Copy a buffer out of the mapping into one of its own, or free the
+   copies made so far if that fails.
+ */
+static void *json_sidecar_copy(const void *buf, size_t len, void **copies,
+                               int *ncopies)
+{
+	void *copy;
+
+	if (!buf)
+		return NULL;
+	if (!(copy = malloc(len))) {
+		while (*ncopies)
+			free(copies[--*ncopies]);
+		return NULL;
+	}
+	memcpy(copy, buf, len);
+	copies[(*ncopies)++] = copy;
+	return copy;
+}
+
+/**
+   @brief Copy the buffers of a json_easy loaded from a file out of the
+   mapping, and unmap it, so that they may change.  The index, whose tables
+   lie in the mapping too, is dropped.
+   @returns 0 on success, or -1 if allocation fails (leaving things as they
+   were)
+ */
+int json_easy_detach(struct json_easy *easy)
+{
+	size_t n = easy->tokens_cap;
+	void *copies[3];
+	int ncopies = 0;
+	struct json_token *tokens;
+	uint32_t *hashes;
+	struct json_int *ints;
+
+	if (!easy->map)
+		return 0;
+	tokens = json_sidecar_copy(easy->tokens, n * sizeof(*tokens), copies,
+	                           &ncopies);
+	if (!tokens)
+		return -1;
+	hashes = json_sidecar_copy(easy->hashes, n * sizeof(*hashes), copies,
+	                           &ncopies);
+	if (easy->hashes && !hashes)
+		return -1;
+	ints = json_sidecar_copy(easy->ints, n * sizeof(*ints), copies,
+	                         &ncopies);
+	if (easy->ints && !ints)
+		return -1;
+
+	json_index_free(easy->index);
+	easy->index = NULL;
+	json_easy_unmap(easy);
+	easy->tokens = tokens;
+	easy->hashes = hashes;
+	easy->ints = ints;
+	return 0;
+}
@@ -0,0 +1,402 @@
+/***************************************************************************/ /**
+
+   @file         stream.c
+
+   @author       Stephen Brennan
+
+   @brief        Resumable parser for input which arrives in pieces.
+
+   @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the
+ Revised BSD License.  See LICENSE.txt for details.
+
+   This is json_parse_value() turned inside out.  Rather than pulling
+   characters from a complete buffer, the parser is pushed chunks of input,
+   and everything it needs to pick up where it left off lives in struct
+   json_stream_state: the stack of open containers, what comes next in the
+   innermost one, and the state of any string, number or literal which was
+   cut off at the end of a chunk.  String and number parsing use the same
+   state machines as json_parse(), and the end of input is handled by running
+   them over a NUL character just as json_parse() would, so that results
+   (including errors and where they are reported) are identical to parsing the
+   concatenated input with json_parse_n().
+
+ *******************************************************************************/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_private.h"
+#include "nosj.h"
+
+/**
+   @brief Initial number of tokens to allocate room for.
+ */
+#define JSON_STREAM_MIN_TOKENS 64
+
+/**
+   @brief Initial number of container frames to allocate room for.
+ */
+#define JSON_STREAM_MIN_DEPTH 16
+
+/**
+   @brief What the parser expects to see next.
+ */
+enum json_stream_mode {
+	/** @brief The start of a value (after optional whitespace). */
+	JSON_STREAM_VALUE,
+	/** @brief A member, or the end of the container on top of the stack. */
+	JSON_STREAM_MEMBER,
+	/** @brief The colon following an object key. */
+	JSON_STREAM_COLON,
+	/** @brief A comma, or the end of the container on top of the stack. */
+	JSON_STREAM_AFTER,
+	/** @brief The rest of a string. */
+	JSON_STREAM_STRING,
+	/** @brief The rest of a number. */
+	JSON_STREAM_NUMBER,
+	/** @brief The rest of true, false or null. */
+	JSON_STREAM_LITERAL,
+	/** @brief Nothing: the value is complete. */
+	JSON_STREAM_DONE,
+};
+
+/**
+   @brief Everything the parser must remember between chunks.
+ */
+struct json_stream_state {
+	/**
+	   @brief What the parser expects to see next.
+	 */
+	enum json_stream_mode mode;
+	/**
+	   @brief Number of bytes of input received so far.
+	 */
+	uint32_t fed;
+	/**
+	   @brief Token for the scalar being parsed (its type and start).
+	 */
+	struct json_token tok;
+	/**
+	   @brief Whether the string being parsed is an object key.
+	 */
+	bool key;
+	/**
+	   @brief State of the string being parsed.
+	 */
+	struct json_string_state string;
+	/**
+	   @brief State of the number being parsed.
+	 */
+	enum json_number_state number;
+	/**
+	   @brief The literal being parsed, and how much of it was matched.
+	 */
+	const char *literal;
+	uint32_t litlen, litmatched;
+	/**
+	   @brief Stack of open containers, and its size and capacity.
+	 */
+	struct json_frame *stack;
+	uint32_t depth, stack_cap;
+};
+
+/**
+   @brief Append a token to the stream's token buffer, growing it as needed.
+   @returns 0 on success, or -1 if memory allocation failed.
+ */
+static int json_stream_emit(struct json_stream *s, struct json_token tok)
+{
+	struct json_token *tokens;
+	uint32_t cap = s->tokens_cap;
+
+	if (s->p.tokenidx == cap) {
+		if (cap == UINT32_MAX)
+			return -1;
+		cap = cap < JSON_STREAM_MIN_TOKENS ? JSON_STREAM_MIN_TOKENS
+		    : cap > UINT32_MAX / 2 ? UINT32_MAX
+		                           : cap * 2;
+		tokens = realloc(s->tokens, (size_t)cap * sizeof(*tokens));
+		if (!tokens)
+			return -1;
+		s->tokens = tokens;
+		s->tokens_cap = cap;
+	}
+	s->tokens[s->p.tokenidx++] = tok;
+	return 0;
+}
+
+/**
+   @brief Push a new container on the stack, growing it as needed.
+   @returns The new frame, or NULL if memory allocation failed.
+ */
+static struct json_frame *json_stream_push(struct json_stream_state *st)
+{
+	struct json_frame *stack;
+	uint32_t cap = st->stack_cap;
+
+	if (st->depth == cap) {
+		cap = cap ? cap * 2 : JSON_STREAM_MIN_DEPTH;
+		if (cap > NOSJ_MAX_DEPTH)
+			cap = NOSJ_MAX_DEPTH;
+		stack = realloc(st->stack, (size_t)cap * sizeof(*stack));
+		if (!stack)
+			return NULL;
+		st->stack = stack;
+		st->stack_cap = cap;
+	}
+	return &st->stack[st->depth++];
+}
+
+/**
+   @brief Parse the given input, continuing where the last call stopped.
+
+   This is json_parse_value(), except that where it would read past the end of
+   the text, it returns instead.  When eof is set, the end of the text is the
+   end of the input, and json_peek() supplies the NUL character from there.
+   @param s The stream.
+   @param text Next piece of input.
+   @param len Length of the text.
+   @param eof Whether this is the end of the input.
+ */
+static void json_stream_run(struct json_stream *s, const char *text,
+                            uint32_t len, bool eof)
+{
+	struct json_stream_state *st = s->state;
+	struct json_frame *top;
+	struct json_token tok;
+	enum json_error err;
+	uint32_t i = 0;
+	char c;
+
+#define FAIL(e, idx)                                                           \
+	do {                                                                   \
+		s->p.error = (e);                                              \
+		s->p.textidx = st->fed + (idx);                                \
+		return;                                                        \
+	} while (0)
+
+	while (i < len || eof) {
+		c = json_peek(text, len, i);
+		switch (st->mode) {
+		case JSON_STREAM_VALUE:
+			if (json_isspace(c)) {
+				i++;
+				continue;
+			}
+			st->tok.start = st->fed + i;
+			st->tok.length = 0;
+			st->tok.next = 0;
+			if (c == '{' || c == '[') {
+				if (st->depth == NOSJ_MAX_DEPTH)
+					FAIL(JSONERR_TOO_DEEP, i);
+				if (!(top = json_stream_push(st)))
+					FAIL(JSONERR_NOMEM, i);
+				top->tokenidx = s->p.tokenidx;
+				top->previdx = 0;
+				top->length = 0;
+				top->object = (c == '{');
+				st->tok.type = top->object ? JSON_OBJECT
+				                           : JSON_ARRAY;
+				if (json_stream_emit(s, st->tok))
+					FAIL(JSONERR_NOMEM, i);
+				i++;
+				st->mode = JSON_STREAM_MEMBER;
+			} else if (c == '"') {
+				memset(&st->string, 0, sizeof(st->string));
+				st->key = false;
+				st->mode = JSON_STREAM_STRING;
+			} else if (c == 't' || c == 'f' || c == 'n') {
+				st->tok.type = c == 't'   ? JSON_TRUE
+				             : c == 'f' ? JSON_FALSE
+				                        : JSON_NULL;
+				st->literal = c == 't'   ? "true"
+				            : c == 'f' ? "false"
+				                       : "null";
+				st->litlen = strlen(st->literal);
+				st->litmatched = 0;
+				st->mode = JSON_STREAM_LITERAL;
+			} else if (c == '-' || ('0' <= c && c <= '9')) {
+				st->tok.type = JSON_NUMBER;
+				st->number = JSON_NUM_START;
+				st->mode = JSON_STREAM_NUMBER;
+			} else if (c == '\0') {
+				FAIL(JSONERR_PREMATURE_EOF, i);
+			} else {
+				FAIL(JSONERR_UNEXPECTED_TOKEN, i);
+			}
+			continue;
+
+		case JSON_STREAM_MEMBER:
+			if (json_isspace(c)) {
+				i++;
+				continue;
+			}
+			top = &st->stack[st->depth - 1];
+			if (c == (top->object ? '}' : ']'))
+				goto end_container;
+			if (c == '\0')
+				FAIL(JSONERR_PREMATURE_EOF, i);
+			if (top->previdx != 0)
+				s->tokens[top->previdx].next = s->p.tokenidx;
+			top->previdx = s->p.tokenidx;
+			if (top->object) {
+				st->tok.start = st->fed + i;
+				memset(&st->string, 0, sizeof(st->string));
+				st->key = true;
+				st->mode = JSON_STREAM_STRING;
+			} else {
+				st->mode = JSON_STREAM_VALUE;
+			}
+			continue;
+
+		case JSON_STREAM_COLON:
+			if (json_isspace(c)) {
+				i++;
+				continue;
+			}
+			if (c != ':')
+				FAIL(JSONERR_MISSING_COLON, i);
+			i++;
+			st->mode = JSON_STREAM_VALUE;
+			continue;
+
+		case JSON_STREAM_AFTER:
+			if (json_isspace(c)) {
+				i++;
+				continue;
+			}
+			top = &st->stack[st->depth - 1];
+			if (c == ',') {
+				i++;
+				st->mode = JSON_STREAM_MEMBER;
+				continue;
+			} else if (c != (top->object ? '}' : ']')) {
+				FAIL(JSONERR_MISSING_COMMA, i);
+			}
+			goto end_container;
+
+		case JSON_STREAM_STRING:
+			err = json_string_resume(&st->string, text, &i, len, eof);
+			if (!st->string.done)
+				continue;
+			tok = st->tok;
+			tok.type = JSON_STRING;
+			tok.length = st->string.outidx;
+			// Escapes decode to fewer bytes than they take up.
+			tok.plain = (err == JSON_OK &&
+			             st->fed + i - tok.start - 2 == tok.length);
+			if (json_stream_emit(s, tok))
+				FAIL(JSONERR_NOMEM, i);
+			if (err != JSON_OK)
+				FAIL(err, i);
+			if (st->key) {
+				st->mode = JSON_STREAM_COLON;
+				continue;
+			}
+			goto end_value;
+
+		case JSON_STREAM_NUMBER:
+			for (;;) {
+				st->number = json_number_step(
+				        st->number, json_peek(text, len, i));
+				if (st->number == JSON_NUM_END ||
+				    st->number == JSON_NUM_INVALID)
+					break;
+				if (++i == len && !eof)
+					break;
+			}
+			if (i == len && !eof)
+				continue;
+			tok = st->tok;
+			tok.length = st->fed + i - tok.start;
+			if (json_stream_emit(s, tok))
+				FAIL(JSONERR_NOMEM, i);
+			if (st->number == JSON_NUM_INVALID)
+				FAIL(JSONERR_INVALID_NUMBER, i);
+			goto end_value;
+
+		case JSON_STREAM_LITERAL:
+			if (c != st->literal[st->litmatched]) {
+				s->p.error = JSONERR_UNEXPECTED_TOKEN;
+				s->p.textidx = st->tok.start;
+				return;
+			}
+			i++;
+			if (++st->litmatched < st->litlen)
+				continue;
+			if (json_stream_emit(s, st->tok))
+				FAIL(JSONERR_NOMEM, i);
+			goto end_value;
+
+		case JSON_STREAM_DONE:
+			return;
+		}
+
+	end_container:
+		top = &st->stack[st->depth - 1];
+		s->tokens[top->tokenidx].length = top->length;
+		i++;
+		st->depth--;
+
+	end_value:
+		// A value just ended.  If it is in a container, find out what's
+		// next.  Otherwise, we're done.
+		if (st->depth == 0) {
+			st->mode = JSON_STREAM_DONE;
+			s->p.textidx = st->fed + i;
+			return;
+		}
+		st->stack[st->depth - 1].length++;
+		st->mode = JSON_STREAM_AFTER;
+	}
+	s->p.textidx = st->fed + i;
+#undef FAIL
+}
+
+int json_stream_init(struct json_stream *s)
+{
+	memset(s, 0, sizeof(*s));
+	s->state = calloc(1, sizeof(*s->state));
+	if (!s->state)
+		return JSONERR_NOMEM;
+	s->state->mode = JSON_STREAM_VALUE;
+	return 0;
+}
+
+int json_stream_feed(struct json_stream *s, const char *chunk, uint32_t len)
+{
+	struct json_stream_state *st = s->state;
+
+	if (s->p.error == JSON_OK && st->mode != JSON_STREAM_DONE) {
+		if (json_too_long((uint64_t)st->fed + len))
+			s->p.error = JSONERR_NOMEM;
+		else
+			json_stream_run(s, chunk, len, false);
+	}
+	st->fed += len;
+	return s->p.error;
+}
+
+bool json_stream_done(const struct json_stream *s)
+{
+	return s->p.error == JSON_OK && s->state->mode == JSON_STREAM_DONE;
+}
+
+struct json_parser json_stream_finish(struct json_stream *s)
+{
+	if (s->p.error == JSON_OK && s->state->mode != JSON_STREAM_DONE)
+		json_stream_run(s, NULL, 0, true);
+	return s->p;
+}
+
+void json_stream_destroy(struct json_stream *s)
+{
+	if (s->state)
+		free(s->state->stack);
+	free(s->state);
+	free(s->tokens);
+	s->state = NULL;
+	s->tokens = NULL;
+}
@@ -23,6 +23,13 @@
 
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if !defined(NOSJ_NO_SIMD) && defined(__SSE2__)
+#include <immintrin.h>
+#define NOSJ_HAVE_SSE2 1
+#endif
 
 #include "json_private.h"
 #include "nosj.h"
@@ -65,6 +72,19 @@ struct parser_arg {
 	   @brief Current index of the text we're parsing.
 	 */
 	uint32_t textidx;
+	/**
+	   @brief Length of the text.  Nothing at or beyond this is read.
+	 */
+	uint32_t len;
+	/**
+	   @brief Upper bound on the output length, if known (else UINT32_MAX).
+
+	   Each output character takes at least one input character, so when
+	   the output length is known from a token, the rest of the string is at
+	   least this long, and plain runs can be scanned without knowing the
+	   length of the text.
+	 */
+	uint32_t maxout;
 	/**
 	   @brief Function to call for every character we parse.
 	 */
@@ -94,6 +114,14 @@ struct parser_arg {
 	   @brief Any error we want to report.
 	 */
 	enum json_error error;
+	/**
+	   @brief Whether to hash the output as it is produced.
+	 */
+	bool hashing;
+	/**
+	   @brief Hash of the output so far (see json_hash_step()).
+	 */
+	uint32_t hash;
 };
 
 /*******************************************************************************
@@ -196,10 +224,112 @@ static void set_output(struct parser_arg *a, wchar_t out, bool from_uesc)
 	for (i = 0; i < nbytes; i++) {
 		if (a->setter)
 			a->setter(a, bytes[i], a->setter_arg);
+		if (a->hashing)
+			a->hash = json_hash_step(a->hash, bytes[i]);
 		a->outidx++;
 	}
 }
 
+/**
+   @brief Return true if c needs the state machine when found in a string.
+
+   That is a quote, a backslash, or a control character (in particular, the
+   NUL terminator).  Everything else is simply copied to the output.
+ */
+static bool json_string_special(char c)
+{
+	return c == '"' || c == '\\' || (unsigned char)c < 0x20;
+}
+
+/**
+   @brief Return the number of bytes at text before the next special character.
+
+   This is how the parser skips over the plain parts of a string, 16 or 32
+   bytes at a time where SIMD is available.  No more than limit bytes are
+   examined; if none of them is special, limit is returned.
+ */
+static uint32_t json_string_run(const char *text, uint32_t limit)
+{
+	uint32_t i = 0;
+#ifdef NOSJ_HAVE_SSE2
+#ifdef __AVX2__
+	typedef __m256i vec;
+#define VEC_LOAD(p)       _mm256_loadu_si256((const vec *)(p))
+#define VEC_SET1(c)       _mm256_set1_epi8(c)
+#define VEC_EQ(a, b)      _mm256_cmpeq_epi8(a, b)
+#define VEC_OR(a, b)      _mm256_or_si256(a, b)
+#define VEC_MAX(a, b)     _mm256_max_epu8(a, b)
+#define VEC_MOVEMASK(v)   (uint32_t) _mm256_movemask_epi8(v)
+#else
+	typedef __m128i vec;
+#define VEC_LOAD(p)       _mm_loadu_si128((const vec *)(p))
+#define VEC_SET1(c)       _mm_set1_epi8(c)
+#define VEC_EQ(a, b)      _mm_cmpeq_epi8(a, b)
+#define VEC_OR(a, b)      _mm_or_si128(a, b)
+#define VEC_MAX(a, b)     _mm_max_epu8(a, b)
+#define VEC_MOVEMASK(v)   (uint32_t) _mm_movemask_epi8(v)
+#endif
+	const vec quote = VEC_SET1('"');
+	const vec backslash = VEC_SET1('\\');
+	const vec ctrl = VEC_SET1(0x1F);
+
+	for (; limit - i >= sizeof(vec); i += sizeof(vec)) {
+		vec v = VEC_LOAD(text + i);
+		// max(v, 0x1F) == 0x1F exactly when v <= 0x1F (unsigned)
+		uint32_t mask = VEC_MOVEMASK(
+		        VEC_OR(VEC_OR(VEC_EQ(v, quote), VEC_EQ(v, backslash)),
+		               VEC_EQ(VEC_MAX(v, ctrl), ctrl)));
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+#undef VEC_LOAD
+#undef VEC_SET1
+#undef VEC_EQ
+#undef VEC_OR
+#undef VEC_MAX
+#undef VEC_MOVEMASK
+#endif
+	while (i < limit && !json_string_special(text[i]))
+		i++;
+	return i;
+}
+
+/**
+   @brief Output a run of plain characters (see json_string_run()).
+   @param a Parser data.
+   @param run Number of characters, starting at the current index.
+ */
+static void set_output_run(struct parser_arg *a, uint32_t run)
+{
+	if (a->setter) {
+		for (uint32_t i = 0; i < run; i++) {
+			a->setter(a, a->text[a->textidx + i], a->setter_arg);
+			a->outidx++;
+		}
+	} else {
+		a->outidx += run;
+	}
+	if (a->hashing) {
+		for (uint32_t i = 0; i < run; i++)
+			a->hash = json_hash_step(a->hash, a->text[a->textidx + i]);
+	}
+	a->textidx += run;
+}
+
+/**
+   @brief Return how many bytes json_string_run() may examine.
+
+   That is up to the end of the text, or past the longest run of plain
+   characters which could still fit in the output (plus one, which lands at
+   the closing quote at the latest).
+ */
+static uint32_t json_string_limit(struct parser_arg *a)
+{
+	uint32_t limit = a->len - a->textidx;
+	uint32_t room = a->maxout - a->outidx;
+	return room < limit ? room + 1 : limit;
+}
+
 static void set_state(struct parser_arg *a, enum parser_st state)
 {
 	if (a->state != END) {
@@ -333,57 +463,121 @@ static void json_string_uesc(struct parser_arg *a, char wc)
 }
 
 /**
-   @brief Parses JSON strings, in a very generic manner.
-   @param text Input text.
-   @param idx Starting index of the string.
-   @param setter Function to call with each character.
-   @param setarg Argument to give to the setter function.
+   @brief Run the parser until the end of the string.
+   @param a Parser data.
+   @param partial If true, also stop at the end of the text (rather than
+   treating it as the end of the input), so that more text may be given later.
  */
-static struct parser_arg json_string(const char *text, uint32_t idx,
-                                     output_setter setter, void *setarg)
+static inline void json_string_loop(struct parser_arg *a, bool partial)
 {
 	char wc;
-	struct parser_arg a = { .state = START,
-		                .text = text,
-		                .textidx = idx,
-		                .outidx = 0,
-		                .setter = setter,
-		                .setter_arg = setarg,
-		                .prev = 0,
-		                .curr = 0,
-		                .error = JSON_OK };
 
-	while (a.state != END) {
-		wc = a.text[a.textidx];
-		switch (a.state) {
+	while (a->state != END && !(partial && a->textidx >= a->len)) {
+		wc = json_peek(a->text, a->len, a->textidx);
+		switch (a->state) {
 		case START:
-			json_string_start(&a, wc);
+			json_string_start(a, wc);
 			break;
 		case INSTRING:
-			json_string_instring(&a, wc);
+			// Skip through plain characters in bulk.  After a
+			// leading surrogate, only an escape may follow, so leave
+			// that to the state machine.
+			if (a->prev == 0 && !json_string_special(wc)) {
+				set_output_run(a, json_string_run(
+				                          a->text + a->textidx,
+				                          json_string_limit(a)));
+				continue;
+			}
+			json_string_instring(a, wc);
 			break;
 		case ESCAPE:
-			json_string_escape(&a, wc);
+			json_string_escape(a, wc);
 			break;
 		case UESC0:
 		case UESC1:
 		case UESC2:
 		case UESC3:
-			json_string_uesc(&a, wc);
+			json_string_uesc(a, wc);
 			break;
 		case END:
 			// never happens
 			assert(false);
 			break;
 		}
-		a.textidx++;
+		a->textidx++;
 	}
-	if (a.prev != 0) {
-		a.error = JSONERR_INVALID_SURROGATE;
+	if (a->state == END && a->prev != 0) {
+		a->error = JSONERR_INVALID_SURROGATE;
 	}
+}
+
+/**
+   @brief Parses JSON strings, in a very generic manner.
+   @param text Input text.
+   @param idx Starting index of the string.
+   @param setter Function to call with each character.
+   @param setarg Argument to give to the setter function.
+ */
+static struct parser_arg json_string(const char *text, uint32_t idx,
+                                     uint32_t len, uint32_t maxout,
+                                     output_setter setter, void *setarg)
+{
+	struct parser_arg a = { .state = START,
+		                .text = text,
+		                .textidx = idx,
+		                .len = len,
+		                .maxout = maxout,
+		                .outidx = 0,
+		                .setter = setter,
+		                .setter_arg = setarg,
+		                .prev = 0,
+		                .curr = 0,
+		                .error = JSON_OK };
+
+	json_string_loop(&a, false);
 	return a;
 }
 
+/**
+   @brief Continue parsing a string with the next piece of input.
+
+   This is for parsers which receive their input a piece at a time.  The
+   string is parsed from text[*idx] up to its end or the end of the text,
+   whichever is first.  When eof is set, the end of the text is the end of the
+   input, so that the string is certain to end (perhaps in error).
+   @param st Saved parser state, updated on return.
+   @param text Input text.
+   @param idx Index to start at, updated to the index where parsing stopped.
+   @param len Length of the text.
+   @param eof Whether there is no more input after this.
+   @returns Any error encountered (only meaningful once st->done is set).
+ */
+enum json_error json_string_resume(struct json_string_state *st,
+                                   const char *text, uint32_t *idx,
+                                   uint32_t len, bool eof)
+{
+	struct parser_arg a = { .state = st->state,
+		                .text = text,
+		                .textidx = *idx,
+		                .len = len,
+		                .maxout = UINT32_MAX,
+		                .outidx = st->outidx,
+		                .setter = NULL,
+		                .setter_arg = NULL,
+		                .prev = st->prev,
+		                .curr = st->curr,
+		                .error = JSON_OK };
+
+	json_string_loop(&a, !eof);
+	st->state = a.state;
+	st->outidx = a.outidx;
+	st->prev = a.prev;
+	st->curr = a.curr;
+	st->done = (a.state == END);
+	*idx = a.textidx;
+	return a.error;
+}
+
 /*******************************************************************************
 
                           Application-Specific Parsers
@@ -391,27 +585,47 @@ static struct parser_arg json_string(const char *text, uint32_t idx,
 *******************************************************************************/
 
 /**
-   @brief Parse a string literal.
+   @brief Parse a string literal, and hash its decoded contents.
    @param text The text we're parsing.
    @param arr The token buffer.
+   @param hashes Buffer (parallel to arr) to put the hash in.  May be null.
    @param maxtoken The length of the token buffer.
    @param p The parser state.
    @returns Parser state after parsing the string.
  */
-struct json_parser json_parse_string(const char *text, struct json_token *arr,
-                                     uint32_t maxtoken, struct json_parser p)
+struct json_parser json_parse_key(const char *text, uint32_t len,
+                                  struct json_token *arr, uint32_t *hashes,
+                                  uint32_t maxtoken, struct json_parser p)
 {
-	struct json_token tok;
-	struct parser_arg a;
+	struct json_token tok = { 0 };
+	struct parser_arg a = { .state = START,
+		                .text = text,
+		                .textidx = p.textidx,
+		                .len = len,
+		                .maxout = UINT32_MAX,
+		                .outidx = 0,
+		                .setter = NULL,
+		                .setter_arg = NULL,
+		                .prev = 0,
+		                .curr = 0,
+		                .error = JSON_OK,
+		                .hashing = (hashes != NULL),
+		                .hash = JSON_HASH_INIT };
 
 	tok.type = JSON_STRING;
 	tok.start = p.textidx;
 
-	a = json_string(text, p.textidx, NULL, NULL);
+	json_string_loop(&a, false);
 
 	tok.next = 0;
 	tok.length = a.outidx;
+	// Escapes decode to fewer bytes than they take up, so the string has
+	// none if its length is that of the text between the quotes.
+	tok.plain = (a.error == JSON_OK &&
+	             a.textidx - tok.start - 2 == tok.length);
 	json_settoken(arr, tok, p, maxtoken);
+	if (hashes && p.tokenidx < maxtoken)
+		hashes[p.tokenidx] = a.hash;
 
 	p.error = a.error;
 	p.tokenidx++;
@@ -419,6 +633,21 @@ struct json_parser json_parse_string(const char *text, struct json_token *arr,
 	return p;
 }
 
+/**
+   @brief Parse a string literal.
+   @param text The text we're parsing.
+   @param arr The token buffer.
+   @param maxtoken The length of the token buffer.
+   @param p The parser state.
+   @returns Parser state after parsing the string.
+ */
+struct json_parser json_parse_string(const char *text, uint32_t len,
+                                     struct json_token *arr, uint32_t maxtoken,
+                                     struct json_parser p)
+{
+	return json_parse_key(text, len, arr, NULL, maxtoken, p);
+}
+
 /**
    @brief Argument passed to setter when we are doing json_string_match().
  */
@@ -461,7 +690,15 @@ int json_string_match(const char *json, const struct json_token *tokens,
 	if (tokens[index].type != JSON_STRING)
 		return JSONERR_TYPE;
 
+	if (tokens[index].plain) {
+		*match = json_string_match_plain(json, &tokens[index], other,
+		                                 strnlen(other,
+		                                         tokens[index].length + 1));
+		return JSON_OK;
+	}
+
 	struct parser_arg pa = json_string(json, tokens[index].start,
+	                                   UINT32_MAX, tokens[index].length,
 	                                   &json_string_comparator, &ca);
 
 	if (pa.error != JSON_OK)
@@ -474,6 +711,32 @@ int json_string_match(const char *json, const struct json_token *tokens,
 	return JSON_OK;
 }
 
+/**
+   @brief This is the "setter" function for json_string_hash().
+   @param a Parser arguments.
+   @param wc Character to set.
+   @param arg The hash so far.
+ */
+static void json_string_hasher(struct parser_arg *a, char wc, void *arg)
+{
+	uint32_t *hash = arg;
+	*hash = json_hash_step(*hash, wc);
+}
+
+int json_string_hash(const char *json, const struct json_token *tokens,
+                     uint32_t index, uint32_t *hash)
+{
+	struct parser_arg pa;
+
+	if (tokens[index].type != JSON_STRING)
+		return JSONERR_TYPE;
+
+	*hash = JSON_HASH_INIT;
+	pa = json_string(json, tokens[index].start, UINT32_MAX,
+	                 tokens[index].length, &json_string_hasher, hash);
+	return pa.error;
+}
+
 /**
    @brief This is the "setter" function for json_string_match().
    @param a Parser arguments.
@@ -499,8 +762,15 @@ int json_string_load(const char *json, const struct json_token *tokens,
 	if (tokens[index].type != JSON_STRING)
 		return JSONERR_TYPE;
 
-	pa = json_string(json, tokens[index].start, &json_string_loader,
-	                 buffer);
+	if (tokens[index].plain) {
+		memcpy(buffer, json + tokens[index].start + 1,
+		       tokens[index].length);
+		buffer[tokens[index].length] = '\0';
+		return JSON_OK;
+	}
+
+	pa = json_string(json, tokens[index].start, UINT32_MAX,
+	                 tokens[index].length, &json_string_loader, buffer);
 	if (pa.error != JSON_OK)
 		return pa.error;
 
@@ -508,6 +778,29 @@ int json_string_load(const char *json, const struct json_token *tokens,
 	return JSON_OK;
 }
 
+int json_string_view(const char *json, const struct json_token *tokens,
+                     uint32_t index, char *scratch, const char **out,
+                     uint32_t *len)
+{
+	int rv;
+
+	if (tokens[index].type != JSON_STRING)
+		return JSONERR_TYPE;
+
+	if (tokens[index].plain) {
+		*out = json + tokens[index].start + 1;
+		*len = tokens[index].length;
+		return JSON_OK;
+	}
+
+	rv = json_string_load(json, tokens, index, scratch);
+	if (rv != JSON_OK)
+		return rv;
+	*out = scratch;
+	*len = tokens[index].length;
+	return JSON_OK;
+}
+
 struct print_arg {
 	FILE *f;
 	bool escape;
@@ -557,7 +850,7 @@ int json_string_print(const char *json, const struct json_token *tokens,
 	if (tokens[index].type != JSON_STRING)
 		return JSONERR_TYPE;
 
-	parse = json_string(json, tokens[index].start, &json_string_printer,
-	                    &pa);
+	parse = json_string(json, tokens[index].start, UINT32_MAX,
+	                    tokens[index].length, &json_string_printer, &pa);
 	return parse.error;
 }
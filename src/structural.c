@@ -0,0 +1,610 @@
+/***************************************************************************/ /**
+
+   @file         structural.c
+
+   @author       Stephen Brennan
+
+   @brief        Two-stage tokenizer driven by an index of structural
+                 characters.
+
+   @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the
+ Revised BSD License.  See LICENSE.txt for details.
+
+   Stage one classifies the input 64 bytes at a time (with SSE2 or AVX2 where
+   available) into bitmasks of quotes, backslashes, operators and whitespace.
+   From those it works out which quotes are escaped and which bytes are inside
+   strings, and emits the offsets of every "structural" character: operators
+   and quotes outside of strings, plus the first byte of each scalar.  This
+   index is produced in small batches, so no memory is allocated.
+
+   Stage two walks the index to build the same tokens as json_parse().  Since
+   whitespace never shows up in the index, and the closing quote of a string is
+   the index entry following the opening one, most of the input is never
+   looked at one byte at a time.  Scalars and strings with escapes are still
+   validated with the ordinary parser functions.  If stage two runs into
+   anything unexpected, it gives up and the input is parsed again by
+   json_parse_n(), which also reports the error.  So this is purely a fast path
+   for valid input: results are always identical to json_parse().
+
+ *******************************************************************************/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if !defined(NOSJ_NO_SIMD) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#if defined(__SSE2__)
+#define NOSJ_HAVE_SSE2 1
+#endif
+#if defined(__GNUC__) && !defined(__AVX2__)
+// We can build an AVX2 version and choose it at runtime.
+#define NOSJ_HAVE_AVX2 1
+#define NOSJ_TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(__AVX2__)
+#define NOSJ_HAVE_AVX2 1
+#define NOSJ_TARGET_AVX2
+#endif
+#endif
+
+#include "json_private.h"
+#include "nosj.h"
+
+/**
+   @brief Number of 64-byte blocks classified each time the index runs dry.
+ */
+#define JSON_INDEX_BLOCKS 16
+
+/**
+   @brief Bitmasks describing one 64-byte block of input (bit i is byte i).
+ */
+struct json_blockmasks {
+	uint64_t quote;
+	uint64_t backslash;
+	uint64_t op;
+	uint64_t space;
+	/** @brief Opening and closing brackets (a subset of op) */
+	uint64_t open;
+	uint64_t close;
+};
+
+typedef void (*json_classify_fn)(const char *block, struct json_blockmasks *m);
+
+/**
+   @brief State of stage one, and the batch of index entries it produced.
+ */
+struct json_indexer {
+	/**
+	   @brief Input text, and its length.
+	 */
+	const char *text;
+	uint32_t len;
+	/**
+	   @brief Offset of the next block to classify.
+	 */
+	uint32_t scanned;
+	/**
+	   @brief Carried from one block to the next: whether the last byte was
+	   an unescaped backslash, was inside a string, or was part of a scalar.
+	 */
+	uint64_t prev_escaped;
+	uint64_t prev_in_string;
+	uint64_t prev_scalar;
+	/**
+	   @brief Block classifier chosen for this CPU.
+	 */
+	json_classify_fn classify;
+	/**
+	   @brief Index entries: cur is the next to hand out, out of npos.
+	 */
+	uint32_t cur;
+	uint32_t npos;
+	uint32_t pos[JSON_INDEX_BLOCKS * 64];
+};
+
+/*******************************************************************************
+
+                              Block Classifiers
+
+*******************************************************************************/
+
+enum {
+	CLS_QUOTE = 1,
+	CLS_BACKSLASH = 2,
+	CLS_OP = 4,
+	CLS_SPACE = 8,
+};
+
+static const uint8_t json_charclass[256] = {
+	['"'] = CLS_QUOTE, ['\\'] = CLS_BACKSLASH, ['{'] = CLS_OP,
+	['}'] = CLS_OP,    ['['] = CLS_OP,         [']'] = CLS_OP,
+	[':'] = CLS_OP,    [','] = CLS_OP,         [' '] = CLS_SPACE,
+	['\t'] = CLS_SPACE, ['\n'] = CLS_SPACE,    ['\r'] = CLS_SPACE,
+};
+
+#ifndef NOSJ_HAVE_SSE2
+static void json_classify_scalar(const char *block, struct json_blockmasks *m)
+{
+	uint64_t quote = 0, backslash = 0, op = 0, space = 0;
+	uint64_t open = 0, close = 0;
+	for (int i = 0; i < 64; i++) {
+		uint64_t cls = json_charclass[(unsigned char)block[i]];
+		quote |= (cls & 1) << i;
+		backslash |= ((cls >> 1) & 1) << i;
+		op |= ((cls >> 2) & 1) << i;
+		space |= ((cls >> 3) & 1) << i;
+		open |= (uint64_t)((block[i] | 0x20) == '{') << i;
+		close |= (uint64_t)((block[i] | 0x20) == '}') << i;
+	}
+	m->quote = quote;
+	m->backslash = backslash;
+	m->op = op;
+	m->space = space;
+	m->open = open;
+	m->close = close;
+}
+#endif
+
+#ifdef NOSJ_HAVE_SSE2
+static void json_classify_sse2(const char *block, struct json_blockmasks *m)
+{
+	// ORing 0x20 maps '[' and ']' onto '{' and '}', and nothing else onto
+	// them, so two compares find all four brackets.
+	const __m128i lower = _mm_set1_epi8(0x20);
+	const __m128i lbrace = _mm_set1_epi8('{');
+	const __m128i rbrace = _mm_set1_epi8('}');
+	const __m128i colon = _mm_set1_epi8(':');
+	const __m128i comma = _mm_set1_epi8(',');
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i sp = _mm_set1_epi8(' ');
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i nl = _mm_set1_epi8('\n');
+	const __m128i cr = _mm_set1_epi8('\r');
+
+	m->quote = m->backslash = m->op = m->space = m->open = m->close = 0;
+	for (int i = 0; i < 4; i++) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(block + 16 * i));
+		__m128i vl = _mm_or_si128(v, lower);
+		__m128i open = _mm_cmpeq_epi8(vl, lbrace);
+		__m128i close = _mm_cmpeq_epi8(vl, rbrace);
+		__m128i op = _mm_or_si128(
+		        _mm_or_si128(open, close),
+		        _mm_or_si128(_mm_cmpeq_epi8(v, colon),
+		                     _mm_cmpeq_epi8(v, comma)));
+		__m128i space = _mm_or_si128(
+		        _mm_or_si128(_mm_cmpeq_epi8(v, sp),
+		                     _mm_cmpeq_epi8(v, tab)),
+		        _mm_or_si128(_mm_cmpeq_epi8(v, nl),
+		                     _mm_cmpeq_epi8(v, cr)));
+		int shift = 16 * i;
+		m->quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+		                    _mm_cmpeq_epi8(v, quote))
+		            << shift;
+		m->backslash |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+		                        _mm_cmpeq_epi8(v, backslash))
+		                << shift;
+		m->op |= (uint64_t)(uint16_t)_mm_movemask_epi8(op) << shift;
+		m->space |= (uint64_t)(uint16_t)_mm_movemask_epi8(space) << shift;
+		m->open |= (uint64_t)(uint16_t)_mm_movemask_epi8(open)
+		           << shift;
+		m->close |= (uint64_t)(uint16_t)_mm_movemask_epi8(close)
+		            << shift;
+	}
+}
+#endif
+
+#ifdef NOSJ_HAVE_AVX2
+NOSJ_TARGET_AVX2
+static void json_classify_avx2(const char *block, struct json_blockmasks *m)
+{
+	const __m256i lower = _mm256_set1_epi8(0x20);
+	const __m256i lbrace = _mm256_set1_epi8('{');
+	const __m256i rbrace = _mm256_set1_epi8('}');
+	const __m256i colon = _mm256_set1_epi8(':');
+	const __m256i comma = _mm256_set1_epi8(',');
+	const __m256i quote = _mm256_set1_epi8('"');
+	const __m256i backslash = _mm256_set1_epi8('\\');
+	const __m256i sp = _mm256_set1_epi8(' ');
+	const __m256i tab = _mm256_set1_epi8('\t');
+	const __m256i nl = _mm256_set1_epi8('\n');
+	const __m256i cr = _mm256_set1_epi8('\r');
+
+	m->quote = m->backslash = m->op = m->space = m->open = m->close = 0;
+	for (int i = 0; i < 2; i++) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(block + 32 * i));
+		__m256i vl = _mm256_or_si256(v, lower);
+		__m256i open = _mm256_cmpeq_epi8(vl, lbrace);
+		__m256i close = _mm256_cmpeq_epi8(vl, rbrace);
+		__m256i op = _mm256_or_si256(
+		        _mm256_or_si256(open, close),
+		        _mm256_or_si256(_mm256_cmpeq_epi8(v, colon),
+		                        _mm256_cmpeq_epi8(v, comma)));
+		__m256i space = _mm256_or_si256(
+		        _mm256_or_si256(_mm256_cmpeq_epi8(v, sp),
+		                        _mm256_cmpeq_epi8(v, tab)),
+		        _mm256_or_si256(_mm256_cmpeq_epi8(v, nl),
+		                        _mm256_cmpeq_epi8(v, cr)));
+		int shift = 32 * i;
+		m->quote |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+		                    _mm256_cmpeq_epi8(v, quote))
+		            << shift;
+		m->backslash |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+		                        _mm256_cmpeq_epi8(v, backslash))
+		                << shift;
+		m->op |= (uint64_t)(uint32_t)_mm256_movemask_epi8(op) << shift;
+		m->space |= (uint64_t)(uint32_t)_mm256_movemask_epi8(space)
+		            << shift;
+		m->open |= (uint64_t)(uint32_t)_mm256_movemask_epi8(open)
+		           << shift;
+		m->close |= (uint64_t)(uint32_t)_mm256_movemask_epi8(close)
+		            << shift;
+	}
+}
+#endif
+
+static json_classify_fn json_classify_select(void)
+{
+#ifdef NOSJ_HAVE_AVX2
+	if (__builtin_cpu_supports("avx2"))
+		return json_classify_avx2;
+#endif
+#ifdef NOSJ_HAVE_SSE2
+	return json_classify_sse2;
+#else
+	return json_classify_scalar;
+#endif
+}
+
+/*******************************************************************************
+
+                           Stage One: Structural Index
+
+*******************************************************************************/
+
+/**
+   @brief Return a mask of the bytes escaped by a backslash.
+
+   A byte is escaped when it follows an odd-length run of backslashes.  Runs
+   are found with an addition: adding the start of each run to the run itself
+   carries through to the byte after it, and whether a run starting on an odd
+   or even bit has odd length is then a matter of comparing against the even
+   bits.  See Langdale & Lemire, "Parsing Gigabytes of JSON per Second".
+ */
+static uint64_t json_find_escaped(uint64_t backslash, uint64_t *prev_escaped)
+{
+	const uint64_t even_bits = 0x5555555555555555ULL;
+	uint64_t follows_escape, odd_starts, sequences, invert;
+	bool carry;
+
+	backslash &= ~*prev_escaped;
+	follows_escape = (backslash << 1) | *prev_escaped;
+	odd_starts = backslash & ~even_bits & ~follows_escape;
+	sequences = odd_starts + backslash;
+	carry = sequences < odd_starts;
+	*prev_escaped = carry;
+	invert = sequences << 1;
+	return (even_bits ^ invert) & follows_escape;
+}
+
+/**
+   @brief Return a mask with each bit set to the XOR of all bits up to it.
+
+   Given the mask of quotes, this is the mask of bytes inside strings
+   (including the opening quote, but not the closing one).
+ */
+static uint64_t json_prefix_xor(uint64_t x)
+{
+	x ^= x << 1;
+	x ^= x << 2;
+	x ^= x << 4;
+	x ^= x << 8;
+	x ^= x << 16;
+	x ^= x << 32;
+	return x;
+}
+
+/**
+   @brief Classify the block at ix->scanned and append its structurals.
+ */
+static void json_index_block(struct json_indexer *ix)
+{
+	struct json_blockmasks m;
+	uint64_t escaped, quote, in_string, scalar, follows_scalar, structural;
+	uint32_t base = ix->scanned;
+	char tail[64];
+
+	if (ix->len - base >= 64) {
+		ix->classify(ix->text + base, &m);
+	} else {
+		// Pad the final block with whitespace, which is never indexed.
+		memset(tail, ' ', sizeof(tail));
+		memcpy(tail, ix->text + base, ix->len - base);
+		ix->classify(tail, &m);
+	}
+	ix->scanned += 64;
+
+	escaped = json_find_escaped(m.backslash, &ix->prev_escaped);
+	quote = m.quote & ~escaped;
+	in_string = json_prefix_xor(quote) ^ ix->prev_in_string;
+	ix->prev_in_string = (uint64_t)((int64_t)in_string >> 63);
+
+	// A scalar is a run of anything but operators, whitespace or quotes.
+	// Only the byte starting each run is indexed.
+	scalar = ~(m.op | m.space | quote);
+	follows_scalar = (scalar << 1) | ix->prev_scalar;
+	ix->prev_scalar = scalar >> 63;
+	structural = ((m.op | (scalar & ~follows_scalar)) & ~in_string) | quote;
+
+	while (structural) {
+		ix->pos[ix->npos++] = base + __builtin_ctzll(structural);
+		structural &= structural - 1;
+	}
+}
+
+/**
+   @brief Refill the batch of index entries, if it has been used up.
+ */
+static void json_index_refill(struct json_indexer *ix)
+{
+	ix->cur = ix->npos = 0;
+	for (int i = 0; i < JSON_INDEX_BLOCKS && ix->scanned < ix->len; i++)
+		json_index_block(ix);
+}
+
+/**
+   @brief Return the offset of the next structural character, without
+   consuming it.  At the end of input, this is the offset of the terminator.
+ */
+static inline uint32_t json_index_peek(struct json_indexer *ix)
+{
+	while (ix->cur == ix->npos) {
+		if (ix->scanned >= ix->len)
+			return ix->len;
+		json_index_refill(ix);
+	}
+	return ix->pos[ix->cur];
+}
+
+/**
+   @brief Return and consume the offset of the next structural character.
+ */
+static inline uint32_t json_index_next(struct json_indexer *ix)
+{
+	uint32_t pos = json_index_peek(ix);
+	if (ix->cur < ix->npos)
+		ix->cur++;
+	return pos;
+}
+
+/**
+   @brief Return the position just past the object or array starting at idx,
+   or 0 if the input ends first.
+
+   Each block is classified as in stage one, and the brackets outside of
+   strings are counted, a whole block at a time unless the depth may reach zero
+   in it.  So this does not check that the
+   brackets match in kind, or anything else about what is between them.
+ */
+uint32_t json_skip_container(const char *text, uint32_t len, uint32_t idx)
+{
+	json_classify_fn classify = json_classify_select();
+	struct json_blockmasks m;
+	uint64_t prev_escaped = 0, prev_in_string = 0;
+	uint64_t escaped, quote, in_string, open, close, op, bit;
+	uint32_t base, depth = 0;
+	char tail[64];
+
+	for (base = idx; base < len; base += 64) {
+		if (len - base >= 64) {
+			classify(text + base, &m);
+		} else {
+			memset(tail, ' ', sizeof(tail));
+			memcpy(tail, text + base, len - base);
+			classify(tail, &m);
+		}
+		escaped = json_find_escaped(m.backslash, &prev_escaped);
+		quote = m.quote & ~escaped;
+		in_string = json_prefix_xor(quote) ^ prev_in_string;
+		prev_in_string = (uint64_t)((int64_t)in_string >> 63);
+
+		open = m.open & ~in_string;
+		close = m.close & ~in_string;
+		// Unless the depth can reach zero in this block, just count.
+		if (__builtin_popcountll(close) < depth) {
+			depth += __builtin_popcountll(open);
+			depth -= __builtin_popcountll(close);
+			goto next;
+		}
+		for (op = open | close; op; op &= op - 1) {
+			bit = op & -op;
+			if (open & bit)
+				depth++;
+			else if (--depth == 0)
+				return base + __builtin_ctzll(op) + 1;
+		}
+next:
+		if (len - base <= 64)
+			break;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+
+                             Stage Two: Tokenizing
+
+*******************************************************************************/
+
+/**
+   @brief Return true if text[start..end) is all JSON whitespace.
+ */
+static bool json_all_space(const char *text, uint32_t start, uint32_t end)
+{
+	for (; start < end; start++)
+		if (!(json_charclass[(unsigned char)text[start]] & CLS_SPACE))
+			return false;
+	return true;
+}
+
+/**
+   @brief Tokenize the string whose opening quote is at p.textidx.
+
+   The closing quote is the next index entry.  Strings without backslashes need
+   no decoding, so their length comes straight from the index.
+   @returns False if stage two should give up.
+ */
+static bool json_index_string(struct json_indexer *ix, struct json_token *arr,
+                              uint32_t maxtoken, struct json_parser *p)
+{
+	uint32_t open = p->textidx, close = json_index_next(ix);
+	struct json_token tok = { 0 };
+
+	if (json_peek(ix->text, ix->len, close) != '"')
+		return false;
+	if (memchr(ix->text + open + 1, '\\', close - open - 1)) {
+		*p = json_parse_string(ix->text, ix->len, arr, maxtoken, *p);
+		return p->error == JSON_OK && p->textidx == close + 1;
+	}
+	tok.type = JSON_STRING;
+	tok.plain = 1;
+	tok.start = open;
+	tok.length = close - open - 1;
+	tok.next = 0;
+	json_settoken(arr, tok, *p, maxtoken);
+	p->tokenidx++;
+	p->textidx = close + 1;
+	return true;
+}
+
+/**
+   @brief Walk the structural index, building tokens like json_parse_value().
+   @returns False if stage two should give up.
+ */
+static bool json_index_tokenize(struct json_indexer *ix, struct json_token *arr,
+                                uint32_t maxtoken, struct json_parser *p)
+{
+	struct json_frame stack[NOSJ_MAX_DEPTH];
+	struct json_frame *top = NULL;
+	struct json_token tok = { 0 };
+	const char *text = ix->text;
+	uint32_t len = ix->len, depth = 0;
+	char c;
+
+	p->textidx = json_index_next(ix);
+value:
+	// p->textidx is at the value, which has been taken from the index.
+	c = json_peek(text, len, p->textidx);
+	if (c == '"') {
+		if (!json_index_string(ix, arr, maxtoken, p))
+			return false;
+		goto end_value;
+	} else if (c != '{' && c != '[') {
+		*p = json_parse_scalar(text, len, arr, NULL, maxtoken, *p);
+		if (p->error != JSON_OK)
+			return false;
+		// Whatever follows a scalar must be whitespace, up to the next
+		// structural (unless the scalar is all there is to parse).
+		if (depth && !json_all_space(text, p->textidx,
+		                             json_index_peek(ix)))
+			return false;
+		goto end_value;
+	}
+	if (depth == NOSJ_MAX_DEPTH)
+		return false;
+	top = &stack[depth++];
+	top->tokenidx = p->tokenidx;
+	top->previdx = 0;
+	top->length = 0;
+	top->object = (c == '{');
+	tok.type = top->object ? JSON_OBJECT : JSON_ARRAY;
+	tok.start = p->textidx;
+	tok.length = 0;
+	tok.next = 0;
+	json_settoken(arr, tok, *p, maxtoken);
+	p->tokenidx++;
+	p->textidx = json_index_next(ix);
+
+next_member:
+	c = json_peek(text, len, p->textidx);
+	if (c == (top->object ? '}' : ']'))
+		goto end_container;
+
+	if (top->previdx != 0)
+		json_setnext(arr, top->previdx, p->tokenidx, maxtoken);
+	top->previdx = p->tokenidx;
+
+	if (top->object) {
+		if (c != '"' || !json_index_string(ix, arr, maxtoken, p))
+			return false;
+		if (json_peek(text, len, json_index_next(ix)) != ':')
+			return false;
+		p->textidx = json_index_next(ix);
+	}
+	goto value;
+
+end_value:
+	if (depth == 0)
+		return true;
+	top = &stack[depth - 1];
+	top->length++;
+	p->textidx = json_index_next(ix);
+	c = json_peek(text, len, p->textidx);
+	if (c == ',') {
+		p->textidx = json_index_next(ix);
+		goto next_member;
+	} else if (c != (top->object ? '}' : ']')) {
+		return false;
+	}
+
+end_container:
+	json_setlength(arr, top->tokenidx, top->length, maxtoken);
+	p->textidx++;
+	depth--;
+	goto end_value;
+}
+
+/**
+   @brief Parse text[0..len) using the index, which must not contain a NUL.
+ */
+static struct json_parser json_parse_indexed_nonul(const char *text,
+                                                   uint32_t len,
+                                                   struct json_token *arr,
+                                                   uint32_t maxtoken)
+{
+	struct json_parser p = { .textidx = 0, .tokenidx = 0, .error = JSON_OK };
+	struct json_indexer ix;
+
+	if (json_too_long((uint64_t)len + 64))
+		return json_parse_n(text, len, arr, maxtoken);
+
+	ix.text = text;
+	ix.len = len;
+	ix.scanned = 0;
+	ix.prev_escaped = 0;
+	ix.prev_in_string = 0;
+	ix.prev_scalar = 0;
+	ix.classify = json_classify_select();
+	ix.cur = ix.npos = 0;
+
+	if (!json_index_tokenize(&ix, arr, maxtoken, &p))
+		return json_parse_n(text, len, arr, maxtoken);
+	return p;
+}
+
+struct json_parser json_parse_indexed_n(const char *text, uint32_t len,
+                                        struct json_token *arr,
+                                        uint32_t maxtoken)
+{
+	// A NUL ends the input early, which the index doesn't account for.
+	// That never happens in valid JSON, so leave it to the serial parser.
+	if (memchr(text, '\0', len))
+		return json_parse_n(text, len, arr, maxtoken);
+	return json_parse_indexed_nonul(text, len, arr, maxtoken);
+}
+
+struct json_parser json_parse_indexed(const char *text, struct json_token *arr,
+                                      uint32_t maxtoken)
+{
+	return json_parse_indexed_nonul(text, json_strlen(text), arr, maxtoken);
+}
@@ -0,0 +1,188 @@
+/***************************************************************************/ /**
+
+   @file         tape.c
+
+   @author       Stephen Brennan
+
+   @brief        Tokens stored as a structure of arrays.
+
+   @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the
+ Revised BSD License.  See LICENSE.txt for details.
+
+   A json_tape holds the tokens of json_parse() with each field in its own
+   array.  It is built by tokenizing as json_easy_parse() does, and then
+   splitting the tokens into columns, which all live in one allocation.  The
+   lookups here are those of util.c, written so that each reads only the
+   columns it needs: walking an array reads only next, and looking for a key
+   reads next and length, and start only for the keys of the right length.
+
+ *******************************************************************************/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_private.h"
+#include "nosj.h"
+
+/**
+   @brief Allocate the columns for n tokens.
+
+   The 32-bit columns come first, so that all of them are aligned.
+ */
+static int json_tape_alloc(struct json_tape *tape, uint32_t n)
+{
+	size_t words = (size_t)n * sizeof(uint32_t);
+	char *mem = malloc(3 * words + 2 * (size_t)n);
+
+	if (!mem)
+		return -1;
+	tape->next = (uint32_t *)mem;
+	tape->start = (uint32_t *)(mem + words);
+	tape->length = (uint32_t *)(mem + 2 * words);
+	tape->type = (uint8_t *)(mem + 3 * words);
+	tape->plain = tape->type + n;
+	return 0;
+}
+
+void json_tape_init(struct json_tape *tape, const char *input, uint32_t len)
+{
+	memset(tape, 0, sizeof(*tape));
+	tape->input = input;
+	tape->input_len = len;
+}
+
+void json_tape_destroy(struct json_tape *tape)
+{
+	/* The other columns share the allocation of next. */
+	free(tape->next);
+	tape->next = NULL;
+}
+
+int json_tape_parse(struct json_tape *tape)
+{
+	struct json_easy easy;
+	struct json_parser p;
+	struct json_token *t;
+
+	/* Already parsed? */
+	if (tape->len)
+		return 0;
+	json_easy_init_n(&easy, tape->input, tape->input_len);
+	p = json_easy_tokenize(&easy);
+	if (p.error != JSON_OK) {
+		tape->error_at = p.textidx;
+		goto out;
+	}
+	if (json_tape_alloc(tape, p.tokenidx)) {
+		p.error = JSONERR_NOMEM;
+		goto out;
+	}
+	t = easy.tokens;
+	for (uint32_t i = 0; i < p.tokenidx; i++) {
+		tape->type[i] = t[i].type;
+		tape->plain[i] = t[i].plain;
+		tape->start[i] = t[i].start;
+		tape->length[i] = t[i].length;
+		tape->next[i] = t[i].next;
+	}
+	tape->len = p.tokenidx;
+out:
+	json_easy_destroy(&easy);
+	return p.error;
+}
+
+/**
+   @brief Look up a key whose length is known in an object.
+ */
+static int json_tape_key(const struct json_tape *tape, uint32_t tok,
+                         const char *key, size_t keylen, uint32_t *ret)
+{
+	struct json_token k;
+
+	if (tape->type[tok] != JSON_OBJECT)
+		return JSONERR_TYPE;
+	if (tape->length[tok] == 0)
+		return JSONERR_LOOKUP;
+
+	/* A key's length is that of its decoded contents, so check it first */
+	for (tok++; tok != 0; tok = tape->next[tok]) {
+		if (tape->length[tok] != keylen)
+			continue;
+		if (tape->plain[tok]) {
+			if (memcmp(tape->input + tape->start[tok] + 1, key,
+			           keylen) != 0)
+				continue;
+		} else {
+			k = json_tape_token(tape, tok);
+			if (!json_key_match(tape->input, &k, NULL, 0, key,
+			                    keylen, 0))
+				continue;
+		}
+		*ret = tok + 1;
+		return JSON_OK;
+	}
+	return JSONERR_LOOKUP;
+}
+
+int json_tape_object_get(const struct json_tape *tape, uint32_t tok,
+                         const char *key, uint32_t *ret)
+{
+	return json_tape_key(tape, tok, key, strlen(key), ret);
+}
+
+int json_tape_array_get(const struct json_tape *tape, uint32_t tok,
+                        uint32_t index, uint32_t *ret)
+{
+	if (tape->type[tok] != JSON_ARRAY)
+		return JSONERR_TYPE;
+	if (index >= tape->length[tok])
+		return JSONERR_INDEX;
+
+	tok++; /* First element has index one greater than array */
+	while (index--)
+		tok = tape->next[tok];
+	*ret = tok;
+	return JSON_OK;
+}
+
+int json_tape_path_eval(const struct json_tape *tape,
+                        const struct json_path *path, uint32_t tok,
+                        uint32_t *result)
+{
+	const struct json_path_step *st;
+	int rv;
+
+	if (path->multi < path->nsteps) {
+		*result = path->steps[path->multi].end;
+		return JSONERR_BAD_EXPR;
+	}
+	for (uint32_t i = 0; i < path->nsteps; i++) {
+		st = &path->steps[i];
+		if (st->key)
+			rv = json_tape_key(tape, tok, st->key, st->keylen,
+			                   &tok);
+		else
+			rv = json_tape_array_get(tape, tok, st->index, &tok);
+		if (rv != JSON_OK) {
+			*result = st->end;
+			return rv;
+		}
+	}
+	*result = tok;
+	return JSON_OK;
+}
+
+int json_tape_lookup(const struct json_tape *tape, uint32_t tok,
+                     const char *expr, uint32_t *result)
+{
+	struct json_path *path;
+	int rv;
+
+	if ((rv = json_path_compile(expr, &path, result)))
+		return rv;
+	rv = json_tape_path_eval(tape, path, tok, result);
+	json_path_free(path);
+	return rv;
+}
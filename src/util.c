@@ -18,47 +18,185 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "json_private.h"
 #include "nosj.h"
 
-void json_easy_init(struct json_easy *easy, const char *input)
+/* Initial guess used by json_easy_parse(): one token per this many bytes */
+#define JSON_EASY_BYTES_PER_TOKEN 8
+#define JSON_EASY_MIN_TOKENS      16
+
+void json_easy_init_n(struct json_easy *easy, const char *input, uint32_t len)
 {
 	easy->input = input;
-	easy->input_len = strlen(input);
+	easy->input_len = len;
 	easy->tokens = NULL;
 	easy->tokens_len = 0;
+	easy->tokens_cap = 0;
+	easy->index = NULL;
+	easy->hashes = NULL;
+	easy->ints = NULL;
+	easy->projected = false;
+	easy->map = NULL;
+	easy->map_len = 0;
 }
 
-int json_easy_parse(struct json_easy *easy)
+void json_easy_init(struct json_easy *easy, const char *input)
 {
-	struct json_parser p;
+	json_easy_init_n(easy, input, json_strlen(input));
+}
 
-	/* Already parsed? */
-	if (easy->tokens)
+/**
+ * Make room for at least @a n tokens in the easy token buffer (and key hashes
+ * and integer values, if there are any). The buffer grows geometrically so
+ * that repeated reservations stay amortized O(1).
+ */
+int json_easy_reserve(struct json_easy *easy, uint32_t n)
+{
+	struct json_token *tokens;
+	uint32_t cap, old;
+
+	/* Tokens loaded from a file are copied out before anything changes. */
+	if (json_easy_detach(easy))
+		return -1;
+	cap = old = easy->tokens_cap;
+	if (n <= cap)
 		return 0;
+	if (cap < JSON_EASY_MIN_TOKENS)
+		cap = JSON_EASY_MIN_TOKENS;
+	while (cap < n)
+		cap = (cap > UINT32_MAX / 2) ? n : cap * 2;
+
+	if (easy->hashes) {
+		uint32_t *hashes = realloc(easy->hashes,
+		                           (size_t)cap * sizeof(*hashes));
+		if (!hashes)
+			return -1;
+		/* Tokens other than keys have no hash, so keep them zero. */
+		memset(hashes + old, 0, (size_t)(cap - old) * sizeof(*hashes));
+		easy->hashes = hashes;
+	}
+	if (easy->ints) {
+		struct json_int *ints = realloc(easy->ints,
+		                                (size_t)cap * sizeof(*ints));
+		if (!ints)
+			return -1;
+		memset(ints + old, 0, (size_t)(cap - old) * sizeof(*ints));
+		easy->ints = ints;
+	}
+	tokens = realloc(easy->tokens, (size_t)cap * sizeof(*tokens));
+	if (!tokens)
+		return -1;
+	easy->tokens = tokens;
+	easy->tokens_cap = cap;
+	return 0;
+}
 
-	p = json_parse(easy->input, NULL, 0);
+/**
+ * Parse the input of a json_easy once, into the buffers it has.
+ */
+static struct json_parser json_easy_parse_into(struct json_easy *easy)
+{
+	struct json_parser p = { 0 };
+
+	return json_parse_value_depth(easy->input, easy->input_len,
+	                              easy->tokens, easy->hashes, easy->ints,
+	                              easy->tokens_cap, p, NOSJ_MAX_DEPTH);
+}
+
+/**
+ * Tokenize the input of a json_easy into its token buffer, reusing the buffer
+ * and growing it only if needed, and return the parser result. On success,
+ * tokens_len is set. Key hashes and integer values are filled in too, if there
+ * are buffers for them.
+ */
+struct json_parser json_easy_tokenize(struct json_easy *easy)
+{
+	struct json_parser p = { 0 };
+
+	/*
+	 * Guess the token count from the input size and parse once. The parser
+	 * keeps counting tokens after the buffer fills up, so on overflow we
+	 * know exactly how much room is needed, and only then parse again.
+	 */
+	if (json_easy_reserve(easy, easy->input_len / JSON_EASY_BYTES_PER_TOKEN)) {
+		p.error = JSONERR_NOMEM;
+		return p;
+	}
+	p = json_easy_parse_into(easy);
 	if (p.error != JSON_OK)
-		return p.error;
+		return p;
 
-	easy->tokens_len = p.tokenidx;
-	easy->tokens = calloc(p.tokenidx, sizeof(*easy->tokens));
-	p = json_parse(easy->input, easy->tokens, easy->tokens_len);
-
-	/* This should be impossible, but catch it anyway */
-	if (p.error != JSON_OK) {
-		free(easy->tokens);
-		easy->tokens = NULL;
-		easy->tokens_len = 0;
-		return p.error;
+	if (p.tokenidx > easy->tokens_cap) {
+		if (json_easy_reserve(easy, p.tokenidx)) {
+			p.error = JSONERR_NOMEM;
+			return p;
+		}
+		p = json_easy_parse_into(easy);
+		/* This should be impossible, but catch it anyway */
+		if (p.error != JSON_OK)
+			return p;
 	}
-	return 0;
+	easy->tokens_len = p.tokenidx;
+	easy->projected = false;
+	return p;
+}
+
+int json_easy_parse(struct json_easy *easy)
+{
+	/* Already parsed? */
+	if (easy->tokens_len)
+		return 0;
+	return json_easy_tokenize(easy).error;
+}
+
+int json_easy_parse_hashed(struct json_easy *easy)
+{
+	if (easy->hashes)
+		return json_easy_parse(easy);
+
+	/* Allocate the hashes alongside the tokens, then parse (again). */
+	if (json_easy_reserve(easy, JSON_EASY_MIN_TOKENS))
+		return JSONERR_NOMEM;
+	easy->hashes = calloc(easy->tokens_cap, sizeof(*easy->hashes));
+	if (!easy->hashes)
+		return JSONERR_NOMEM;
+	easy->tokens_len = 0;
+	return json_easy_tokenize(easy).error;
+}
+
+int json_easy_parse_ints(struct json_easy *easy)
+{
+	if (easy->ints)
+		return json_easy_parse(easy);
+
+	/* As for the hashes, allocate the values, then parse (again). */
+	if (json_easy_reserve(easy, JSON_EASY_MIN_TOKENS))
+		return JSONERR_NOMEM;
+	easy->ints = calloc(easy->tokens_cap, sizeof(*easy->ints));
+	if (!easy->ints)
+		return JSONERR_NOMEM;
+	easy->tokens_len = 0;
+	return json_easy_tokenize(easy).error;
 }
 
 void json_easy_destroy(struct json_easy *easy)
 {
+	json_index_free(easy->index);
+	json_easy_unmap(easy);
+	free(easy->ints);
+	free(easy->hashes);
 	free(easy->tokens);
 }
 
+int json_easy_index(struct json_easy *easy, size_t max_bytes)
+{
+	if (easy->index)
+		return 0;
+	easy->index = json_index_build(easy->input, easy->tokens,
+	                               easy->tokens_len, max_bytes);
+	return easy->index ? 0 : JSONERR_NOMEM;
+}
+
 int json_easy_string_get(struct json_easy *easy, uint32_t index, char **out)
 {
 	char *buf = malloc(easy->tokens[index].length + 1);
@@ -71,21 +209,46 @@ int json_easy_string_get(struct json_easy *easy, uint32_t index, char **out)
 	return JSON_OK;
 }
 
-int json_object_get(const char *json, const struct json_token *tokens,
-                    uint32_t index, const char *key, uint32_t *ret)
+/**
+ * Return whether the key at index equals the given key, whose length and hash
+ * are given. If hashes is not null, keys whose hash differs are skipped.
+ */
+bool json_key_match(const char *json, const struct json_token *tokens,
+                    const uint32_t *hashes, uint32_t index, const char *key,
+                    size_t keylen, uint32_t hash)
+{
+	int rv;
+	bool match;
+
+	if (hashes && hashes[index] != hash)
+		return false;
+	if (tokens[index].plain)
+		/* Most keys have no escapes: compare them directly */
+		return json_string_match_plain(json, &tokens[index], key,
+		                               keylen);
+	rv = json_string_match(json, tokens, index, key, &match);
+	assert(rv == JSON_OK);
+	return match;
+}
+
+/**
+ * Implementation of json_object_get() and friends, given the length and hash
+ * of the key. If hashes is not null, keys whose hash differs are skipped.
+ */
+int json_object_find(const char *json, const struct json_token *tokens,
+                     const uint32_t *hashes, uint32_t index, const char *key,
+                     size_t keylen, uint32_t hash, uint32_t *ret)
 {
 	if (tokens[index].type != JSON_OBJECT)
 		return JSONERR_TYPE;
+	if (tokens[index].length == 0)
+		return JSONERR_LOOKUP;
 
 	index++; /* First key has index one greater than object */
 
 	while (index != 0) {
-		int rv;
-		bool match;
-
-		rv = json_string_match(json, tokens, index, key, &match);
-		assert(rv == JSON_OK);
-		if (match) {
+		if (json_key_match(json, tokens, hashes, index, key, keylen,
+		                   hash)) {
 			/* Value has index one greater than key */
 			*ret = index + 1;
 			return JSON_OK;
@@ -96,6 +259,21 @@ int json_object_get(const char *json, const struct json_token *tokens,
 	return JSONERR_LOOKUP;
 }
 
+int json_object_get(const char *json, const struct json_token *tokens,
+                    uint32_t index, const char *key, uint32_t *ret)
+{
+	return json_object_find(json, tokens, NULL, index, key, strlen(key), 0,
+	                        ret);
+}
+
+int json_object_get_hashed(const char *json, const struct json_token *tokens,
+                           const uint32_t *hashes, uint32_t index,
+                           const char *key, uint32_t *ret)
+{
+	return json_object_find(json, tokens, hashes, index, key, strlen(key),
+	                        json_hash_str(key), ret);
+}
+
 int json_array_get(const char *json, const struct json_token *tokens,
                    uint32_t index, uint32_t array_index, uint32_t *result)
 {
@@ -119,41 +297,73 @@ int json_number_get(const char *json, const struct json_token *tokens,
 {
 	if (tokens[index].type != JSON_NUMBER)
 		return JSONERR_TYPE;
-	/*
-	 * At this point, we've validated the syntax of the float. If sscanf()
-	 * fails, that is highly unexpected and worth an assertion.
-	 */
-	assert(sscanf(json + tokens[index].start, "%lf", number) == 1);
+	*number = json_number_double(json + tokens[index].start,
+	                             tokens[index].length);
+	return JSON_OK;
+}
+
+/**
+ * Convert the magnitude and sign of an integer to an int64_t, if it fits.
+ */
+static int json_int_signed(uint64_t mag, bool neg, int64_t *number)
+{
+	if (mag > (uint64_t)INT64_MAX + neg)
+		return JSONERR_NOT_INT;
+	*number = neg && mag ? -(int64_t)(mag - 1) - 1 : (int64_t)mag;
 	return JSON_OK;
 }
 
 int json_number_getint(const char *json, const struct json_token *tokens,
                        uint32_t index, int64_t *number)
 {
+	uint64_t mag;
+	bool neg;
+
 	if (tokens[index].type != JSON_NUMBER)
 		return JSONERR_TYPE;
-	char *end;
-	int64_t val = strtoll(json + tokens[index].start, &end, 10);
-	if (end != json + tokens[index].start + tokens[index].length) {
+	if (!json_number_integer(json + tokens[index].start,
+	                         tokens[index].length, &mag, &neg))
 		return JSONERR_NOT_INT;
-	}
-	*number = val;
-	return JSON_OK;
+	return json_int_signed(mag, neg, number);
 }
 
 int json_number_getuint(const char *json, const struct json_token *tokens,
                         uint32_t index, uint64_t *number)
 {
+	uint64_t mag;
+	bool neg;
+
 	if (tokens[index].type != JSON_NUMBER)
 		return JSONERR_TYPE;
-	char *end;
-	/* Fail negative numbers, since strtoull doesn't */
-	if (json[tokens[index].start] == '-')
+	/* Fail negative numbers, even -0 */
+	if (!json_number_integer(json + tokens[index].start,
+	                         tokens[index].length, &mag, &neg) ||
+	    neg)
 		return JSONERR_NOT_INT;
-	uint64_t val = strtoull(json + tokens[index].start, &end, 10);
-	if (end != json + tokens[index].start + tokens[index].length)
+	*number = mag;
+	return JSON_OK;
+}
+
+int json_int_get(const struct json_token *tokens, const struct json_int *ints,
+                 uint32_t index, int64_t *number)
+{
+	if (tokens[index].type != JSON_NUMBER)
+		return JSONERR_TYPE;
+	if (!ints[index].integer)
 		return JSONERR_NOT_INT;
-	*number = val;
+	return json_int_signed(ints[index].mag, ints[index].neg, number);
+}
+
+int json_int_getuint(const struct json_token *tokens,
+                     const struct json_int *ints, uint32_t index,
+                     uint64_t *number)
+{
+	if (tokens[index].type != JSON_NUMBER)
+		return JSONERR_TYPE;
+	/* Fail negative numbers, even -0 */
+	if (!ints[index].integer || ints[index].neg)
+		return JSONERR_NOT_INT;
+	*number = ints[index].mag;
 	return JSON_OK;
 }
 
@@ -166,6 +376,16 @@ int json_number_getuint(const char *json, const struct json_token *tokens,
  */
 int json_lookup(const char *json, const struct json_token *arr, uint32_t tok,
                 const char *key, uint32_t *result)
+{
+	return json_lookup_ix(json, arr, NULL, tok, key, result);
+}
+
+/**
+ * Implementation of json_lookup(), which uses the index ix (if not null).
+ */
+int json_lookup_ix(const char *json, const struct json_token *arr,
+                   const struct json_index *ix, uint32_t tok, const char *key,
+                   uint32_t *result)
 {
 	uint32_t start = 0, i = 0;
 	int state = 0;
@@ -191,9 +411,13 @@ int json_lookup(const char *json, const struct json_token *arr, uint32_t tok,
 				goto out;
 			}
 			keymut[i] = '\0';
-			ret = json_object_get(json, arr, tok, &keymut[start],
-			                      &tok);
-			if (tok == 0)
+			if (ix)
+				ret = json_index_object_get(ix, tok,
+				                            &keymut[start], &tok);
+			else
+				ret = json_object_get(json, arr, tok,
+				                      &keymut[start], &tok);
+			if (ret != JSON_OK)
 				goto out;
 			start = i + 1;
 			if (c == '[')
@@ -220,8 +444,12 @@ int json_lookup(const char *json, const struct json_token *arr, uint32_t tok,
 				ret = JSONERR_INDEX;
 				goto out;
 			}
-			ret = json_array_get(json, arr, tok, (size_t)index,
-			                     &tok);
+			if (ix)
+				ret = json_index_array_get(ix, tok, (size_t)index,
+				                           &tok);
+			else
+				ret = json_array_get(json, arr, tok,
+				                     (size_t)index, &tok);
 			if (ret != JSON_OK)
 				goto out;
 			i += 1;
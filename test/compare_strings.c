@@ -13,6 +13,7 @@
 
  *******************************************************************************/
 
+#include <string.h>
 #include <unity.h>
 
 #include "nosj.h"
@@ -275,6 +276,48 @@ static void test_invalid_surrogate_pair(void)
 	TEST_ASSERT(p.error == JSONERR_INVALID_SURROGATE);
 }
 
+static void test_plain_flag(void)
+{
+	char input[] = "{\"plain\": \"a\\nb\", \"\": [\"\\u0041\", \"x\", 1]}";
+	struct json_token tokens[8], itokens[8];
+	struct json_parser p = json_parse(input, tokens, 8);
+	TEST_ASSERT(p.error == JSON_OK);
+	TEST_ASSERT_EQUAL_INT(8, p.tokenidx);
+	TEST_ASSERT(!tokens[0].plain); // object
+	TEST_ASSERT(tokens[1].plain);  // "plain"
+	TEST_ASSERT(!tokens[2].plain); // "a\nb"
+	TEST_ASSERT(tokens[3].plain);  // ""
+	TEST_ASSERT(!tokens[4].plain); // array
+	TEST_ASSERT(!tokens[5].plain); // "\u0041"
+	TEST_ASSERT(tokens[6].plain);  // "x"
+	TEST_ASSERT(!tokens[7].plain); // 1
+	p = json_parse_indexed(input, itokens, 8);
+	TEST_ASSERT(p.error == JSON_OK);
+	TEST_ASSERT(!memcmp(tokens, itokens, sizeof(tokens)));
+}
+
+static void test_plain_object_get(void)
+{
+	char input[] = "{\"ab\": 1, \"a\": 2, \"a\\u0062c\": 3, \"abc\": 4}";
+	struct json_token tokens[9];
+	struct json_parser p = json_parse(input, tokens, 9);
+	uint32_t r;
+	bool match;
+	TEST_ASSERT(p.error == JSON_OK);
+	TEST_ASSERT(!json_object_get(input, tokens, 0, "a", &r));
+	TEST_ASSERT_EQUAL_INT(4, r);
+	TEST_ASSERT(!json_object_get(input, tokens, 0, "abc", &r));
+	TEST_ASSERT_EQUAL_INT(6, r);
+	TEST_ASSERT_EQUAL_INT(JSONERR_LOOKUP,
+	                      json_object_get(input, tokens, 0, "", &r));
+	TEST_ASSERT_EQUAL_INT(JSONERR_LOOKUP,
+	                      json_object_get(input, tokens, 0, "abcd", &r));
+	TEST_ASSERT(!json_string_match(input, tokens, 1, "a", &match));
+	TEST_ASSERT(!match);
+	TEST_ASSERT(!json_string_match(input, tokens, 1, "abc", &match));
+	TEST_ASSERT(!match);
+}
+
 int main(void)
 {
 	UNITY_BEGIN();
@@ -295,5 +338,7 @@ int main(void)
 	RUN_TEST(test_incomplete_surrogate);
 	RUN_TEST(test_invalid_surrogate_char);
 	RUN_TEST(test_invalid_surrogate_pair);
+	RUN_TEST(test_plain_flag);
+	RUN_TEST(test_plain_object_get);
 	return UNITY_END();
 }
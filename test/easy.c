@@ -54,6 +54,23 @@ static void test_parse_fail(void)
 	json_easy_free(easy);
 }
 
+static void test_parse_grow(void)
+{
+	/* Far more tokens than the initial guess based on input length */
+	struct json_easy *easy = json_easy_new("[1,2,3,4,5,6,7,8,9,[0,1,2,3,4,5,"
+	                                       "6,7,8,9,[0,1,2,3,4,5,6,7,8,9]]]");
+	uint32_t index;
+	double number;
+
+	TEST_ASSERT(!json_easy_parse(easy));
+	TEST_ASSERT_EQUAL(32, easy->tokens_len);
+	TEST_ASSERT(easy->tokens_cap >= easy->tokens_len);
+	TEST_ASSERT(!json_easy_lookup(easy, 0, "[9][10][9]", &index));
+	TEST_ASSERT(!json_easy_number_get(easy, index, &number));
+	TEST_ASSERT_EQUAL(9, number);
+	json_easy_free(easy);
+}
+
 int main(void)
 {
 	UNITY_BEGIN();
@@ -61,6 +78,7 @@ int main(void)
 	RUN_TEST(test_basic_access);
 	RUN_TEST(test_easy_string);
 	RUN_TEST(test_parse_fail);
+	RUN_TEST(test_parse_grow);
 
 	return UNITY_END();
 }
@@ -1,5 +1,6 @@
 /* format.c - test formatting */
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <unity.h>
 
@@ -110,6 +111,98 @@ static void test_complex_nesting(void)
 	TEST_ASSERT_EQUAL_STRING(expected, res);
 }
 
+static char *write_mem(struct json_writer *w, char *data)
+{
+	struct json_parser p = json_parse(data, NULL, 0);
+	TEST_ASSERT(p.error == JSON_OK);
+	struct json_token *tok = calloc(p.tokenidx, sizeof(*tok));
+	p = json_parse(data, tok, p.tokenidx);
+	TEST_ASSERT_EQUAL(JSON_OK, json_write(w, data, tok, p.tokenidx, 0));
+	free(tok);
+	return w->buf;
+}
+
+static void test_escapes(void)
+{
+	// A raw tab is allowed in a string, but escaped on output.
+	char *res = format("[\"a\\\"b\\n\", \"\\u00e9\\/\", \"tab\there\"]");
+	TEST_ASSERT_EQUAL_STRING(
+	        "[\n  \"a\\\"b\\n\",\n  \"\xc3\xa9/\",\n  \"tab\\there\"\n]\n",
+	        res);
+}
+
+static void test_compact(void)
+{
+	struct json_writer w;
+
+	json_writer_init(&w);
+	w.indent = 0;
+	w.newline = false;
+	write_mem(&w, "{\"foo\": [1, {}, []], \"bar\": {\"a\\tb\": null}}");
+	TEST_ASSERT_EQUAL_STRING("{\"foo\":[1,{},[]],\"bar\":{\"a\\tb\":null}}",
+	                         w.buf);
+	TEST_ASSERT_EQUAL(strlen(w.buf), w.len);
+
+	// Values follow one another, as for NDJSON.
+	w.newline = true;
+	w.len = 0;
+	write_mem(&w, "[true]");
+	write_mem(&w, "false");
+	TEST_ASSERT_EQUAL_STRING("[true]\nfalse\n", w.buf);
+	json_writer_destroy(&w);
+}
+
+static void test_indent(void)
+{
+	struct json_writer w;
+
+	json_writer_init(&w);
+	w.indent = 4;
+	write_mem(&w, "{\"foo\": [1, 2]}");
+	TEST_ASSERT_EQUAL_STRING("{\n    \"foo\": [\n        1,\n        2\n"
+	                         "    ]\n}\n",
+	                         w.buf);
+	json_writer_destroy(&w);
+}
+
+static int collect(const char *buf, size_t len, void *arg)
+{
+	size_t *total = arg;
+	*total += len;
+	return *total > 70000;
+}
+
+static void test_callback(void)
+{
+	static char data[4 + 3 * 4096];
+	struct json_token tok[4097];
+	struct json_writer w;
+	size_t total = 0;
+	int i;
+
+	// An array of 4096 tens, 24579 bytes once formatted.
+	data[0] = '[';
+	for (i = 0; i < 4096; i++)
+		memcpy(data + 1 + 3 * i, "10,", 3);
+	strcpy(data + 3 * 4096, "]");
+	TEST_ASSERT_EQUAL(JSON_OK, json_parse(data, tok, 4097).error);
+
+	json_writer_init_cb(&w, collect, &total);
+	TEST_ASSERT_EQUAL(JSON_OK, json_write(&w, data, tok, 4097, 0));
+	TEST_ASSERT_EQUAL(0, total);
+	TEST_ASSERT_EQUAL(JSON_OK, json_writer_flush(&w));
+	TEST_ASSERT_EQUAL(24579, total);
+
+	// Output goes to the callback as the buffer fills, until it fails.
+	for (i = 0; i < 2; i++)
+		TEST_ASSERT_EQUAL(JSON_OK, json_write(&w, data, tok, 4097, 0));
+	TEST_ASSERT_EQUAL(24579, total);
+	TEST_ASSERT_EQUAL(JSONERR_IO, json_write(&w, data, tok, 4097, 0));
+	TEST_ASSERT(total > 70000);
+	TEST_ASSERT_EQUAL(JSONERR_IO, json_writer_flush(&w));
+	json_writer_destroy(&w);
+}
+
 int main(void)
 {
 	UNITY_BEGIN();
@@ -118,5 +211,9 @@ int main(void)
 	RUN_TEST(test_simple_object);
 	RUN_TEST(test_simple_array);
 	RUN_TEST(test_complex_nesting);
+	RUN_TEST(test_escapes);
+	RUN_TEST(test_compact);
+	RUN_TEST(test_indent);
+	RUN_TEST(test_callback);
 	return UNITY_END();
 }
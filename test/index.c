@@ -0,0 +1,220 @@
+/*
+ * test/index.c: Lookups using a json_index
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include "nosj.h"
+
+static char *doc;
+static struct json_token *tokens;
+static uint32_t ntokens;
+
+void setUp(void)
+{
+	// set stuff up here
+}
+
+void tearDown(void)
+{
+	// clean stuff up here
+}
+
+/*
+ * Build a document with a large array of objects (each with a mid-sized array
+ * in it), a small array and an empty one.
+ */
+static void make_doc(void)
+{
+	size_t len = 0;
+	struct json_parser p;
+
+	doc = malloc(1 << 20);
+	len += sprintf(doc + len, "{\"items\": [");
+	for (int i = 0; i < 1000; i++) {
+		len += sprintf(doc + len, "%s{\"id\": %d, \"v\": [", i ? ", " : "",
+		               i);
+		for (int j = 0; j < 20; j++)
+			len += sprintf(doc + len, "%s%d", j ? "," : "", i * j);
+		len += sprintf(doc + len, "]}");
+	}
+	len += sprintf(doc + len, "], \"small\": [1, 2, 3], \"empty\": []}");
+
+	p = json_parse(doc, NULL, 0);
+	TEST_ASSERT_EQUAL(JSON_OK, p.error);
+	ntokens = p.tokenidx;
+	tokens = calloc(ntokens, sizeof(*tokens));
+	json_parse(doc, tokens, ntokens);
+}
+
+/*
+ * Every array lookup through the index must agree with json_array_get().
+ */
+static void check_arrays(const struct json_index *ix)
+{
+	for (uint32_t i = 0; i < ntokens; i++) {
+		uint32_t n = tokens[i].type == JSON_ARRAY ? tokens[i].length : 1;
+		for (uint32_t j = 0; j <= n; j++) {
+			uint32_t r1 = 0, r2 = 0;
+			int rv1 = json_array_get(doc, tokens, i, j, &r1);
+			int rv2 = json_index_array_get(ix, i, j, &r2);
+			TEST_ASSERT_EQUAL(rv1, rv2);
+			TEST_ASSERT_EQUAL(r1, r2);
+		}
+	}
+}
+
+static void test_array_get(void)
+{
+	struct json_index *ix = json_index_build(doc, tokens, ntokens, SIZE_MAX);
+	TEST_ASSERT(ix);
+	check_arrays(ix);
+	json_index_free(ix);
+}
+
+static void test_memory_limit(void)
+{
+	// Room for just a few of the arrays, or none at all
+	struct json_index *ix = json_index_build(doc, tokens, ntokens, 500);
+	TEST_ASSERT(ix);
+	check_arrays(ix);
+	json_index_free(ix);
+	ix = json_index_build(doc, tokens, ntokens, 0);
+	TEST_ASSERT(ix);
+	check_arrays(ix);
+	json_index_free(ix);
+}
+
+static void test_lookup(void)
+{
+	struct json_index *ix = json_index_build(doc, tokens, ntokens, SIZE_MAX);
+	char expr[64];
+	uint32_t r1, r2;
+
+	for (int i = 0; i < 1000; i += 37) {
+		sprintf(expr, "items[%d].v[%d]", i, i % 20);
+		TEST_ASSERT_EQUAL(JSON_OK, json_lookup(doc, tokens, 0, expr, &r1));
+		TEST_ASSERT_EQUAL(JSON_OK, json_index_lookup(ix, 0, expr, &r2));
+		TEST_ASSERT_EQUAL(r1, r2);
+	}
+	TEST_ASSERT_EQUAL(JSONERR_INDEX,
+	                  json_index_lookup(ix, 0, "items[1000]", &r2));
+	TEST_ASSERT_EQUAL(JSONERR_INDEX, json_index_lookup(ix, 0, "empty[0]", &r2));
+	TEST_ASSERT_EQUAL(JSONERR_TYPE, json_index_lookup(ix, 0, "small.x", &r2));
+	json_index_free(ix);
+}
+
+/*
+ * Every key lookup through the index must agree with json_object_get(),
+ * including for escaped and duplicate keys, and keys which aren't there.
+ */
+static void check_keys(const char *json, const struct json_token *toks,
+                       uint32_t n, const struct json_index *ix)
+{
+	static const char *missing[] = { "", "k", "k1000", "K0", "dup\\" };
+	char key[64];
+
+	for (uint32_t i = 0; i < n; i++) {
+		uint32_t elem;
+		if (toks[i].type != JSON_OBJECT)
+			continue;
+		json_array_for_each(elem, toks, i) {
+			uint32_t r1 = 0, r2 = 0;
+			TEST_ASSERT_EQUAL(JSON_OK,
+			                  json_string_load(json, toks, elem, key));
+			TEST_ASSERT_EQUAL(JSON_OK,
+			                  json_object_get(json, toks, i, key, &r1));
+			TEST_ASSERT_EQUAL(JSON_OK,
+			                  json_index_object_get(ix, i, key, &r2));
+			TEST_ASSERT_EQUAL(r1, r2);
+		}
+		for (size_t j = 0; j < sizeof(missing) / sizeof(missing[0]); j++) {
+			uint32_t r = 0;
+			TEST_ASSERT_EQUAL(JSONERR_LOOKUP,
+			                  json_index_object_get(ix, i, missing[j],
+			                                        &r));
+		}
+	}
+}
+
+static void test_object_get(void)
+{
+	char *wide = malloc(1 << 16);
+	struct json_token *toks;
+	struct json_parser p;
+	struct json_index *ix;
+	size_t len = 0;
+	uint32_t r, r2;
+
+	len += sprintf(wide, "{\"dup\": 1, \"d\\u0075p\": 2, \"\\u00e9\": 3, ");
+	for (int i = 0; i < 500; i++)
+		len += sprintf(wide + len, "\"k%d\": {\"a\": %d}, ", i, i);
+	sprintf(wide + len, "\"dup\": 4, \"small\": {\"a\": 1}}");
+	p = json_parse(wide, NULL, 0);
+	TEST_ASSERT_EQUAL(JSON_OK, p.error);
+	toks = calloc(p.tokenidx, sizeof(*toks));
+	json_parse(wide, toks, p.tokenidx);
+
+	ix = json_index_build(wide, toks, p.tokenidx, SIZE_MAX);
+	TEST_ASSERT(ix);
+	check_keys(wide, toks, p.tokenidx, ix);
+	// The first of the duplicates wins, however it was spelled.
+	TEST_ASSERT_EQUAL(JSON_OK, json_index_object_get(ix, 0, "dup", &r));
+	TEST_ASSERT_EQUAL(2, r);
+	TEST_ASSERT_EQUAL(JSON_OK, json_index_lookup(ix, 0, "k321.a", &r));
+	TEST_ASSERT_EQUAL(JSON_OK, json_lookup(wide, toks, 0, "k321.a", &r2));
+	TEST_ASSERT_EQUAL(r2, r);
+	TEST_ASSERT_EQUAL(JSONERR_TYPE,
+	                  json_index_object_get(ix, 2, "dup", &r));
+	json_index_free(ix);
+
+	// Too little memory for the wide object: lookups fall back.
+	ix = json_index_build(wide, toks, p.tokenidx, 1000);
+	TEST_ASSERT(ix);
+	check_keys(wide, toks, p.tokenidx, ix);
+	json_index_free(ix);
+
+	free(toks);
+	free(wide);
+}
+
+static void test_easy(void)
+{
+	struct json_easy easy;
+	uint32_t index;
+	int64_t value;
+
+	json_easy_init(&easy, "[0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,"
+	                      " 15, 16, 17, 18, 19, 20]");
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_parse(&easy));
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_index(&easy, SIZE_MAX));
+	for (int i = 0; i <= 20; i++) {
+		TEST_ASSERT_EQUAL(JSON_OK,
+		                  json_easy_array_get(&easy, 0, i, &index));
+		TEST_ASSERT_EQUAL(JSON_OK,
+		                  json_easy_number_getint(&easy, index, &value));
+		TEST_ASSERT_EQUAL(i, value);
+	}
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_lookup(&easy, 0, "[17]", &index));
+	TEST_ASSERT_EQUAL(18, index);
+	json_easy_destroy(&easy);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+
+	make_doc();
+	RUN_TEST(test_array_get);
+	RUN_TEST(test_memory_limit);
+	RUN_TEST(test_lookup);
+	RUN_TEST(test_object_get);
+	RUN_TEST(test_easy);
+	free(tokens);
+	free(doc);
+
+	return UNITY_END();
+}
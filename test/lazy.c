@@ -0,0 +1,170 @@
+/*
+ * test/lazy.c: On-demand tokenizing must agree with json_parse()
+ */
+
+#include <string.h>
+#include <unity.h>
+
+#include "nosj.h"
+#include "twitapi.h"
+
+void setUp(void)
+{
+	// set stuff up here
+}
+
+void tearDown(void)
+{
+	// clean stuff up here
+}
+
+/*
+ * Expand every container under a lazy token, checking that each token matches
+ * the one json_parse() produced for the same value.
+ */
+static void check_tree(struct json_lazy *lz, uint32_t tok,
+                       const struct json_token *tokens, uint32_t full)
+{
+	uint32_t a, b;
+
+	TEST_ASSERT_EQUAL(tokens[full].type, lz->tokens[tok].type);
+	TEST_ASSERT_EQUAL(tokens[full].start, lz->tokens[tok].start);
+	if (tokens[full].type != JSON_OBJECT &&
+	    tokens[full].type != JSON_ARRAY) {
+		TEST_ASSERT_EQUAL(tokens[full].length, lz->tokens[tok].length);
+		TEST_ASSERT_EQUAL(tokens[full].plain, lz->tokens[tok].plain);
+		return;
+	}
+	TEST_ASSERT_EQUAL(JSON_OK, json_lazy_expand(lz, tok));
+	TEST_ASSERT_EQUAL(tokens[full].length, lz->tokens[tok].length);
+	b = full + 1;
+	json_lazy_for_each(a, lz, tok) {
+		TEST_ASSERT(b != 0);
+		check_tree(lz, a, tokens, b);
+		if (tokens[full].type == JSON_OBJECT)
+			check_tree(lz, a + 1, tokens, b + 1);
+		b = tokens[b].next;
+	}
+	TEST_ASSERT(b == 0 || tokens[full].length == 0);
+}
+
+static void test_tree(void)
+{
+	struct json_easy easy;
+	struct json_lazy lz;
+
+	json_easy_init(&easy, twitapi_json);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_parse(&easy));
+	json_lazy_init(&lz, twitapi_json, strlen(twitapi_json));
+	TEST_ASSERT_EQUAL(JSON_OK, json_lazy_parse(&lz));
+	// Only the root and its members so far.
+	TEST_ASSERT_EQUAL(1 + 2 * easy.tokens[0].length, lz.tokens_len);
+	check_tree(&lz, 0, easy.tokens, 0);
+	TEST_ASSERT_EQUAL(easy.tokens_len, lz.tokens_len);
+	json_lazy_destroy(&lz);
+	json_easy_destroy(&easy);
+}
+
+static void test_lookup(void)
+{
+	static const char *exprs[] = {
+		"user.entities.url.urls[0].indices[1]",
+		"user.entities.url.urls[0].indices[2]",
+		"user.name",
+		"user.name.first",
+		"contributors[0]",
+		"favorited.x",
+		"foobar",
+	};
+	struct json_easy easy;
+	struct json_lazy lz;
+	uint32_t r1, r2;
+	int rv1, rv2;
+	char s[32];
+
+	json_easy_init(&easy, twitapi_json);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_parse(&easy));
+	json_lazy_init(&lz, twitapi_json, strlen(twitapi_json));
+	TEST_ASSERT_EQUAL(JSON_OK, json_lazy_parse(&lz));
+	for (size_t i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i++) {
+		rv1 = json_easy_lookup(&easy, 0, exprs[i], &r1);
+		rv2 = json_lazy_lookup(&lz, 0, exprs[i], &r2);
+		TEST_ASSERT_EQUAL(rv1, rv2);
+		if (rv1 != JSON_OK) {
+			TEST_ASSERT_EQUAL(r1, r2);
+			continue;
+		}
+		TEST_ASSERT_EQUAL(easy.tokens[r1].type, lz.tokens[r2].type);
+		TEST_ASSERT_EQUAL(easy.tokens[r1].start, lz.tokens[r2].start);
+	}
+	// Strings are read as usual.
+	TEST_ASSERT_EQUAL(JSON_OK, json_lazy_lookup(&lz, 0, "user.name", &r2));
+	TEST_ASSERT_EQUAL(JSON_STRING, lz.tokens[r2].type);
+	TEST_ASSERT(lz.tokens[r2].length < sizeof(s));
+	TEST_ASSERT_EQUAL(JSON_OK,
+	                  json_string_load(lz.input, lz.tokens, r2, s));
+	TEST_ASSERT_EQUAL_STRING("Twitter API", s);
+	// Only the containers on the way were tokenized.
+	TEST_ASSERT(lz.tokens_len < easy.tokens_len);
+	json_lazy_destroy(&lz);
+	json_easy_destroy(&easy);
+}
+
+static void test_skip(void)
+{
+	static const char doc[] =
+		"{\"a\": [\"x]\\\"}\", \"\\\\\", {\"]\": \"{\"}], "
+		"\"b\": [1, 2,, 3], \"c\": 2}";
+	struct json_lazy lz;
+	uint32_t r;
+
+	json_lazy_init(&lz, doc, sizeof(doc) - 1);
+	TEST_ASSERT_EQUAL(JSON_OK, json_lazy_parse(&lz));
+	TEST_ASSERT_EQUAL(JSON_OK, json_lazy_lookup(&lz, 0, "c", &r));
+	TEST_ASSERT_EQUAL(JSON_NUMBER, lz.tokens[r].type);
+	TEST_ASSERT_EQUAL(JSON_OK, json_lazy_lookup(&lz, 0, "a[2].]", &r));
+	TEST_ASSERT_EQUAL(JSON_STRING, lz.tokens[r].type);
+	TEST_ASSERT_EQUAL(JSON_OK, json_lazy_lookup(&lz, 0, "a[1]", &r));
+	TEST_ASSERT_EQUAL(1, lz.tokens[r].length);
+	// The error in "b" is only found when it is looked into.
+	TEST_ASSERT_EQUAL(JSONERR_UNEXPECTED_TOKEN,
+	                  json_lazy_lookup(&lz, 0, "b[0]", &r));
+	TEST_ASSERT_EQUAL(3, r);
+	TEST_ASSERT_EQUAL(strstr(doc, ",,") - doc + 1, lz.error_at);
+	json_lazy_destroy(&lz);
+}
+
+static void test_errors(void)
+{
+	static const char eof[] = "{\"a\": [1, {\"b\": \"]}\"}";
+	struct json_lazy lz;
+	uint32_t r;
+
+	// The brackets in the string don't count.
+	json_lazy_init(&lz, eof, sizeof(eof) - 1);
+	TEST_ASSERT_EQUAL(JSONERR_PREMATURE_EOF, json_lazy_parse(&lz));
+	TEST_ASSERT_EQUAL(sizeof(eof) - 1, lz.error_at);
+	TEST_ASSERT_EQUAL(0, lz.tokens_len);
+	json_lazy_destroy(&lz);
+
+	json_lazy_init(&lz, "[1 2]", 5);
+	TEST_ASSERT_EQUAL(JSONERR_MISSING_COMMA, json_lazy_parse(&lz));
+	TEST_ASSERT_EQUAL(3, lz.error_at);
+	json_lazy_destroy(&lz);
+
+	json_lazy_init(&lz, "\"scalar\"", 8);
+	TEST_ASSERT_EQUAL(JSON_OK, json_lazy_parse(&lz));
+	TEST_ASSERT_EQUAL(JSONERR_TYPE, json_lazy_lookup(&lz, 0, "[0]", &r));
+	TEST_ASSERT_EQUAL(JSONERR_TYPE, json_lazy_expand(&lz, 0));
+	json_lazy_destroy(&lz);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_tree);
+	RUN_TEST(test_lookup);
+	RUN_TEST(test_skip);
+	RUN_TEST(test_errors);
+	return UNITY_END();
+}
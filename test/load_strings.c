@@ -13,6 +13,7 @@
 
  *******************************************************************************/
 
+#include <string.h>
 #include <unity.h>
 
 #include "nosj.h"
@@ -123,6 +124,62 @@ static void test_unicode_undisturbed(void)
 	TEST_ASSERT_EQUAL_STRING(expected, buffer);
 }
 
+static void test_long_string_alignment(void)
+{
+	// Escapes and control characters at every offset within a vector
+	char input[128], expected[128], buffer[128];
+	struct json_token tokens[1];
+	for (int off = 0; off < 40; off++) {
+		int i = 0, j = 0;
+		input[i++] = '"';
+		for (int k = 0; k < off; k++)
+			input[i++] = expected[j++] = 'a' + k % 26;
+		strcpy(input + i, "\\n\\t\x01x");
+		strcpy(expected + j, "\n\t\x01x");
+		for (int k = 0; k < 50; k++)
+			strcat(input, "z");
+		strcat(input, "\"");
+		for (int k = 0; k < 50; k++)
+			strcat(expected, "z");
+
+		struct json_parser p = json_parse(input, tokens, 1);
+		TEST_ASSERT(p.error == JSON_OK);
+		TEST_ASSERT(p.textidx == strlen(input));
+		TEST_ASSERT(tokens[0].length == strlen(expected));
+		json_string_load(input, tokens, 0, buffer);
+		TEST_ASSERT_EQUAL_STRING(expected, buffer);
+	}
+}
+
+static void test_string_view(void)
+{
+	char input[] = "[\"hello\", \"he\\\"llo\", \"\", 1]";
+	char scratch[8];
+	struct json_token tokens[5];
+	struct json_parser p = json_parse(input, tokens, 5);
+	const char *out;
+	uint32_t len;
+	TEST_ASSERT(p.error == JSON_OK);
+
+	// Without escapes, the view points into the input.
+	TEST_ASSERT(!json_string_view(input, tokens, 1, scratch, &out, &len));
+	TEST_ASSERT(out == input + 2);
+	TEST_ASSERT_EQUAL_INT(5, len);
+	TEST_ASSERT(!memcmp(out, "hello", 5));
+
+	// With escapes, it is decoded into the scratch buffer.
+	TEST_ASSERT(!json_string_view(input, tokens, 2, scratch, &out, &len));
+	TEST_ASSERT(out == scratch);
+	TEST_ASSERT_EQUAL_INT(6, len);
+	TEST_ASSERT_EQUAL_STRING("he\"llo", out);
+
+	TEST_ASSERT(!json_string_view(input, tokens, 3, NULL, &out, &len));
+	TEST_ASSERT_EQUAL_INT(0, len);
+	TEST_ASSERT_EQUAL_INT(JSONERR_TYPE, json_string_view(input, tokens, 4,
+	                                                     scratch, &out,
+	                                                     &len));
+}
+
 int main(void)
 {
 	UNITY_BEGIN();
@@ -132,5 +189,7 @@ int main(void)
 	RUN_TEST(test_unicode_escape);
 	RUN_TEST(test_surrogate_pair);
 	RUN_TEST(test_unicode_undisturbed);
+	RUN_TEST(test_long_string_alignment);
+	RUN_TEST(test_string_view);
 	return UNITY_END();
 }
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include <unity.h>
 
 #include "nosj.h"
@@ -38,6 +39,10 @@ static void test_lookup_key_not_exist(void)
 	uint32_t r;
 	TEST_ASSERT_EQUAL(JSONERR_LOOKUP,
 	                  json_lookup(j, t, 0, "user.foobar", &r));
+	// The error is at the first key not found, not at the end.
+	TEST_ASSERT_EQUAL(JSONERR_LOOKUP,
+	                  json_lookup(j, t, 0, "user.foobar.x", &r));
+	TEST_ASSERT_EQUAL(11, r);
 }
 
 static void test_lookup_array(void)
@@ -124,6 +129,50 @@ static void test_lookup_invalid_index(void)
 	TEST_ASSERT_EQUAL(r, 15);
 }
 
+static void test_object_get_hashed(void)
+{
+	uint32_t n = json_parse(j, NULL, 0).tokenidx;
+	uint32_t *h = calloc(n, sizeof(*h));
+	struct json_token *ht = calloc(n, sizeof(*ht));
+	char key[256];
+
+	TEST_ASSERT_EQUAL(JSON_OK,
+	                  json_parse_hashed_n(j, strlen(j), ht, h, n).error);
+	TEST_ASSERT(!memcmp(t, ht, n * sizeof(*t)));
+	for (uint32_t i = 0; i < n; i++) {
+		uint32_t k, r1, r2;
+		if (t[i].type != JSON_OBJECT || t[i].length == 0)
+			continue;
+		json_for_each(k, t, i) {
+			TEST_ASSERT(!json_string_load(j, t, k, key));
+			TEST_ASSERT(!json_object_get(j, t, i, key, &r1));
+			TEST_ASSERT(!json_object_get_hashed(j, t, h, i, key, &r2));
+			TEST_ASSERT_EQUAL(r1, r2);
+		}
+		TEST_ASSERT_EQUAL(JSONERR_LOOKUP, json_object_get_hashed(
+		                                          j, t, h, i, "foobar", &r2));
+	}
+	free(ht);
+	free(h);
+}
+
+static void test_easy_parse_hashed(void)
+{
+	struct json_easy easy;
+	uint32_t r;
+
+	json_easy_init(&easy, "{\"a\": {}, \"b\\u00e9\": 1, \"b\u00e9\": 2}");
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_parse_hashed(&easy));
+	TEST_ASSERT(easy.hashes);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_object_get(&easy, 0, "b\u00e9", &r));
+	TEST_ASSERT_EQUAL(4, r);
+	TEST_ASSERT_EQUAL(JSONERR_LOOKUP,
+	                  json_easy_object_get(&easy, 0, "b", &r));
+	TEST_ASSERT_EQUAL(JSONERR_LOOKUP,
+	                  json_easy_object_get(&easy, 2, "b", &r));
+	json_easy_destroy(&easy);
+}
+
 int main(void)
 {
 	UNITY_BEGIN();
@@ -137,5 +186,7 @@ int main(void)
 	RUN_TEST(test_lookup_non_integer_index);
 	RUN_TEST(test_lookup_invalid_after_index);
 	RUN_TEST(test_lookup_invalid_index);
+	RUN_TEST(test_object_get_hashed);
+	RUN_TEST(test_easy_parse_hashed);
 	return UNITY_END();
 }
@@ -0,0 +1,155 @@
+/*
+ * test/ndjson.c: Reading newline-delimited JSON
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include "nosj.h"
+
+void setUp(void)
+{
+	// set stuff up here
+}
+
+void tearDown(void)
+{
+	// clean stuff up here
+}
+
+static const char *input = "{\"id\": 1, \"name\": \"one\"}\n"
+                           "\n"
+                           "  \r\n"
+                           "{\"id\": 2, \"name\": \"two\"}\r\n"
+                           "{\"id\": 3, \"name\": \"three\"} x\n"
+                           "[1, 2,\n"
+                           "  {\"id\": 4, \"name\": \"four\"}  ";
+
+/*
+ * Read all records, and check the ones which parse have the expected ids and
+ * names, and the others the expected errors.
+ */
+static void check_records(struct json_ndjson *nd)
+{
+	static const struct {
+		size_t line;
+		enum json_error error;
+		int64_t id;
+		const char *name;
+	} expected[] = {
+		{ 1, JSON_OK, 1, "one" },
+		{ 4, JSON_OK, 2, "two" },
+		{ 5, JSONERR_UNEXPECTED_TOKEN, 0, NULL },
+		{ 6, JSONERR_PREMATURE_EOF, 0, NULL },
+		{ 7, JSON_OK, 4, "four" },
+	};
+	size_t n = 0;
+
+	while (json_ndjson_next(nd)) {
+		uint32_t index;
+		int64_t id;
+		char *name;
+
+		TEST_ASSERT(n < sizeof(expected) / sizeof(expected[0]));
+		TEST_ASSERT_EQUAL(expected[n].line, nd->line);
+		TEST_ASSERT_EQUAL(expected[n].error, nd->p.error);
+		if (nd->p.error != JSON_OK) {
+			TEST_ASSERT_EQUAL(0, nd->record.tokens_len);
+			n++;
+			continue;
+		}
+		TEST_ASSERT_EQUAL(5, nd->record.tokens_len);
+		TEST_ASSERT(!json_easy_lookup(&nd->record, 0, "id", &index));
+		TEST_ASSERT(!json_easy_number_getint(&nd->record, index, &id));
+		TEST_ASSERT_EQUAL(expected[n].id, id);
+		TEST_ASSERT(!json_easy_lookup(&nd->record, 0, "name", &index));
+		TEST_ASSERT(!json_easy_string_get(&nd->record, index, &name));
+		TEST_ASSERT_EQUAL_STRING(expected[n].name, name);
+		free(name);
+		n++;
+	}
+	TEST_ASSERT_EQUAL(sizeof(expected) / sizeof(expected[0]), n);
+}
+
+static void test_buffer(void)
+{
+	struct json_ndjson nd;
+
+	json_ndjson_init(&nd, input, strlen(input));
+	check_records(&nd);
+	json_ndjson_destroy(&nd);
+}
+
+static void test_file(void)
+{
+	struct json_ndjson nd;
+	FILE *f = tmpfile();
+
+	TEST_ASSERT(f);
+	fputs(input, f);
+	rewind(f);
+	json_ndjson_init_file(&nd, f);
+	check_records(&nd);
+	json_ndjson_destroy(&nd);
+	fclose(f);
+}
+
+static void test_empty(void)
+{
+	struct json_ndjson nd;
+
+	json_ndjson_init(&nd, "", 0);
+	TEST_ASSERT(!json_ndjson_next(&nd));
+	json_ndjson_destroy(&nd);
+	json_ndjson_init(&nd, "\n \n\t\n", 5);
+	TEST_ASSERT(!json_ndjson_next(&nd));
+	TEST_ASSERT_EQUAL(3, nd.line);
+	json_ndjson_destroy(&nd);
+}
+
+static void test_token_reuse(void)
+{
+	struct json_ndjson nd;
+	struct json_token *tokens;
+	size_t len = 0, cap = 1 << 16;
+	char *buf = malloc(cap);
+	uint32_t i, cap_before;
+
+	// One large record, and then many smaller ones.
+	len += sprintf(buf + len, "[");
+	for (i = 0; i < 100; i++)
+		len += sprintf(buf + len, "%u,", i);
+	len += sprintf(buf + len, "0]\n");
+	for (i = 0; i < 1000; i++)
+		len += sprintf(buf + len, "{\"i\": %u, \"a\": [true]}\n", i);
+
+	json_ndjson_init(&nd, buf, len);
+	TEST_ASSERT(json_ndjson_next(&nd));
+	TEST_ASSERT_EQUAL(JSON_OK, nd.p.error);
+	TEST_ASSERT_EQUAL(102, nd.record.tokens_len);
+	tokens = nd.record.tokens;
+	cap_before = nd.record.tokens_cap;
+	for (i = 0; json_ndjson_next(&nd); i++) {
+		TEST_ASSERT_EQUAL(JSON_OK, nd.p.error);
+		TEST_ASSERT_EQUAL(6, nd.record.tokens_len);
+		TEST_ASSERT(tokens == nd.record.tokens);
+	}
+	TEST_ASSERT_EQUAL(1000, i);
+	TEST_ASSERT_EQUAL(cap_before, nd.record.tokens_cap);
+	json_ndjson_destroy(&nd);
+	free(buf);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+
+	RUN_TEST(test_buffer);
+	RUN_TEST(test_file);
+	RUN_TEST(test_empty);
+	RUN_TEST(test_token_reuse);
+
+	return UNITY_END();
+}
@@ -0,0 +1,182 @@
+/*
+ * test/ndjson_parallel.c: Reading newline-delimited JSON on several threads
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include "nosj.h"
+
+static char *input;
+static size_t input_len;
+static size_t nrecords, nerrors;
+
+void setUp(void)
+{
+	// set stuff up here
+}
+
+void tearDown(void)
+{
+	// clean stuff up here
+}
+
+/*
+ * Build a few MB of records, with blank lines, bad records and some lines long
+ * enough to span several chunks mixed in.
+ */
+static void make_input(void)
+{
+	size_t cap = 8 << 20;
+	input = malloc(cap);
+	input_len = 0;
+	nrecords = nerrors = 0;
+	for (unsigned int i = 0; input_len < cap - (1 << 18); i++) {
+		if (i % 1000 == 7) {
+			input_len += sprintf(input + input_len, "\n");
+			continue;
+		}
+		nrecords++;
+		if (i % 997 == 3) {
+			input_len += sprintf(input + input_len, "{\"i\": %u,,}\n", i);
+			nerrors++;
+		} else if (i % 50000 == 11) {
+			input_len += sprintf(input + input_len, "{\"i\": %u, \"s\": \"", i);
+			memset(input + input_len, 'x', 200000);
+			input_len += 200000;
+			input_len += sprintf(input + input_len, "\"}\n");
+		} else {
+			input_len += sprintf(input + input_len,
+			                     "{\"i\": %u, \"a\": [%u, \"s\"]}\n", i,
+			                     i * 7);
+		}
+	}
+}
+
+/*
+ * Ordered delivery must match the serial reader exactly.
+ */
+static int check_serial(struct json_ndjson *nd, void *arg)
+{
+	struct json_ndjson *serial = arg;
+
+	TEST_ASSERT(json_ndjson_next(serial));
+	TEST_ASSERT_EQUAL(serial->line, nd->line);
+	TEST_ASSERT(serial->record.input == nd->record.input);
+	TEST_ASSERT_EQUAL(serial->record.input_len, nd->record.input_len);
+	TEST_ASSERT_EQUAL(serial->p.error, nd->p.error);
+	TEST_ASSERT_EQUAL(serial->p.textidx, nd->p.textidx);
+	TEST_ASSERT_EQUAL(serial->record.tokens_len, nd->record.tokens_len);
+	TEST_ASSERT(!memcmp(serial->record.tokens, nd->record.tokens,
+	                    nd->record.tokens_len * sizeof(struct json_token)));
+	return 0;
+}
+
+static void check_ordered(unsigned int nthreads)
+{
+	struct json_ndjson serial;
+
+	json_ndjson_init(&serial, input, input_len);
+	TEST_ASSERT_EQUAL(0, json_ndjson_parallel(input, input_len, nthreads,
+	                                          true, check_serial, &serial));
+	TEST_ASSERT(!json_ndjson_next(&serial));
+	json_ndjson_destroy(&serial);
+}
+
+static void test_ordered(void)
+{
+	check_ordered(1);
+	check_ordered(4);
+	check_ordered(0);
+}
+
+struct totals {
+	pthread_mutex_t lock;
+	size_t records, errors;
+	uint64_t sum;
+};
+
+static int count_records(struct json_ndjson *nd, void *arg)
+{
+	struct totals *t = arg;
+	uint32_t index;
+	int64_t i = 0;
+
+	if (nd->p.error == JSON_OK) {
+		TEST_ASSERT(!json_easy_lookup(&nd->record, 0, "i", &index));
+		TEST_ASSERT(!json_easy_number_getint(&nd->record, index, &i));
+	}
+	pthread_mutex_lock(&t->lock);
+	t->records++;
+	t->errors += nd->p.error != JSON_OK;
+	t->sum += i;
+	pthread_mutex_unlock(&t->lock);
+	return 0;
+}
+
+static void test_unordered(void)
+{
+	struct totals serial = { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0 };
+	struct totals parallel = { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0 };
+	struct json_ndjson nd;
+
+	json_ndjson_init(&nd, input, input_len);
+	while (json_ndjson_next(&nd))
+		count_records(&nd, &serial);
+	json_ndjson_destroy(&nd);
+	TEST_ASSERT_EQUAL(nrecords, serial.records);
+	TEST_ASSERT_EQUAL(nerrors, serial.errors);
+
+	TEST_ASSERT_EQUAL(0, json_ndjson_parallel(input, input_len, 8, false,
+	                                          count_records, &parallel));
+	TEST_ASSERT_EQUAL(serial.records, parallel.records);
+	TEST_ASSERT_EQUAL(serial.errors, parallel.errors);
+	TEST_ASSERT_EQUAL(serial.sum, parallel.sum);
+}
+
+static int stop_at_1000(struct json_ndjson *nd, void *arg)
+{
+	size_t *count = arg;
+	(void)nd;
+	return ++*count == 1000 ? 42 : 0;
+}
+
+static void test_stop(void)
+{
+	size_t count = 0;
+
+	TEST_ASSERT_EQUAL(42, json_ndjson_parallel(input, input_len, 4, true,
+	                                           stop_at_1000, &count));
+	TEST_ASSERT_EQUAL(1000, count);
+}
+
+static void test_small(void)
+{
+	struct totals t = { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0 };
+	const char *small = "{\"i\": 1}\n\n{\"i\": 2}";
+
+	TEST_ASSERT_EQUAL(0, json_ndjson_parallel("", 0, 4, true,
+	                                          count_records, &t));
+	TEST_ASSERT_EQUAL(0, t.records);
+	TEST_ASSERT_EQUAL(0, json_ndjson_parallel(small, strlen(small), 4, false,
+	                                          count_records, &t));
+	TEST_ASSERT_EQUAL(2, t.records);
+	TEST_ASSERT_EQUAL(3, t.sum);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+
+	make_input();
+	RUN_TEST(test_ordered);
+	RUN_TEST(test_unordered);
+	RUN_TEST(test_stop);
+	RUN_TEST(test_small);
+	free(input);
+
+	return UNITY_END();
+}
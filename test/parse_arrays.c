@@ -13,6 +13,8 @@
 
  *******************************************************************************/
 
+#include <stdlib.h>
+#include <string.h>
 #include <unity.h>
 
 #include "nosj.h"
@@ -178,6 +180,42 @@ static void test_get_empty(void)
 	TEST_ASSERT(res == JSONERR_INDEX);
 }
 
+static char *nested(uint32_t depth)
+{
+	char *input = malloc(2 * depth + 1);
+	memset(input, '[', depth);
+	memset(input + depth, ']', depth);
+	input[2 * depth] = '\0';
+	return input;
+}
+
+static void test_nested(void)
+{
+	uint32_t depth = 500, i;
+	char *input = nested(depth);
+	struct json_token *tokens = calloc(depth, sizeof(*tokens));
+	struct json_parser p = json_parse(input, tokens, depth);
+	TEST_ASSERT(p.error == JSON_OK);
+	TEST_ASSERT(p.tokenidx == depth);
+	TEST_ASSERT(p.textidx == 2 * depth);
+	for (i = 0; i < depth; i++) {
+		TEST_ASSERT(tokens[i].type == JSON_ARRAY);
+		TEST_ASSERT(tokens[i].start == i);
+		TEST_ASSERT(tokens[i].length == (i == depth - 1 ? 0 : 1));
+		TEST_ASSERT(tokens[i].next == 0);
+	}
+	free(tokens);
+	free(input);
+}
+
+static void test_too_deep(void)
+{
+	char *input = nested(1000000);
+	struct json_parser p = json_parse(input, NULL, 0);
+	TEST_ASSERT(p.error == JSONERR_TOO_DEEP);
+	free(input);
+}
+
 int main(void)
 {
 	UNITY_BEGIN();
@@ -191,6 +229,8 @@ int main(void)
 	RUN_TEST(test_no_comma);
 	RUN_TEST(test_get);
 	RUN_TEST(test_get_empty);
+	RUN_TEST(test_nested);
+	RUN_TEST(test_too_deep);
 
 	return UNITY_END();
 }
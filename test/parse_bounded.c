@@ -0,0 +1,143 @@
+/*
+ * test/parse_bounded.c: Parsing input which is not NUL-terminated
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include "nosj.h"
+#include "twitapi.h"
+
+void setUp(void)
+{
+	// set stuff up here
+}
+
+void tearDown(void)
+{
+	// clean stuff up here
+}
+
+/*
+ * Parse the first len bytes of input, copied to a buffer of exactly that size
+ * (so that the address sanitizer catches any read past the end), and check
+ * that the results match parsing a NUL-terminated copy.
+ */
+static void check_prefix(const char *input, uint32_t len,
+                         struct json_parser (*parse_n)(const char *, uint32_t,
+                                                       struct json_token *,
+                                                       uint32_t))
+{
+	char *exact = malloc(len ? len : 1);
+	char *terminated = malloc(len + 1);
+	struct json_token t1[64], t2[64];
+	struct json_parser p1, p2;
+
+	memcpy(exact, input, len);
+	memcpy(terminated, input, len);
+	terminated[len] = '\0';
+
+	p1 = json_parse(terminated, t1, 64);
+	p2 = parse_n(exact, len, t2, 64);
+	TEST_ASSERT_EQUAL(p1.error, p2.error);
+	TEST_ASSERT_EQUAL(p1.textidx, p2.textidx);
+	TEST_ASSERT_EQUAL(p1.tokenidx, p2.tokenidx);
+	if (p1.error == JSON_OK)
+		TEST_ASSERT(!memcmp(t1, t2, p1.tokenidx * sizeof(t1[0])));
+	free(exact);
+	free(terminated);
+}
+
+static const char *doc = "{\"a\": [1, -2.5e+3, true, false, null],"
+                         " \"b\\u00e9\": \"x\\\"y\", \"c\": {}}";
+
+static void test_every_prefix(void)
+{
+	for (uint32_t len = 0; len <= strlen(doc); len++)
+		check_prefix(doc, len, json_parse_n);
+}
+
+static void test_every_prefix_indexed(void)
+{
+	for (uint32_t len = 0; len <= strlen(doc); len++)
+		check_prefix(doc, len, json_parse_indexed_n);
+}
+
+static void test_premature_eof(void)
+{
+	struct json_parser p;
+
+	p = json_parse_n("[1, 2]", 5, NULL, 0);
+	TEST_ASSERT_EQUAL(JSONERR_MISSING_COMMA, p.error);
+	p = json_parse_n("\"abc\"", 4, NULL, 0);
+	TEST_ASSERT_EQUAL(JSONERR_PREMATURE_EOF, p.error);
+	p = json_parse_n("{\"a\": 1}", 6, NULL, 0);
+	TEST_ASSERT_EQUAL(JSONERR_PREMATURE_EOF, p.error);
+	p = json_parse_indexed_n("\"abc\"", 4, NULL, 0);
+	TEST_ASSERT_EQUAL(JSONERR_PREMATURE_EOF, p.error);
+}
+
+static void test_trailing_bytes_ignored(void)
+{
+	// Bytes past the length, even invalid ones, are never looked at
+	struct json_parser p = json_parse_n("[1234]xyz", 6, NULL, 0);
+	TEST_ASSERT_EQUAL(JSON_OK, p.error);
+	TEST_ASSERT_EQUAL(6, p.textidx);
+	p = json_parse_n("12345", 3, NULL, 0);
+	TEST_ASSERT_EQUAL(JSON_OK, p.error);
+	TEST_ASSERT_EQUAL(3, p.textidx);
+}
+
+/*
+ * Only compact tokens limit the input length.  It is checked before reading
+ * any of the text, so a short buffer will do.
+ */
+static void test_too_long(void)
+{
+	struct json_lazy lz;
+	struct json_parser p;
+
+	if (NOSJ_MAX_INPUT == UINT32_MAX)
+		return;
+	TEST_ASSERT_EQUAL(12, sizeof(struct json_token));
+	p = json_parse_n("[1]", NOSJ_MAX_INPUT + 1, NULL, 0);
+	TEST_ASSERT_EQUAL(JSONERR_NOMEM, p.error);
+	json_lazy_init(&lz, "[1]", NOSJ_MAX_INPUT + 1);
+	TEST_ASSERT_EQUAL(JSONERR_NOMEM, json_lazy_parse(&lz));
+	json_lazy_destroy(&lz);
+	p = json_parse_n("[1]", NOSJ_MAX_INPUT, NULL, 0);
+	TEST_ASSERT_EQUAL(JSON_OK, p.error);
+}
+
+static void test_easy_n(void)
+{
+	uint32_t len = strlen(twitapi_json), index;
+	char *copy = malloc(len);
+	struct json_easy *easy;
+	char *string;
+
+	memcpy(copy, twitapi_json, len);
+	easy = json_easy_new_n(copy, len);
+	TEST_ASSERT(!json_easy_parse(easy));
+	TEST_ASSERT(!json_easy_lookup(easy, 0, "user.name", &index));
+	TEST_ASSERT(!json_easy_string_get(easy, index, &string));
+	TEST_ASSERT_EQUAL_STRING("Twitter API", string);
+	free(string);
+	json_easy_free(easy);
+	free(copy);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+
+	RUN_TEST(test_every_prefix);
+	RUN_TEST(test_every_prefix_indexed);
+	RUN_TEST(test_premature_eof);
+	RUN_TEST(test_trailing_bytes_ignored);
+	RUN_TEST(test_too_long);
+	RUN_TEST(test_easy_n);
+
+	return UNITY_END();
+}
@@ -0,0 +1,148 @@
+/*
+ * test/parse_indexed.c: json_parse_indexed() must agree with json_parse()
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include "nosj.h"
+#include "twitapi.h"
+
+void setUp(void)
+{
+	// set stuff up here
+}
+
+void tearDown(void)
+{
+	// clean stuff up here
+}
+
+static void check_same(const char *input)
+{
+	struct json_parser p1 = json_parse(input, NULL, 0);
+	struct json_parser p2 = json_parse_indexed(input, NULL, 0);
+	struct json_token *t1, *t2;
+	uint32_t n = p1.tokenidx;
+
+	TEST_ASSERT_EQUAL(p1.error, p2.error);
+	TEST_ASSERT_EQUAL(p1.textidx, p2.textidx);
+	TEST_ASSERT_EQUAL(p1.tokenidx, p2.tokenidx);
+	if (p1.error != JSON_OK)
+		return;
+
+	t1 = calloc(n, sizeof(*t1));
+	t2 = calloc(n, sizeof(*t2));
+	json_parse(input, t1, n);
+	p2 = json_parse_indexed(input, t2, n);
+	TEST_ASSERT_EQUAL(p1.tokenidx, p2.tokenidx);
+	for (uint32_t i = 0; i < n; i++) {
+		TEST_ASSERT_EQUAL(t1[i].type, t2[i].type);
+		TEST_ASSERT_EQUAL(t1[i].start, t2[i].start);
+		TEST_ASSERT_EQUAL(t1[i].length, t2[i].length);
+		TEST_ASSERT_EQUAL(t1[i].next, t2[i].next);
+	}
+	free(t1);
+	free(t2);
+}
+
+static void test_atomics(void)
+{
+	check_same("true");
+	check_same("false");
+	check_same("null");
+	check_same("  -12.5e+3  ");
+	check_same("\"hello\"");
+	check_same("tru");
+	check_same("truex");
+	check_same("");
+	check_same("   ");
+}
+
+static void test_containers(void)
+{
+	check_same("{}");
+	check_same("[]");
+	check_same("[ 1 , 2 , [3, {\"a\" : [true, false, null]}], \"x\" ]");
+	check_same("{\"a\": 1, \"b\": {\"c\": [1, 2, 3]}, \"d\": \"e\"}");
+	check_same("[1,]");
+	check_same("{\"a\": 1,}");
+	check_same("[1, 2] trailing garbage");
+}
+
+static void test_errors(void)
+{
+	check_same("[1, 2");
+	check_same("[1 2]");
+	check_same("[1x]");
+	check_same("[truex]");
+	check_same("{\"a\" 1}");
+	check_same("{1: 2}");
+	check_same("{\"a\": }");
+	check_same("[\"abc");
+	check_same("[\"a\\qb\"]");
+	check_same("[\"a\"x]");
+	check_same("[\\\"a\"]");
+	check_same("[-]");
+	check_same("[01]");
+	check_same("[\"\\ud800\"]");
+}
+
+static void test_escapes_across_blocks(void)
+{
+	char buf[512];
+
+	// Put quotes and runs of backslashes at every offset around a block
+	// boundary, so that the carried state is exercised.
+	for (int pad = 0; pad < 70; pad++) {
+		for (int nbs = 0; nbs < 5; nbs++) {
+			int i = 0;
+			buf[i++] = '[';
+			for (int j = 0; j < pad; j++)
+				buf[i++] = ' ';
+			buf[i++] = '"';
+			for (int j = 0; j < nbs; j++)
+				buf[i++] = '\\';
+			strcpy(buf + i, "\"x\", \"y\\\"z\" ,{\"k\":[1,2]}]");
+			check_same(buf);
+		}
+	}
+}
+
+static void test_long_strings(void)
+{
+	size_t len = 100000;
+	char *buf = malloc(len + 16);
+
+	buf[0] = '[';
+	buf[1] = '"';
+	for (size_t i = 2; i < len; i++)
+		buf[i] = (i % 97 == 0) ? ' ' : 'a' + i % 26;
+	strcpy(buf + len, "\", 1]");
+	check_same(buf);
+
+	// the same string, unterminated
+	buf[len] = '\0';
+	check_same(buf);
+	free(buf);
+}
+
+static void test_twitapi(void)
+{
+	check_same(twitapi_json);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+
+	RUN_TEST(test_atomics);
+	RUN_TEST(test_containers);
+	RUN_TEST(test_errors);
+	RUN_TEST(test_escapes_across_blocks);
+	RUN_TEST(test_long_strings);
+	RUN_TEST(test_twitapi);
+
+	return UNITY_END();
+}
@@ -356,6 +356,153 @@ static void test_double_digit_exp(void)
 	TEST_ASSERT(1e23 == number);
 }
 
+/*
+ * Numbers which are hard to round correctly, or are near the limits of double
+ * precision.  The compiler rounds the literals correctly.
+ */
+static void test_correct_rounding(void)
+{
+	static const struct {
+		const char *input;
+		double expected;
+	} cases[] = {
+		{ "0.1", 0.1 },
+		{ "9007199254740993", 9007199254740992.0 },
+		{ "9007199254740995", 9007199254740996.0 },
+		{ "0.1000000000000000055511151231257827021181583404541015625",
+		  0.1 },
+		{ "1.00000000000000011102230246251565404236316680908203125",
+		  1.0 },
+		{ "1.00000000000000011102230246251565404236316680908203126",
+		  1.0000000000000002 },
+		{ "123456789012345678901234567890", 1.2345678901234568e29 },
+		{ "2.2250738585072011e-308", 2.2250738585072011e-308 },
+		{ "4.9406564584124654e-324", 4.9406564584124654e-324 },
+		{ "2.4703282292062328e-324", 4.9406564584124654e-324 },
+		{ "2.4703282292062327e-324", 0.0 },
+		{ "1e-400", 0.0 },
+		{ "1.7976931348623157e308", 1.7976931348623157e308 },
+		{ "-1.5e300", -1.5e300 },
+		{ "7.3177701707893310e+15", 7.3177701707893310e+15 },
+	};
+	struct json_token tokens[1];
+	double number;
+
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		json_parse(cases[i].input, tokens, 1);
+		TEST_ASSERT(!json_number_get(cases[i].input, tokens, 0,
+		                             &number));
+		TEST_ASSERT(cases[i].expected == number);
+	}
+
+	json_parse("1.7976931348623159e308", tokens, 1);
+	TEST_ASSERT(!json_number_get("1.7976931348623159e308", tokens, 0,
+	                             &number));
+	TEST_ASSERT(number > 1.7976931348623157e308);
+	json_parse("-1e-400", tokens, 1);
+	TEST_ASSERT(!json_number_get("-1e-400", tokens, 0, &number));
+	TEST_ASSERT(number == 0.0 && 1 / number < 0);
+}
+
+static void test_integer_range(void)
+{
+	char input[] = "[9223372036854775807, -9223372036854775808, "
+	               "9223372036854775808, 18446744073709551615, "
+	               "18446744073709551616]";
+	uint32_t ntok = 6;
+	struct json_token tokens[ntok];
+	struct json_parser p = json_parse(input, tokens, ntok);
+	int64_t dst_int;
+	uint64_t dst_uint;
+	double number;
+	TEST_ASSERT(p.error == JSON_OK);
+	TEST_ASSERT(!json_number_getint(input, tokens, 1, &dst_int));
+	TEST_ASSERT(INT64_MAX == dst_int);
+	TEST_ASSERT(!json_number_getint(input, tokens, 2, &dst_int));
+	TEST_ASSERT(INT64_MIN == dst_int);
+	TEST_ASSERT(JSONERR_NOT_INT ==
+	            json_number_getuint(input, tokens, 2, &dst_uint));
+	TEST_ASSERT(JSONERR_NOT_INT ==
+	            json_number_getint(input, tokens, 3, &dst_int));
+	TEST_ASSERT(!json_number_getuint(input, tokens, 3, &dst_uint));
+	TEST_ASSERT(9223372036854775808ull == dst_uint);
+	TEST_ASSERT(!json_number_getuint(input, tokens, 4, &dst_uint));
+	TEST_ASSERT(UINT64_MAX == dst_uint);
+	TEST_ASSERT(JSONERR_NOT_INT ==
+	            json_number_getuint(input, tokens, 5, &dst_uint));
+	// The token ends before the comma.
+	TEST_ASSERT(!json_number_get(input, tokens, 1, &number));
+	TEST_ASSERT(9223372036854775807.0 == number);
+}
+
+/*
+ * Values decoded while parsing must agree with those read from the text.
+ */
+static void test_int_table(void)
+{
+	char input[] = "[0, -0, 12, -12, 1.5, 1e2, 10.0, -1E0, "
+	               "9223372036854775807, -9223372036854775808, "
+	               "18446744073709551615, 18446744073709551616, "
+	               "-18446744073709551615, {\"a\": 7}, \"3\", 70]";
+	uint32_t ntok = 19;
+	struct json_token tokens[ntok];
+	struct json_int ints[ntok];
+	struct json_parser p = json_parse_ints_n(input, sizeof(input) - 1,
+	                                         tokens, ints, ntok);
+	int64_t i1, i2;
+	uint64_t u1, u2;
+	int rv;
+
+	TEST_ASSERT(p.error == JSON_OK);
+	TEST_ASSERT(ntok == p.tokenidx);
+	for (uint32_t i = 0; i < ntok; i++) {
+		rv = json_number_getint(input, tokens, i, &i1);
+		TEST_ASSERT_EQUAL(rv, json_int_get(tokens, ints, i, &i2));
+		if (rv == JSON_OK)
+			TEST_ASSERT(i1 == i2);
+		rv = json_number_getuint(input, tokens, i, &u1);
+		TEST_ASSERT_EQUAL(rv, json_int_getuint(tokens, ints, i, &u2));
+		if (rv == JSON_OK)
+			TEST_ASSERT(u1 == u2);
+	}
+	TEST_ASSERT(!json_int_get(tokens, ints, 18, &i2));
+	TEST_ASSERT(70 == i2);
+	TEST_ASSERT(JSONERR_TYPE == json_int_get(tokens, ints, 17, &i2));
+
+	// A short buffer is not written past, and the count is still right.
+	p = json_parse_ints_n(input, sizeof(input) - 1, tokens, ints, 4);
+	TEST_ASSERT(p.error == JSON_OK);
+	TEST_ASSERT(ntok == p.tokenidx);
+}
+
+/*
+ * The easy interface keeps the values along with the tokens (and hashes) as
+ * they are reallocated.
+ */
+static void test_int_table_easy(void)
+{
+	char input[2 * 1000 + 1];
+	struct json_easy easy;
+	uint32_t tok, n = 0;
+	int64_t value;
+
+	input[0] = '[';
+	for (int i = 0; i < 1000; i++) {
+		input[2 * i + 1] = '0' + i % 10;
+		input[2 * i + 2] = i < 999 ? ',' : ']';
+	}
+	json_easy_init_n(&easy, input, sizeof(input));
+	TEST_ASSERT(!json_easy_parse_hashed(&easy));
+	TEST_ASSERT(!json_easy_parse_ints(&easy));
+	TEST_ASSERT(easy.ints != NULL);
+	json_easy_for_each(tok, &easy, 0) {
+		TEST_ASSERT(!json_easy_number_getint(&easy, tok, &value));
+		TEST_ASSERT(n++ % 10 == value);
+	}
+	TEST_ASSERT(1000 == n);
+	json_easy_destroy(&easy);
+}
+
 int main(void)
 {
 	UNITY_BEGIN();
@@ -379,6 +526,10 @@ int main(void)
 	RUN_TEST(test_zero_exp);
 	RUN_TEST(test_double_digit_decimal);
 	RUN_TEST(test_double_digit_exp);
+	RUN_TEST(test_correct_rounding);
+	RUN_TEST(test_integer_range);
+	RUN_TEST(test_int_table);
+	RUN_TEST(test_int_table_easy);
 
 	return UNITY_END();
 }
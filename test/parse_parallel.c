@@ -0,0 +1,119 @@
+/*
+ * test/parse_parallel.c: json_easy_parse_parallel() must agree with
+ * json_easy_parse()
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include "nosj.h"
+
+void setUp(void)
+{
+	// set stuff up here
+}
+
+void tearDown(void)
+{
+	// clean stuff up here
+}
+
+static void check_same(const char *input, unsigned int nthreads)
+{
+	struct json_easy serial, parallel;
+	int rv1, rv2;
+
+	json_easy_init(&serial, input);
+	json_easy_init(&parallel, input);
+	rv1 = json_easy_parse(&serial);
+	rv2 = json_easy_parse_parallel(&parallel, nthreads);
+	TEST_ASSERT_EQUAL(rv1, rv2);
+	TEST_ASSERT_EQUAL(serial.tokens_len, parallel.tokens_len);
+	// On errors there are no tokens, and the buffers may be null.
+	if (serial.tokens_len)
+		TEST_ASSERT(!memcmp(serial.tokens, parallel.tokens,
+		                    serial.tokens_len *
+		                            sizeof(struct json_token)));
+	json_easy_destroy(&serial);
+	json_easy_destroy(&parallel);
+}
+
+/*
+ * Build an array of about 2MB, with elements from the given format (which
+ * takes the element number up to three times).
+ */
+static char *make_array(const char *fmt, const char *sep, const char *close)
+{
+	size_t cap = 3 << 20, len = 0;
+	char *buf = malloc(cap);
+
+	len += sprintf(buf, "[");
+	for (unsigned int i = 0; len < (2 << 20); i++) {
+		if (i)
+			len += sprintf(buf + len, "%s", sep);
+		len += sprintf(buf + len, fmt, i, i, i);
+	}
+	sprintf(buf + len, "%s", close);
+	return buf;
+}
+
+static void check_array(const char *fmt, const char *sep, const char *close)
+{
+	char *input = make_array(fmt, sep, close);
+	check_same(input, 2);
+	check_same(input, 7);
+	check_same(input, 16);
+	free(input);
+}
+
+static void test_objects(void)
+{
+	check_array("\n  {\"id\": %u, \"tags\": [\"a\", \"b\"], \"n\": {\"x\": %u}}",
+	            ",", "\n]\n");
+	check_array("{\"id\":%u,\"v\":[{\"a\":%u},{\"b\":%u}]}", ",", "]");
+}
+
+static void test_scalars(void)
+{
+	check_array("%u", ", ", "]");
+	check_array("\"%u, %u, %u\"", ", ", "]");
+	check_array("[%u, [%u, %u]]", ",", "]");
+}
+
+static void test_trailing_comma(void)
+{
+	check_array("{\"id\": %u}", ", ", ", ]");
+}
+
+static void test_errors(void)
+{
+	check_array("{\"id\": %u}", ", ", "");
+	check_array("{\"id\": %u}", ", ", " {\"id\": 0}]");
+	check_array("{\"id\": %u}", ", ", ", , ]");
+	check_array("{\"id\": %u}", ", ", ", 1x]");
+}
+
+static void test_not_array(void)
+{
+	char *input = make_array("\"k%u\": %u", ", ", "}");
+	input[0] = '{';
+	check_same(input, 4);
+	check_same("[1, 2, 3]", 4);
+	check_same("", 4);
+	free(input);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+
+	RUN_TEST(test_objects);
+	RUN_TEST(test_scalars);
+	RUN_TEST(test_trailing_comma);
+	RUN_TEST(test_errors);
+	RUN_TEST(test_not_array);
+
+	return UNITY_END();
+}
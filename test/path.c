@@ -0,0 +1,471 @@
+/*
+ * test/path.c: Compiled lookup expressions must agree with json_lookup()
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include "nosj.h"
+#include "twitapi.h"
+
+static const char *exprs[] = {
+	"favorited",
+	"user",
+	"user.entities.url.urls[0].indices[1]",
+	"user.entities.url.urls[0].indices[2]",
+	"user.entities.url.urls[0].indices",
+	"contributors[0]",
+	"contributors[1]",
+	"user.foobar",
+	"user.foobar.x",
+	"user.foobar[0]",
+	"user.name.first",
+	"user[0]",
+	"favorited.x",
+	"entities.urls[2]",
+	"foobar",
+	"",
+};
+#define NEXPRS (sizeof(exprs) / sizeof(exprs[0]))
+
+void setUp(void)
+{
+	// set stuff up here
+}
+
+void tearDown(void)
+{
+	// clean stuff up here
+}
+
+static void check_paths(struct json_easy *easy)
+{
+	for (size_t i = 0; i < NEXPRS; i++) {
+		struct json_path *path;
+		uint32_t r1 = 0, r2 = 0, r3 = 0;
+		int rv1, rv2, rv3;
+
+		TEST_ASSERT_EQUAL(JSON_OK,
+		                  json_path_compile(exprs[i], &path, NULL));
+		rv1 = json_lookup(easy->input, easy->tokens, 0, exprs[i], &r1);
+		rv2 = json_path_eval(path, easy->input, easy->tokens, 0, &r2);
+		rv3 = json_easy_path_eval(easy, path, 0, &r3);
+		TEST_ASSERT_EQUAL(rv1, rv2);
+		TEST_ASSERT_EQUAL(r1, r2);
+		TEST_ASSERT_EQUAL(rv1, rv3);
+		TEST_ASSERT_EQUAL(r1, r3);
+		if (easy->index) {
+			rv3 = json_index_path_eval(easy->index, path, 0, &r3);
+			TEST_ASSERT_EQUAL(rv1, rv3);
+			TEST_ASSERT_EQUAL(r1, r3);
+		}
+		json_path_free(path);
+	}
+}
+
+static void test_eval(void)
+{
+	struct json_easy easy;
+
+	json_easy_init(&easy, twitapi_json);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_parse(&easy));
+	check_paths(&easy);
+	json_easy_destroy(&easy);
+
+	// Again, with key hashes and an index.
+	json_easy_init(&easy, twitapi_json);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_parse_hashed(&easy));
+	check_paths(&easy);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_index(&easy, SIZE_MAX));
+	check_paths(&easy);
+	json_easy_destroy(&easy);
+}
+
+/*
+ * A set of all the paths (and some repeats) must give each path's own result.
+ */
+static void check_set(struct json_easy *easy)
+{
+	const size_t n = NEXPRS;
+	struct json_path *paths[2 * NEXPRS];
+	struct json_path_set *set;
+	uint32_t results[2 * NEXPRS], r;
+	int errors[2 * NEXPRS], rv, first = JSON_OK;
+
+	for (size_t i = 0; i < 2 * n; i++)
+		TEST_ASSERT_EQUAL(JSON_OK, json_path_compile(exprs[i % n],
+		                                             &paths[i], NULL));
+	TEST_ASSERT_EQUAL(JSON_OK, json_path_set_build(paths, 2 * n, &set));
+	rv = json_easy_path_set_eval(easy, set, 0, results, errors);
+	for (size_t i = 0; i < 2 * n; i++) {
+		int rv1 = json_path_eval(paths[i], easy->input, easy->tokens, 0,
+		                         &r);
+		TEST_ASSERT_EQUAL(rv1, errors[i]);
+		TEST_ASSERT_EQUAL(r, results[i]);
+		if (first == JSON_OK)
+			first = rv1;
+	}
+	TEST_ASSERT_EQUAL(first, rv);
+	memset(results, 0, sizeof(results));
+	TEST_ASSERT_EQUAL(rv, json_path_set_eval(set, easy->input,
+	                                         easy->tokens, 0, results,
+	                                         errors));
+	for (size_t i = 0; i < 2 * n; i++) {
+		json_path_eval(paths[i], easy->input, easy->tokens, 0, &r);
+		TEST_ASSERT_EQUAL(r, results[i]);
+	}
+	if (easy->index) {
+		memset(results, 0, sizeof(results));
+		TEST_ASSERT_EQUAL(rv, json_index_path_set_eval(easy->index, set,
+		                                               0, results,
+		                                               errors));
+		for (size_t i = 0; i < 2 * n; i++) {
+			json_path_eval(paths[i], easy->input, easy->tokens, 0,
+			               &r);
+			TEST_ASSERT_EQUAL(r, results[i]);
+		}
+	}
+	json_path_set_free(set);
+	for (size_t i = 0; i < 2 * n; i++)
+		json_path_free(paths[i]);
+}
+
+static void test_set(void)
+{
+	struct json_easy easy;
+
+	json_easy_init(&easy, twitapi_json);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_parse(&easy));
+	check_set(&easy);
+	json_easy_destroy(&easy);
+
+	json_easy_init(&easy, twitapi_json);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_parse_hashed(&easy));
+	check_set(&easy);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_index(&easy, SIZE_MAX));
+	check_set(&easy);
+	json_easy_destroy(&easy);
+}
+
+/*
+ * A set over a small document must agree with json_path_eval() for each path,
+ * with and without an index.
+ */
+static void check_set_doc(const char *doc, const char **list, size_t n)
+{
+	struct json_path *paths[8];
+	struct json_path_set *set;
+	struct json_easy easy;
+	uint32_t results[8], r;
+	int errors[8], rv;
+
+	json_easy_init(&easy, doc);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_parse_hashed(&easy));
+	for (size_t i = 0; i < n; i++)
+		TEST_ASSERT_EQUAL(JSON_OK,
+		                  json_path_compile(list[i], &paths[i], NULL));
+	TEST_ASSERT_EQUAL(JSON_OK, json_path_set_build(paths, n, &set));
+	for (int pass = 0; pass < 2; pass++) {
+		if (pass)
+			TEST_ASSERT_EQUAL(JSON_OK,
+			                  json_easy_index(&easy, SIZE_MAX));
+		json_easy_path_set_eval(&easy, set, 0, results, errors);
+		for (size_t i = 0; i < n; i++) {
+			rv = json_path_eval(paths[i], doc, easy.tokens, 0, &r);
+			TEST_ASSERT_EQUAL(rv, errors[i]);
+			TEST_ASSERT_EQUAL(r, results[i]);
+		}
+	}
+	json_path_set_free(set);
+	for (size_t i = 0; i < n; i++)
+		json_path_free(paths[i]);
+	json_easy_destroy(&easy);
+}
+
+/*
+ * Empty objects and arrays have no members, whatever follows them.
+ */
+static void test_set_empty(void)
+{
+	check_set_doc("{\"a\": {}, \"x\": 1}",
+	              (const char *[]){ "a.x", "a", "x" }, 3);
+	check_set_doc("[[], 1]", (const char *[]){ "[0][0]", "[1]" }, 2);
+	check_set_doc("{\"a\": [], \"b\": {}, \"c\": [{}, 2]}",
+	              (const char *[]){ "a[0]", "a[1]", "b.c", "c[0].c",
+	                                "c[1]", "c[0]" },
+	              6);
+}
+
+/*
+ * Many keys of one object, more than are looked up in one scan, with
+ * duplicates and escapes in the document.
+ */
+static void test_set_wide(void)
+{
+	struct json_path *paths[150];
+	struct json_path_set *set;
+	uint32_t results[150], r;
+	int errors[150];
+	static char doc[1 << 16];
+	char expr[32];
+	size_t len = 0;
+	struct json_easy easy;
+
+	len += sprintf(doc, "{\"d\\u0075p\": 1, \"dup\": 2, ");
+	for (int i = 0; i < 140; i++)
+		len += sprintf(doc + len, "\"k%d\": [%d, {\"a\": %d}], ", i, i,
+		               i);
+	sprintf(doc + len, "\"k7\": null}");
+	json_easy_init(&easy, doc);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_parse(&easy));
+
+	for (int i = 0; i < 150; i++) {
+		if (i == 0)
+			strcpy(expr, "dup");
+		else if (i % 3)
+			sprintf(expr, "k%d[%d]", i, i % 2);
+		else
+			sprintf(expr, "k%d[1].a", i);
+		TEST_ASSERT_EQUAL(JSON_OK, json_path_compile(expr, &paths[i],
+		                                             NULL));
+	}
+	TEST_ASSERT_EQUAL(JSON_OK, json_path_set_build(paths, 150, &set));
+	TEST_ASSERT_EQUAL(JSONERR_LOOKUP, json_easy_path_set_eval(&easy, set, 0,
+	                                                          results,
+	                                                          errors));
+	TEST_ASSERT_EQUAL(2, results[0]);
+	for (int i = 0; i < 150; i++) {
+		int rv = json_path_eval(paths[i], doc, easy.tokens, 0, &r);
+		TEST_ASSERT_EQUAL(rv, errors[i]);
+		TEST_ASSERT_EQUAL(r, results[i]);
+	}
+	json_path_set_free(set);
+	for (int i = 0; i < 150; i++)
+		json_path_free(paths[i]);
+	json_easy_destroy(&easy);
+}
+
+static const char *query_doc =
+	"{\"items\": [{\"id\": 1, \"tags\": [\"a\", \"b\"]}, {\"name\": \"x\"},"
+	" {\"id\": 3, \"sub\": {\"id\": 4}}], \"id\": 0}";
+
+/*
+ * A query must match the tokens of the given json_lookup() expressions, in
+ * order (the list ends with NULL).
+ */
+static void check_query(struct json_easy *easy, const char *query,
+                        const char **expected)
+{
+	struct json_path *path;
+	uint32_t out[8], count, r;
+	size_t n = 0;
+
+	TEST_ASSERT_EQUAL(JSON_OK, json_path_compile(query, &path, NULL));
+	TEST_ASSERT_EQUAL(JSON_OK, json_path_select(path, easy->input,
+	                                            easy->tokens, 0, out, 8,
+	                                            &count));
+	for (; expected[n]; n++) {
+		TEST_ASSERT_EQUAL(JSON_OK, json_easy_lookup(easy, 0,
+		                                            expected[n], &r));
+		TEST_ASSERT_EQUAL(r, out[n]);
+	}
+	TEST_ASSERT_EQUAL(n, count);
+	memset(out, 0, sizeof(out));
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_path_select(easy, path, 0, out, 8,
+	                                                 &count));
+	TEST_ASSERT_EQUAL(n, count);
+	for (n = 0; expected[n]; n++) {
+		json_easy_lookup(easy, 0, expected[n], &r);
+		TEST_ASSERT_EQUAL(r, out[n]);
+	}
+	json_path_free(path);
+}
+
+static void check_queries(struct json_easy *easy)
+{
+	check_query(easy, "items[*].id",
+	            (const char *[]){ "items[0].id", "items[2].id", NULL });
+	check_query(easy, "..id",
+	            (const char *[]){ "id", "items[0].id", "items[2].id",
+	                              "items[2].sub.id", NULL });
+	check_query(easy, "..[0]",
+	            (const char *[]){ "items[0]", "items[0].tags[0]", NULL });
+	check_query(easy, "items[0].*",
+	            (const char *[]){ "items[0].id", "items[0].tags", NULL });
+	check_query(easy, "items[0].tags[*]",
+	            (const char *[]){ "items[0].tags[0]", "items[0].tags[1]",
+	                              NULL });
+	check_query(easy, "items[1:]",
+	            (const char *[]){ "items[1]", "items[2]", NULL });
+	check_query(easy, "items[:1]", (const char *[]){ "items[0]", NULL });
+	check_query(easy, "items[1:2].name",
+	            (const char *[]){ "items[1].name", NULL });
+	check_query(easy, "items[0:0]", (const char *[]){ NULL });
+	check_query(easy, "items[5:]", (const char *[]){ NULL });
+	check_query(easy, "id[*]", (const char *[]){ NULL });
+	// Without wildcards, a query is just a lookup.
+	check_query(easy, "items[2].sub",
+	            (const char *[]){ "items[2].sub", NULL });
+	check_query(easy, "items[2].foo", (const char *[]){ NULL });
+}
+
+/*
+ * Wildcards on empty objects and arrays match nothing.
+ */
+static void test_query_empty(void)
+{
+	static const struct {
+		const char *doc, *query, *expected[3];
+	} cases[] = {
+		{ "[[], 1]", "[*][*]", { NULL } },
+		{ "{\"a\": [], \"b\": {}}", "*.*", { NULL } },
+		{ "[1, {}]", "[1].*", { NULL } },
+		{ "[{}, []]", "..*", { "[0]", "[1]", NULL } },
+	};
+	struct json_easy easy;
+
+	for (size_t i = 0; i < 2 * sizeof(cases) / sizeof(cases[0]); i++) {
+		size_t c = i / 2;
+		json_easy_init(&easy, cases[c].doc);
+		TEST_ASSERT_EQUAL(JSON_OK, json_easy_parse_hashed(&easy));
+		// Every other time, with an index.
+		if (i % 2)
+			TEST_ASSERT_EQUAL(JSON_OK,
+			                  json_easy_index(&easy, SIZE_MAX));
+		check_query(&easy, cases[c].query,
+		            (const char **)cases[c].expected);
+		json_easy_destroy(&easy);
+	}
+}
+
+static int stop_at_second(uint32_t tok, void *arg)
+{
+	uint32_t *seen = arg;
+	(void)tok;
+	return ++*seen == 2 ? 7 : 0;
+}
+
+static void test_query(void)
+{
+	struct json_easy easy;
+	struct json_path *path;
+	struct json_path_set *set;
+	uint32_t out[1], count, r, seen = 0;
+
+	json_easy_init(&easy, query_doc);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_parse(&easy));
+	check_queries(&easy);
+
+	TEST_ASSERT_EQUAL(JSON_OK, json_path_compile("..id", &path, NULL));
+	// The buffer is filled as far as it goes, but every match is counted.
+	TEST_ASSERT_EQUAL(JSON_OK, json_path_select(path, query_doc,
+	                                            easy.tokens, 0, out, 1,
+	                                            &count));
+	TEST_ASSERT_EQUAL(4, count);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_lookup(&easy, 0, "id", &r));
+	TEST_ASSERT_EQUAL(r, out[0]);
+	TEST_ASSERT_EQUAL(7, json_path_query(path, query_doc, easy.tokens, 0,
+	                                     stop_at_second, &seen));
+	TEST_ASSERT_EQUAL(2, seen);
+	// Queries can't be evaluated as single lookups.
+	TEST_ASSERT_EQUAL(JSONERR_BAD_EXPR,
+	                  json_path_eval(path, query_doc, easy.tokens, 0, &r));
+	TEST_ASSERT_EQUAL(4, r);
+	TEST_ASSERT_EQUAL(JSONERR_BAD_EXPR,
+	                  json_path_set_build(&path, 1, &set));
+	json_path_free(path);
+	TEST_ASSERT_EQUAL(JSON_OK, json_path_compile("items[*].id", &path,
+	                                             NULL));
+	TEST_ASSERT_EQUAL(JSONERR_BAD_EXPR,
+	                  json_path_eval(path, query_doc, easy.tokens, 0, &r));
+	TEST_ASSERT_EQUAL(7, r);
+	json_path_free(path);
+	json_easy_destroy(&easy);
+
+	// Again, with key hashes and an index.
+	json_easy_init(&easy, query_doc);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_parse_hashed(&easy));
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_index(&easy, SIZE_MAX));
+	check_queries(&easy);
+	json_easy_destroy(&easy);
+}
+
+static void test_relative(void)
+{
+	struct json_easy easy;
+	struct json_path *path;
+	uint32_t user, r;
+
+	json_easy_init(&easy, twitapi_json);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_parse(&easy));
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_lookup(&easy, 0, "user", &user));
+	TEST_ASSERT_EQUAL(JSON_OK, json_path_compile("[1][0]", &path, NULL));
+	TEST_ASSERT_EQUAL(JSONERR_TYPE, json_easy_path_eval(&easy, path, user,
+	                                                     &r));
+	TEST_ASSERT_EQUAL(2, r);
+	json_path_free(path);
+	TEST_ASSERT_EQUAL(JSON_OK, json_path_compile("name", &path, NULL));
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_path_eval(&easy, path, user, &r));
+	TEST_ASSERT_EQUAL(JSON_STRING, easy.tokens[r].type);
+	json_path_free(path);
+	// Indices too large for 32 bits are out of bounds (not truncated).
+	TEST_ASSERT_EQUAL(JSON_OK, json_path_compile("contributors[4294967296]",
+	                                             &path, NULL));
+	TEST_ASSERT_EQUAL(JSONERR_INDEX, json_easy_path_eval(&easy, path, 0,
+	                                                      &r));
+	TEST_ASSERT_EQUAL(23, r);
+	json_path_free(path);
+	json_easy_destroy(&easy);
+}
+
+static void test_syntax_errors(void)
+{
+	struct json_path *path = NULL;
+	uint32_t erridx, r;
+
+	TEST_ASSERT_EQUAL(JSONERR_BAD_EXPR,
+	                  json_path_compile("user.entities.url.urls[0]indices",
+	                                    &path, &erridx));
+	TEST_ASSERT_EQUAL(25, erridx);
+	// json_lookup() agrees
+	TEST_ASSERT_EQUAL(JSONERR_BAD_EXPR,
+	                  json_lookup(twitapi_json, NULL, 0, "[1a]", &r));
+	TEST_ASSERT_EQUAL(JSONERR_BAD_EXPR,
+	                  json_path_compile("[1a]", &path, &erridx));
+	TEST_ASSERT_EQUAL(r, erridx);
+	TEST_ASSERT_EQUAL(JSONERR_BAD_EXPR,
+	                  json_path_compile("a[-1]", &path, &erridx));
+	TEST_ASSERT_EQUAL(2, erridx);
+	TEST_ASSERT_EQUAL(JSONERR_BAD_EXPR,
+	                  json_path_compile("a[1", &path, &erridx));
+	TEST_ASSERT_EQUAL(3, erridx);
+	TEST_ASSERT_EQUAL(JSONERR_BAD_EXPR,
+	                  json_path_compile("a[]", &path, NULL));
+	TEST_ASSERT(path == NULL);
+	TEST_ASSERT_EQUAL(JSONERR_BAD_EXPR,
+	                  json_path_compile("a[1:2", &path, &erridx));
+	TEST_ASSERT_EQUAL(5, erridx);
+	TEST_ASSERT_EQUAL(JSONERR_BAD_EXPR,
+	                  json_path_compile("a[*", &path, &erridx));
+	TEST_ASSERT_EQUAL(2, erridx);
+	TEST_ASSERT_EQUAL(JSONERR_BAD_EXPR,
+	                  json_path_compile("a[1:-1]", &path, &erridx));
+	TEST_ASSERT_EQUAL(4, erridx);
+	TEST_ASSERT(path == NULL);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_eval);
+	RUN_TEST(test_set);
+	RUN_TEST(test_set_wide);
+	RUN_TEST(test_set_empty);
+	RUN_TEST(test_query);
+	RUN_TEST(test_query_empty);
+	RUN_TEST(test_relative);
+	RUN_TEST(test_syntax_errors);
+	return UNITY_END();
+}
@@ -0,0 +1,217 @@
+/*
+ * test/project.c: Projected parsing must select what json_parse() + paths do
+ */
+
+#include <string.h>
+#include <unity.h>
+
+#include "nosj.h"
+#include "twitapi.h"
+
+void setUp(void)
+{
+	// set stuff up here
+}
+
+void tearDown(void)
+{
+	// clean stuff up here
+}
+
+#define NPATHS 7
+#define MAXMATCH 8
+
+static const char *exprs[NPATHS] = {
+	"user.id",
+	"entities.urls[*].url",
+	"entities.hashtags[0].indices[1]",
+	"user.entities.url",
+	"contributors[3]",
+	"id_str",
+	"user.entities.*.urls[:1]",
+};
+
+/*
+ * Check that two tokens are the same value, tokenized in full.
+ */
+static void check_same(const struct json_token *t1, uint32_t a,
+                       const struct json_token *t2, uint32_t b)
+{
+	bool object = t1[a].type == JSON_OBJECT;
+	uint32_t n = t1[a].length;
+
+	TEST_ASSERT_EQUAL(t1[a].type, t2[b].type);
+	TEST_ASSERT_EQUAL(t1[a].start, t2[b].start);
+	TEST_ASSERT_EQUAL(t1[a].length, t2[b].length);
+	if (!object && t1[a].type != JSON_ARRAY)
+		return;
+	a++;
+	b++;
+	for (uint32_t i = 0; i < n; i++) {
+		check_same(t1, a, t2, b);
+		if (object)
+			check_same(t1, a + 1, t2, b + 1);
+		a = t1[a].next;
+		b = t2[b].next;
+	}
+}
+
+static struct json_parser project(const char *doc, const char *expr,
+                                  struct json_token *tokens, uint32_t n)
+{
+	struct json_path *path;
+	struct json_parser p;
+
+	TEST_ASSERT_EQUAL(JSON_OK, json_path_compile(expr, &path, NULL));
+	p = json_parse_projected_n(doc, strlen(doc), &path, 1, tokens, n);
+	json_path_free(path);
+	return p;
+}
+
+/*
+ * Each path must match the same values in the projection as in the whole
+ * document.
+ */
+static void test_twitapi(void)
+{
+	struct json_path *paths[NPATHS];
+	struct json_easy easy, proj;
+	uint32_t m1[MAXMATCH], m2[MAXMATCH], c1, c2, r;
+	struct json_parser p;
+
+	json_easy_init(&easy, twitapi_json);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_parse(&easy));
+	for (int i = 0; i < NPATHS; i++)
+		TEST_ASSERT_EQUAL(JSON_OK,
+		                  json_path_compile(exprs[i], &paths[i], NULL));
+	json_easy_init(&proj, twitapi_json);
+	TEST_ASSERT_EQUAL(JSON_OK,
+	                  json_easy_parse_projected(&proj, paths, NPATHS));
+	TEST_ASSERT(proj.tokens_len < easy.tokens_len / 4);
+
+	for (int i = 0; i < NPATHS; i++) {
+		json_easy_path_select(&easy, paths[i], 0, m1, MAXMATCH, &c1);
+		json_easy_path_select(&proj, paths[i], 0, m2, MAXMATCH, &c2);
+		TEST_ASSERT_EQUAL(c1, c2);
+		for (uint32_t j = 0; j < c1; j++)
+			check_same(easy.tokens, m1[j], proj.tokens, m2[j]);
+	}
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_lookup(&proj, 0, "user.id", &r));
+	TEST_ASSERT_EQUAL(JSON_NUMBER, proj.tokens[r].type);
+	TEST_ASSERT_EQUAL(JSONERR_LOOKUP,
+	                  json_easy_lookup(&proj, 0, "user.name", &r));
+
+	// Without a buffer, the count is the same.
+	p = json_parse_projected_n(twitapi_json, strlen(twitapi_json), paths,
+	                           NPATHS, NULL, 0);
+	TEST_ASSERT_EQUAL(JSON_OK, p.error);
+	TEST_ASSERT_EQUAL(proj.tokens_len, p.tokenidx);
+
+	// Hashes are kept in step with the tokens.
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_parse_hashed(&proj));
+	TEST_ASSERT_EQUAL(JSON_OK,
+	                  json_easy_parse_projected(&proj, paths, NPATHS));
+	TEST_ASSERT_EQUAL(p.tokenidx, proj.tokens_len);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_lookup(&proj, 0, "user.id", &r));
+	TEST_ASSERT_EQUAL(JSON_NUMBER, proj.tokens[r].type);
+
+	for (int i = 0; i < NPATHS; i++)
+		json_path_free(paths[i]);
+	json_easy_destroy(&proj);
+	json_easy_destroy(&easy);
+}
+
+/*
+ * Array elements up to the last one selected are kept, so that indices don't
+ * change, but the ones not selected have no members.
+ */
+static void test_arrays(void)
+{
+	static const char doc[] =
+		"[1, {\"a\": [2, 3]}, [4], {\"b\": 5}, {\"b\": 6}, 7]";
+	struct json_token t[16];
+	struct json_parser p;
+
+	p = project(doc, "[2]", t, 16);
+	TEST_ASSERT_EQUAL(JSON_OK, p.error);
+	TEST_ASSERT_EQUAL(sizeof(doc) - 1, p.textidx);
+	TEST_ASSERT_EQUAL(5, p.tokenidx);
+	TEST_ASSERT_EQUAL(3, t[0].length);
+	TEST_ASSERT_EQUAL(JSON_NUMBER, t[1].type);
+	TEST_ASSERT_EQUAL(2, t[1].next);
+	TEST_ASSERT_EQUAL(JSON_OBJECT, t[2].type);
+	TEST_ASSERT_EQUAL(0, t[2].length);
+	TEST_ASSERT_EQUAL(3, t[2].next);
+	TEST_ASSERT_EQUAL(JSON_ARRAY, t[3].type);
+	TEST_ASSERT_EQUAL(1, t[3].length);
+	TEST_ASSERT_EQUAL(0, t[3].next);
+
+	// Both "b"s are selected, and the 7 after them is dropped.
+	p = project(doc, "[*].b", t, 16);
+	TEST_ASSERT_EQUAL(JSON_OK, p.error);
+	TEST_ASSERT_EQUAL(10, p.tokenidx);
+	TEST_ASSERT_EQUAL(5, t[0].length);
+	TEST_ASSERT_EQUAL(0, t[2].length);
+	TEST_ASSERT_EQUAL(0, t[3].length);
+	TEST_ASSERT_EQUAL(1, t[4].length);
+	TEST_ASSERT_EQUAL(7, t[4].next);
+	TEST_ASSERT_EQUAL(0, t[7].next);
+	// A short buffer still gets the count right.
+	p = project(doc, "[*].b", t, 4);
+	TEST_ASSERT_EQUAL(JSON_OK, p.error);
+	TEST_ASSERT_EQUAL(10, p.tokenidx);
+
+	// Nothing selected leaves just the root.
+	p = project(doc, "[9]", t, 16);
+	TEST_ASSERT_EQUAL(JSON_OK, p.error);
+	TEST_ASSERT_EQUAL(1, p.tokenidx);
+	TEST_ASSERT_EQUAL(0, t[0].length);
+
+	// Selecting every element is the same as parsing it all.
+	p = project(doc, "[*]", t, 16);
+	TEST_ASSERT_EQUAL(JSON_OK, p.error);
+	TEST_ASSERT_EQUAL(json_parse(doc, NULL, 0).tokenidx, p.tokenidx);
+}
+
+/*
+ * Errors are found in the parts which are skipped, just where json_parse()
+ * finds them.
+ */
+static void test_errors(void)
+{
+	static const char *docs[] = {
+		"{\"a\": [1 2], \"b\": 1}",
+		"{\"a\": {\"x\": tru}, \"b\": 1}",
+		"{\"a\": \"\\q\", \"b\": 1}",
+		"{\"a\" 1, \"b\": 1}",
+		"{\"b\": 1, \"a\": [[[",
+		"{\"b\": [1, 2}",
+		"[-]",
+	};
+	struct json_token t[16];
+	struct json_parser p1, p2;
+	struct json_path *path;
+	uint32_t erridx;
+
+	for (size_t i = 0; i < sizeof(docs) / sizeof(docs[0]); i++) {
+		p1 = json_parse(docs[i], t, 16);
+		p2 = project(docs[i], "b", t, 16);
+		TEST_ASSERT(p1.error != JSON_OK);
+		TEST_ASSERT_EQUAL(p1.error, p2.error);
+		TEST_ASSERT_EQUAL(p1.textidx, p2.textidx);
+	}
+
+	TEST_ASSERT_EQUAL(JSON_OK, json_path_compile("..b", &path, &erridx));
+	p1 = json_parse_projected_n(docs[0], strlen(docs[0]), &path, 1, t, 16);
+	TEST_ASSERT_EQUAL(JSONERR_BAD_EXPR, p1.error);
+	json_path_free(path);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_twitapi);
+	RUN_TEST(test_arrays);
+	RUN_TEST(test_errors);
+	return UNITY_END();
+}
@@ -0,0 +1,217 @@
+/*
+ * test/sidecar.c: Tokens loaded from a file must be those which were saved
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <unity.h>
+
+#include "nosj.h"
+#include "twitapi.h"
+
+static char path[] = "/tmp/nosj-sidecar-XXXXXX";
+
+void setUp(void)
+{
+	int fd = mkstemp(path);
+
+	TEST_ASSERT(fd >= 0);
+	close(fd);
+}
+
+void tearDown(void)
+{
+	unlink(path);
+	strcpy(path + strlen(path) - 6, "XXXXXX");
+}
+
+static void test_save_load(void)
+{
+	struct json_easy saved, loaded;
+	uint32_t r1, r2;
+	int64_t i;
+
+	json_easy_init(&saved, twitapi_json);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_parse_hashed(&saved));
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_parse_ints(&saved));
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_index(&saved, SIZE_MAX));
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_save(&saved, path));
+
+	json_easy_init(&loaded, twitapi_json);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_load(&loaded, path));
+	TEST_ASSERT_EQUAL(saved.tokens_len, loaded.tokens_len);
+	TEST_ASSERT(memcmp(saved.tokens, loaded.tokens,
+	                   saved.tokens_len * sizeof(*saved.tokens)) == 0);
+	TEST_ASSERT(memcmp(saved.hashes, loaded.hashes,
+	                   saved.tokens_len * sizeof(*saved.hashes)) == 0);
+	TEST_ASSERT(loaded.ints != NULL);
+	TEST_ASSERT(loaded.index != NULL);
+
+	// Lookups go through the loaded index and integer values.
+	TEST_ASSERT_EQUAL(JSON_OK,
+	                  json_easy_lookup(&saved, 0, "user.followers_count",
+	                                   &r1));
+	TEST_ASSERT_EQUAL(JSON_OK,
+	                  json_easy_lookup(&loaded, 0, "user.followers_count",
+	                                   &r2));
+	TEST_ASSERT_EQUAL(r1, r2);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_number_getint(&loaded, r2, &i));
+	TEST_ASSERT(1212963 == i);
+	TEST_ASSERT_EQUAL(JSONERR_LOOKUP,
+	                  json_easy_lookup(&loaded, 0, "foobar", &r2));
+	json_easy_destroy(&loaded);
+	json_easy_destroy(&saved);
+}
+
+static void test_plain(void)
+{
+	struct json_easy easy;
+	uint32_t index;
+
+	// Saving parses first, and there may be no optional sections.
+	json_easy_init(&easy, twitapi_json);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_save(&easy, path));
+	json_easy_destroy(&easy);
+
+	json_easy_init(&easy, twitapi_json);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_load(&easy, path));
+	TEST_ASSERT(easy.hashes == NULL);
+	TEST_ASSERT(easy.ints == NULL);
+	TEST_ASSERT(easy.index == NULL);
+	TEST_ASSERT_EQUAL(JSON_OK,
+	                  json_easy_lookup(&easy, 0, "user.name", &index));
+
+	// Anything which changes the tokens copies them out of the file first.
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_parse_hashed(&easy));
+	TEST_ASSERT(easy.map == NULL);
+	TEST_ASSERT_EQUAL(JSON_OK,
+	                  json_easy_lookup(&easy, 0, "user.name", &index));
+	json_easy_destroy(&easy);
+}
+
+/* Read a whole file, which must be smaller than the buffer. */
+static size_t slurp(const char *name, char *buf, size_t cap)
+{
+	FILE *f = fopen(name, "rb");
+	size_t n;
+
+	TEST_ASSERT(f != NULL);
+	n = fread(buf, 1, cap, f);
+	fclose(f);
+	TEST_ASSERT(n < cap);
+	return n;
+}
+
+static void test_same_bytes(void)
+{
+	static char a[1 << 16], b[1 << 16];
+	struct json_easy easy;
+	struct json_path *path2;
+	char other[sizeof(path) + 2];
+	uint32_t err;
+	size_t na, nb;
+
+	// One save straight after parsing...
+	json_easy_init(&easy, twitapi_json);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_parse_ints(&easy));
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_parse_hashed(&easy));
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_save(&easy, path));
+	json_easy_destroy(&easy);
+
+	// ...and one after the buffers held other tokens, must be the same.
+	TEST_ASSERT_EQUAL(JSON_OK, json_path_compile("user.id", &path2, &err));
+	json_easy_init(&easy, twitapi_json);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_parse_ints(&easy));
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_parse_projected(&easy, &path2, 1));
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_parse_hashed(&easy));
+	strcpy(other, path);
+	strcat(other, ".2");
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_save(&easy, other));
+	json_easy_destroy(&easy);
+	json_path_free(path2);
+
+	na = slurp(path, a, sizeof(a));
+	nb = slurp(other, b, sizeof(b));
+	unlink(other);
+	TEST_ASSERT_EQUAL(na, nb);
+	TEST_ASSERT(memcmp(a, b, na) == 0);
+}
+
+static void test_projected(void)
+{
+	struct json_easy easy;
+	struct json_path *path2;
+	uint32_t err;
+
+	// Projected tokens would pass for the whole document, so aren't saved.
+	TEST_ASSERT_EQUAL(JSON_OK, json_path_compile("user.id", &path2, &err));
+	json_easy_init(&easy, twitapi_json);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_parse_projected(&easy, &path2, 1));
+	TEST_ASSERT(easy.projected);
+	TEST_ASSERT_EQUAL(JSONERR_STALE, json_easy_save(&easy, path));
+	json_easy_destroy(&easy);
+	json_path_free(path2);
+
+	json_easy_init(&easy, twitapi_json);
+	TEST_ASSERT_EQUAL(JSONERR_STALE, json_easy_load(&easy, path));
+	json_easy_destroy(&easy);
+}
+
+static void test_stale(void)
+{
+	struct json_easy easy;
+	char *copy = strdup(twitapi_json);
+
+	json_easy_init(&easy, twitapi_json);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_save(&easy, path));
+	json_easy_destroy(&easy);
+
+	// Same length, different contents.
+	*strstr(copy, "Twitter API") = 't';
+	json_easy_init(&easy, copy);
+	TEST_ASSERT_EQUAL(JSONERR_STALE, json_easy_load(&easy, path));
+	TEST_ASSERT(easy.tokens == NULL);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_parse(&easy));
+	json_easy_destroy(&easy);
+
+	json_easy_init(&easy, "[1, 2]");
+	TEST_ASSERT_EQUAL(JSONERR_STALE, json_easy_load(&easy, path));
+	json_easy_destroy(&easy);
+
+	// An empty file is no good either.
+	json_easy_init(&easy, "[1, 2]");
+	TEST_ASSERT(truncate(path, 0) == 0);
+	TEST_ASSERT_EQUAL(JSONERR_STALE, json_easy_load(&easy, path));
+	json_easy_destroy(&easy);
+	free(copy);
+}
+
+static void test_io(void)
+{
+	struct json_easy easy;
+
+	json_easy_init(&easy, "[1, 2]");
+	TEST_ASSERT_EQUAL(JSONERR_IO,
+	                  json_easy_load(&easy, "/nonexistent/nosj"));
+	TEST_ASSERT_EQUAL(JSONERR_IO,
+	                  json_easy_save(&easy, "/nonexistent/nosj"));
+	json_easy_destroy(&easy);
+
+	// Parser errors come before writing anything.
+	json_easy_init(&easy, "[1 2]");
+	TEST_ASSERT_EQUAL(JSONERR_MISSING_COMMA, json_easy_save(&easy, path));
+	json_easy_destroy(&easy);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_save_load);
+	RUN_TEST(test_plain);
+	RUN_TEST(test_same_bytes);
+	RUN_TEST(test_projected);
+	RUN_TEST(test_stale);
+	RUN_TEST(test_io);
+	return UNITY_END();
+}
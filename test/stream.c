@@ -0,0 +1,189 @@
+/*
+ * test/stream.c: Parsing input fed in pieces must agree with json_parse_n()
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include "nosj.h"
+#include "twitapi.h"
+
+void setUp(void)
+{
+	// set stuff up here
+}
+
+void tearDown(void)
+{
+	// clean stuff up here
+}
+
+/*
+ * Feed input to a stream in pieces of the given sizes (the last one repeated
+ * until the input runs out), copying each to a buffer of exactly that size so
+ * that the address sanitizer catches reads past the end, and check the result
+ * against json_parse_n().
+ */
+static void check_chunks(const char *input, uint32_t len, const uint32_t *sizes,
+                         uint32_t nsizes)
+{
+	struct json_parser p1 = json_parse_n(input, len, NULL, 0);
+	struct json_token *t1 = calloc(p1.tokenidx + 1, sizeof(*t1));
+	struct json_stream s;
+	struct json_parser p2;
+	uint32_t off = 0, k = 0;
+
+	json_parse_n(input, len, t1, p1.tokenidx);
+	TEST_ASSERT_EQUAL(JSON_OK, json_stream_init(&s));
+	while (off < len) {
+		uint32_t n = sizes[k < nsizes - 1 ? k++ : k];
+		char *chunk;
+		if (n > len - off)
+			n = len - off;
+		chunk = malloc(n ? n : 1);
+		memcpy(chunk, input + off, n);
+		json_stream_feed(&s, chunk, n);
+		free(chunk);
+		off += n;
+	}
+	p2 = json_stream_finish(&s);
+
+	TEST_ASSERT_EQUAL(p1.error, p2.error);
+	TEST_ASSERT_EQUAL(p1.textidx, p2.textidx);
+	TEST_ASSERT_EQUAL(p1.tokenidx, p2.tokenidx);
+	if (p1.error == JSON_OK)
+		TEST_ASSERT(!memcmp(t1, s.tokens, p1.tokenidx * sizeof(*t1)));
+	json_stream_destroy(&s);
+	free(t1);
+}
+
+/*
+ * Check input split into two at every point, and one byte at a time.
+ */
+static void check_splits(const char *input)
+{
+	uint32_t len = strlen(input);
+	uint32_t one = 1;
+
+	for (uint32_t split = 0; split <= len; split++) {
+		uint32_t sizes[] = { split, len };
+		check_chunks(input, len, sizes, 2);
+	}
+	check_chunks(input, len, &one, 1);
+}
+
+static void test_atomics(void)
+{
+	check_splits("true");
+	check_splits("false");
+	check_splits("null");
+	check_splits("  -12.5e+3  ");
+	check_splits("12");
+	check_splits("\"hello\"");
+	check_splits("\"a\\u00e9\\ud83d\\ude00\\n\"");
+	check_splits("tru");
+	check_splits("truex");
+	check_splits("");
+	check_splits("   ");
+}
+
+static void test_containers(void)
+{
+	check_splits("{}");
+	check_splits("[]");
+	check_splits("[ 1 , 2 , [3, {\"a\" : [true, false, null]}], \"x\" ]");
+	check_splits("{\"a\": 1, \"b\": {\"c\": [1, 2, 3]}, \"d\": \"e\"}");
+	check_splits("[1,]");
+	check_splits("{\"a\": 1,}");
+	check_splits("[1, 2] trailing garbage");
+}
+
+static void test_errors(void)
+{
+	check_splits("[1, 2");
+	check_splits("[1 2]");
+	check_splits("[1x]");
+	check_splits("[truex]");
+	check_splits("[trux]");
+	check_splits("{\"a\" 1}");
+	check_splits("{1: 2}");
+	check_splits("{\"a\": }");
+	check_splits("[\"abc");
+	check_splits("[\"a\\qb\"]");
+	check_splits("[\"a\\u12x4\"]");
+	check_splits("[\"a\"x]");
+	check_splits("[-]");
+	check_splits("[1.]");
+	check_splits("[1e+]");
+	check_splits("[01]");
+	check_splits("[\"\\ud800\"]");
+	check_splits("\"\\ud800");
+	check_splits("[\"\\ud800\\u0041\"]");
+}
+
+static void test_embedded_nul(void)
+{
+	uint32_t sizes[] = { 3, 1 };
+	check_chunks("[1, \0 2]", 8, sizes, 2);
+	check_chunks("[\"a\0b\"]", 7, sizes, 2);
+}
+
+static void test_too_deep(void)
+{
+	uint32_t depth = 1000000, n = 4096;
+	char *input = malloc(depth);
+
+	memset(input, '[', depth);
+	check_chunks(input, depth, &n, 1);
+	free(input);
+}
+
+static void test_partial_tokens(void)
+{
+	struct json_stream s;
+	struct json_parser p;
+
+	TEST_ASSERT_EQUAL(JSON_OK, json_stream_init(&s));
+	TEST_ASSERT_EQUAL(JSON_OK, json_stream_feed(&s, "{\"abc\": [1, \"x", 14));
+	// the object, key, array and first element are there already
+	TEST_ASSERT_EQUAL(4, s.p.tokenidx);
+	TEST_ASSERT_EQUAL(JSON_STRING, s.tokens[1].type);
+	TEST_ASSERT_EQUAL(3, s.tokens[1].length);
+	TEST_ASSERT_EQUAL(JSON_NUMBER, s.tokens[3].type);
+	TEST_ASSERT(!json_stream_done(&s));
+
+	TEST_ASSERT_EQUAL(JSON_OK, json_stream_feed(&s, "yz\"]}  [", 8));
+	TEST_ASSERT(json_stream_done(&s));
+	p = json_stream_finish(&s);
+	TEST_ASSERT_EQUAL(JSON_OK, p.error);
+	TEST_ASSERT_EQUAL(19, p.textidx);
+	TEST_ASSERT_EQUAL(5, p.tokenidx);
+	TEST_ASSERT_EQUAL(2, s.tokens[2].length);
+	TEST_ASSERT_EQUAL(3, s.tokens[4].length);
+	json_stream_destroy(&s);
+}
+
+static void test_twitapi(void)
+{
+	uint32_t len = strlen(twitapi_json);
+	uint32_t sizes[] = { 1, 7, 64, 1000, 4096 };
+
+	for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+		check_chunks(twitapi_json, len, &sizes[i], 1);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+
+	RUN_TEST(test_atomics);
+	RUN_TEST(test_containers);
+	RUN_TEST(test_errors);
+	RUN_TEST(test_embedded_nul);
+	RUN_TEST(test_too_deep);
+	RUN_TEST(test_partial_tokens);
+	RUN_TEST(test_twitapi);
+
+	return UNITY_END();
+}
@@ -0,0 +1,131 @@
+/*
+ * test/tape.c: A tape must hold the tokens of json_parse(), and find the same
+ */
+
+#include <string.h>
+#include <unity.h>
+
+#include "nosj.h"
+#include "twitapi.h"
+
+void setUp(void)
+{
+	// set stuff up here
+}
+
+void tearDown(void)
+{
+	// clean stuff up here
+}
+
+static void test_columns(void)
+{
+	struct json_easy easy;
+	struct json_tape tape;
+	struct json_token tok;
+
+	json_easy_init(&easy, twitapi_json);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_parse(&easy));
+	json_tape_init(&tape, twitapi_json, strlen(twitapi_json));
+	TEST_ASSERT_EQUAL(JSON_OK, json_tape_parse(&tape));
+	TEST_ASSERT_EQUAL(easy.tokens_len, tape.len);
+	for (uint32_t i = 0; i < tape.len; i++) {
+		tok = json_tape_token(&tape, i);
+		TEST_ASSERT_EQUAL(easy.tokens[i].type, tok.type);
+		TEST_ASSERT_EQUAL(easy.tokens[i].plain, tok.plain);
+		TEST_ASSERT_EQUAL(easy.tokens[i].start, tok.start);
+		TEST_ASSERT_EQUAL(easy.tokens[i].length, tok.length);
+		TEST_ASSERT_EQUAL(easy.tokens[i].next, tok.next);
+	}
+	json_tape_destroy(&tape);
+	json_easy_destroy(&easy);
+}
+
+static void test_lookup(void)
+{
+	static const char *exprs[] = {
+		"user.entities.url.urls[0].indices[1]",
+		"user.entities.url.urls[0].indices[2]",
+		"user.name",
+		"user.name.first",
+		"contributors[0]",
+		"favorited.x",
+		"foobar",
+		"entities.hashtags[*]",
+	};
+	struct json_easy easy;
+	struct json_tape tape;
+	uint32_t r1, r2, r3, n = 0;
+	int rv1, rv2;
+	int64_t i;
+	char s[32];
+
+	json_easy_init(&easy, twitapi_json);
+	TEST_ASSERT_EQUAL(JSON_OK, json_easy_parse(&easy));
+	json_tape_init(&tape, twitapi_json, strlen(twitapi_json));
+	TEST_ASSERT_EQUAL(JSON_OK, json_tape_parse(&tape));
+	for (size_t k = 0; k < sizeof(exprs) / sizeof(exprs[0]); k++) {
+		rv1 = json_easy_lookup(&easy, 0, exprs[k], &r1);
+		rv2 = json_tape_lookup(&tape, 0, exprs[k], &r2);
+		if (rv2 == JSONERR_BAD_EXPR)
+			continue;
+		TEST_ASSERT_EQUAL(rv1, rv2);
+		TEST_ASSERT_EQUAL(r1, r2);
+	}
+	TEST_ASSERT_EQUAL(JSONERR_BAD_EXPR,
+	                  json_tape_lookup(&tape, 0, "entities.*", &r2));
+
+	// Values are read as usual.
+	TEST_ASSERT_EQUAL(JSON_OK,
+	                  json_tape_lookup(&tape, 0, "user.name", &r2));
+	TEST_ASSERT(tape.length[r2] < sizeof(s));
+	TEST_ASSERT_EQUAL(JSON_OK, json_tape_string_load(&tape, r2, s));
+	TEST_ASSERT_EQUAL_STRING("Twitter API", s);
+	TEST_ASSERT_EQUAL(JSON_OK,
+	                  json_tape_lookup(&tape, 0, "user.followers_count",
+	                                   &r2));
+	TEST_ASSERT_EQUAL(JSON_OK, json_tape_number_getint(&tape, r2, &i));
+	TEST_ASSERT(1212963 == i);
+	TEST_ASSERT_EQUAL(JSON_OK,
+	                  json_tape_object_get(&tape, 0, "contributors", &r2));
+	json_tape_for_each(r1, &tape, r2) {
+		TEST_ASSERT_EQUAL(JSON_OK,
+		                  json_tape_array_get(&tape, r2, n++, &r3));
+		TEST_ASSERT_EQUAL(r1, r3);
+	}
+	TEST_ASSERT_EQUAL(tape.length[r2], n);
+	json_tape_destroy(&tape);
+	json_easy_destroy(&easy);
+}
+
+static void test_errors(void)
+{
+	struct json_tape tape;
+	uint32_t r;
+
+	json_tape_init(&tape, "[1 2]", 5);
+	TEST_ASSERT_EQUAL(JSONERR_MISSING_COMMA, json_tape_parse(&tape));
+	TEST_ASSERT_EQUAL(3, tape.error_at);
+	TEST_ASSERT_EQUAL(0, tape.len);
+	json_tape_destroy(&tape);
+
+	json_tape_init(&tape, "{\"a\\u0062\": [], \"b\": {}}", 24);
+	TEST_ASSERT_EQUAL(JSON_OK, json_tape_parse(&tape));
+	// The escaped key matches on its decoded contents.
+	TEST_ASSERT_EQUAL(JSON_OK, json_tape_object_get(&tape, 0, "ab", &r));
+	TEST_ASSERT_EQUAL(2, r);
+	TEST_ASSERT_EQUAL(JSONERR_INDEX, json_tape_array_get(&tape, r, 0, &r));
+	TEST_ASSERT_EQUAL(JSONERR_TYPE, json_tape_array_get(&tape, 0, 0, &r));
+	TEST_ASSERT_EQUAL(JSONERR_LOOKUP,
+	                  json_tape_lookup(&tape, 0, "b.c", &r));
+	json_tape_destroy(&tape);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_columns);
+	RUN_TEST(test_lookup);
+	RUN_TEST(test_errors);
+	return UNITY_END();
+}